@@ -9,11 +9,24 @@
 #define FILEPATH(x,ext,bff) std::string(std::string("Files/gamedata/BFF/")+bff+"/"+std::string(x)+ext).c_str()
 
 bff_file_t* bff;
-bff_level_t* levels;
-bff_texture_t* textures;
-bff_spawn_t* spawns;
 bffinfo_t bffinfo;
 
+typedef struct
+{
+    const char *base;
+    uint64_t size;
+    const bffheader_t* header;
+    const bffchunk_t* toc;
+    uint32_t first[NUMCHUNKTYPES];
+    uint32_t count[NUMCHUNKTYPES];
+    std::atomic<uint8_t>* checked;  // per chunk, set once its checksum's been verified
+    char **unpacked;                // per chunk, the zone copy of a compressed one, NULL for the rest
+    cache_user_t* cached;           // per chunk, compressed textures are read through the cache once the hunk's up
+    uint32_t* alias;                // per chunk, the first one of its type with the same payload
+} bffmap_t;
+
+static bffmap_t bffmap;
+
 typedef enum : uint8_t
 {
 	LVL_START,
@@ -56,102 +69,467 @@ int remove_recursive(const char* path)
     return remove(path);
 }
 
-void G_ExtractBFF(const std::string& filepath)
+//
+// G_CRC32: the zlib crc32, pass 0 to start and the last result to keep going. Goes
+// four bytes at a time (slicing-by-4), little endian only
+//
+uint32_t G_CRC32(uint32_t crc, const void *data, size_t size)
 {
-    Z_Init();
-    bff = (bff_file_t *)Z_Malloc(sizeof(bff_file_t), TAG_STATIC, &bff, "BFF");
+    static const struct crctable_s
+    {
+        uint32_t t[4][256];
+        crctable_s()
+        {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (uint32_t k = 0; k < 8; ++k)
+                    c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                t[0][i] = c;
+            }
+            for (uint32_t i = 0; i < 256; ++i) {
+                for (uint32_t k = 1; k < 4; ++k)
+                    t[k][i] = t[0][t[k - 1][i] & 0xff] ^ (t[k - 1][i] >> 8);
+            }
+        }
+    } crctable;
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t word;
 
-	bff->fp = fopen(filepath.c_str(), "rb");
-	if (!bff->fp) {
-		N_Error("G_ExtractBFF: failed to open file %s", filepath.c_str());
-	}
-	
-    memset(&bff->header, 0, sizeof(bffinfo_t));
-	fread(&bff->header, sizeof(bffinfo_t), 1, bff->fp);
-	if (bff->header.magic != HEADER_MAGIC) {
-		N_Error("G_ExtractBFF: header wasn't the correct constant, should be %lx, got %lx",
-			(uint64_t)HEADER_MAGIC, bff->header.magic);
-	}
-
-    LOG_INFO("number of level chunks to load: {}", bff->header.numlevels);
-    LOG_INFO("number of spawn chunks to load: {}", bff->header.numspawns);
-    LOG_INFO("number of sound chunks to load: {}", bff->header.numsounds);
-    LOG_INFO("number of texture chunks to load: {}", bff->header.numtextures);
-	
-	bff->levels = bff->header.numlevels
-        ? (bff_level_t *)Z_Malloc(sizeof(bff_level_t) * bff->header.numlevels, TAG_STATIC, &bff->levels, "bfflvls") : NULL;
-	bff->sounds = bff->header.numsounds
-        ? (bff_audio_t *)Z_Malloc(sizeof(bff_audio_t) * bff->header.numsounds, TAG_STATIC, &bff->sounds, "bffsnds") : NULL;
-	bff->spawns = bff->header.numspawns
-        ? (bff_spawn_t *)Z_Malloc(sizeof(bff_spawn_t) * bff->header.numspawns, TAG_STATIC, &bff->spawns, "bffspns") : NULL;
-    bff->textures = bff->header.numtextures
-        ? (bff_texture_t *)Z_Malloc(sizeof(bff_texture_t) * bff->header.numtextures, TAG_STATIC, &bff->textures, "bfftextures") : NULL;
-
-
-    for (uint16_t i = 0; i < bff->header.numlevels; ++i) {
-        bff_level_t* const ptr = &bff->levels[i];
-        memset(ptr, 0, sizeof(bff_level_t));
+    crc = ~crc;
+    while (size >= 4) {
+        memcpy(&word, p, sizeof(word));
+        crc ^= word;
+        crc = crctable.t[3][crc & 0xff] ^ crctable.t[2][(crc >> 8) & 0xff]
+            ^ crctable.t[1][(crc >> 16) & 0xff] ^ crctable.t[0][crc >> 24];
+        p += 4;
+        size -= 4;
+    }
+    while (size--)
+        crc = crctable.t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
 
-        LOG_INFO("loading level chunk {}", i);
-        fread(&ptr->spawncount, sizeof(uint16_t), 1, bff->fp);
-        if (ptr->spawncount) {
-            ptr->spawnlist = (uint16_t *)Z_Malloc(sizeof(uint16_t) * ptr->spawncount, TAG_STATIC, &ptr->spawnlist, "spnlist");
-            fread(ptr->spawnlist, sizeof(uint16_t), ptr->spawncount, bff->fp);
-        }
-        fread(ptr->lvl_map, sizeof(sprite_t), MAP_MAX_Y*MAP_MAX_X, bff->fp);
-#if 0
-        char *inbuffer;
-        unsigned int insize;
-        unsigned int destlen = sizeof(ptr->lvl_map);
-
-        fread(&insize, sizeof(unsigned int), 1, bff->fp);
-        inbuffer = (char *)malloc(insize);
-        if (!inbuffer) {
-            fclose(bff->fp);
-            N_Error("G_LoadBFF: malloc() failed");
-        }
-        fread(inbuffer, sizeof(char), insize, bff->fp);
-        int ret = BZ2_bzBuffToBuffDecompress((char *)ptr, &destlen, inbuffer, insize, 0, 0);
-        if (ret != BZ_OK) {
-            free(inbuffer);
-            fclose(bff->fp);
-            N_Error("G_LoadBFF: failed to decompress %i bytes using bzip2, error: %s", insize, bzip2_strerror(ret));
-        }
-        LOG_TRACE("successfully decompressed {} bytes of level data", insize);
-        free(inbuffer);
+static const char *G_MapFile(const char *path, uint64_t* size)
+{
+#ifdef _WIN32
+    HANDLE file, mapping;
+    LARGE_INTEGER fsize;
+    void *ptr;
+
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+    if (!GetFileSizeEx(file, &fsize) || !fsize.QuadPart) {
+        CloseHandle(file);
+        return NULL;
+    }
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return NULL;
+    // the view keeps the mapping alive
+    ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    *size = fsize.QuadPart;
+    return (const char *)ptr;
+#else
+    struct stat st;
+    void *ptr;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+    if (fstat(fd, &st) == -1 || !st.st_size) {
+        close(fd);
+        return NULL;
+    }
+    // the mapping keeps the file open
+    ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
+        return NULL;
+    *size = st.st_size;
+    return (const char *)ptr;
 #endif
+}
+
+//
+// G_ReadPayload: unpacks chunk i into out (or copies it if it isn't compressed) and lets go
+// of the mapping's pages behind it, nothing reads the packed copy again. The checksum gets
+// checked the first time since every byte's being read anyway
+//
+static void G_ReadPayload(uint32_t i, char *out)
+{
+    const bffchunk_t* c = &bffmap.toc[i];
+    const char *data = bffmap.base + c->offset;
+    uint64_t size = 0;
+
+    if (!bffmap.checked[i].load(std::memory_order_acquire)) {
+        if (G_CRC32(0, data, c->size) != c->checksum)
+            N_Error("G_ReadPayload: chunk %u is corrupt", i);
+        bffmap.checked[i].store(1, std::memory_order_release);
     }
-    for (uint16_t i = 0; i < bff->header.numspawns; ++i) {
-        bff_spawn_t* const ptr = &bff->spawns[i];
-        memset(ptr, 0, sizeof(bff_spawn_t));
 
-        LOG_INFO("loading spawn chunk {}", i);
-        fread(&ptr->what, sizeof(uint8_t), 1, bff->fp);
-        fread(&ptr->replacement, sizeof(sprite_t), 1, bff->fp);
-        fread(&ptr->marker, sizeof(sprite_t), 1, bff->fp);
+    switch (c->codec) {
+    case BC_LZ4: {
+        const int ret = LZ4_decompress_safe(data, out, (int)c->size, (int)c->rawsize);
+        size = ret < 0 ? 0 : (uint64_t)ret;
+        break; }
+    case BC_ZSTD: {
+        const size_t ret = ZSTD_decompress(out, c->rawsize, data, c->size);
+        size = ZSTD_isError(ret) ? 0 : ret;
+        break; }
+    default:
+        memcpy(out, data, c->size);
+        size = c->size;
+        break;
+    };
+    if (size != c->rawsize)
+        N_Error("G_ReadPayload: chunk %u didn't decompress to %lu bytes", i, c->rawsize);
+
+#ifdef __unix__
+    // the mapping's read only, a page that's shared with a chunk somebody's still using just
+    // gets faulted back in
+    const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    const uintptr_t start = (uintptr_t)data & ~(page - 1);
+    const uintptr_t end = ((uintptr_t)data + c->size + page - 1) & ~(page - 1);
+    if (end > start)
+        madvise((void *)start, end - start, MADV_DONTNEED);
+#endif
+}
+
+// G_UnpackChunk: a job, decompresses one chunk into the zone
+static void G_UnpackChunk(void *arg)
+{
+    const uint32_t i = (uint32_t)(uintptr_t)arg;
+    const bffchunk_t* c = &bffmap.toc[i];
+    char *out;
+
+    // same alignment it'd have had in the mapping
+    out = (char *)Z_AlignedAlloc(c->align, c->rawsize, TAG_STATIC, &bffmap.unpacked[i], "bffchunk");
+    G_ReadPayload(i, out);
+    bffmap.unpacked[i] = out;
+}
+
+//
+// G_UnpackBFF: fans the compressed chunks out over the job workers, everything else stays
+// in the mapping. Sectors are left packed, they're paged in one at a time (g_sector.cpp),
+// and so are textures when there's a cache to read them through (G_BFFCacheChunk)
+//
+static void G_UnpackBFF(void)
+{
+    job_t* jobs;
+    jobcounter_t pending{0};
+    uint64_t packed, raw;
+    uint32_t i, n;
+
+    jobs = (job_t *)Z_Malloc(sizeof(job_t) * (bffmap.header->numchunks + 1), TAG_STATIC, &jobs, "bffunpackjobs");
+    n = 0;
+    packed = raw = 0;
+    for (i = 0; i < bffmap.header->numchunks; ++i) {
+        // aliases get the copy their first one unpacks
+        if (bffmap.toc[i].codec == BC_NONE || bffmap.toc[i].type == CT_SECTOR || bffmap.alias[i] != i)
+            continue;
+        if (bffmap.cached && bffmap.toc[i].type == CT_TEXTURE)
+            continue;
+        jobs[n].func = G_UnpackChunk;
+        jobs[n].arg = (void *)(uintptr_t)i;
+        jobs[n].name = "bffunpack";
+        ++n;
+        packed += bffmap.toc[i].size;
+        raw += bffmap.toc[i].rawsize;
     }
-    for (uint16_t i = 0; i < bff->header.numtextures; ++i) {
-        bff_texture_t* const ptr = &bff->textures[i];
-        memset(ptr, 0, sizeof(bff_texture_t));
-        
-        LOG_INFO("loading texture chunk {}", i);
-        fread(&ptr->fsize, sizeof(uint64_t), 1, bff->fp);
-        ptr->buffer = (char *)Z_Malloc(ptr->fsize, TAG_STATIC, &ptr->buffer);
-        fread(ptr->buffer, sizeof(char), ptr->fsize, bff->fp);
-    }
-    for (uint16_t i = 0; i < bff->header.numsounds; ++i) {
-        bff_audio_t* const ptr = &bff->sounds[i];
-        memset(ptr, 0, sizeof(bff_audio_t));
-        LOG_INFO("loading audio chunk {}", i);
-
-        fread(&ptr->lvl_index, sizeof(int32_t), 1, bff->fp);
-        fread(&ptr->fsize, sizeof(uint64_t), 1, bff->fp);
-        if (ptr->fsize) {
-            ptr->filebuf = (char *)Z_Malloc(ptr->fsize, TAG_STATIC, &ptr->filebuf, "sndfilebuf");
-            fread(ptr->filebuf, sizeof(char), ptr->fsize, bff->fp);
-        }
+    N_RunJobs(jobs, n, &pending);
+    N_WaitJobs(&pending);
+    Z_Free(jobs);
+
+    if (n)
+        LOG_INFO("G_UnpackBFF: unpacked {} chunks, {} bytes to {}", n, packed, raw);
+}
+
+// G_PrefetchChunk: the cache's i/o thread side of G_PrefetchBFF
+static bool G_PrefetchChunk(void *data, size_t size, void *arg)
+{
+    G_ReadPayload((uint32_t)(uintptr_t)arg, (char *)data);
+    return true;
+}
+
+//
+// G_PrefetchBFF: queues the packed textures on the cache's i/o thread in archive order, so
+// R_BFFTexture finds them unpacked. Only up to half of the cache, anything past that would
+// just push the first ones back out
+//
+static void G_PrefetchBFF(void)
+{
+    const size_t space = (hunk_size - hunk_low_used - hunk_high_used) / 2;
+    size_t queued;
+    uint32_t i, n;
+
+    queued = 0;
+    n = 0;
+    for (i = bffmap.first[CT_TEXTURE]; i < bffmap.first[CT_TEXTURE] + bffmap.count[CT_TEXTURE]; ++i) {
+        const bffchunk_t* c = &bffmap.toc[i];
+
+        if (c->codec == BC_NONE || bffmap.alias[i] != i)
+            continue;
+        if (queued + c->rawsize > space)
+            break;
+        Cache_Prefetch(&bffmap.cached[i], c->rawsize, G_PrefetchChunk, (void *)(uintptr_t)i, 0, "bffchunk");
+        queued += c->rawsize;
+        ++n;
+    }
+    if (n)
+        LOG_INFO("G_PrefetchBFF: prefetching {} textures, {} bytes", n, queued);
+}
+
+//
+// G_MapBFF: maps a v2 archive and checks that the toc is sane. Compressed chunks other than
+// sectors get unpacked right away, the rest aren't touched until somebody asks for them
+//
+void G_MapBFF(const char *path)
+{
+    std::unordered_map<uint64_t, uint32_t> payloads;
+    const bffchunk_t* c;
+    uint64_t size;
+    uint32_t i, numaliases;
+
+    G_UnmapBFF();
+
+    bffmap.base = G_MapFile(path, &size);
+    if (!bffmap.base)
+        N_Error("G_MapBFF: failed to map file %s", path);
+    bffmap.size = size;
+    if (size < sizeof(bffheader_t))
+        N_Error("G_MapBFF: %s is too small to be a bff", path);
+
+    bffmap.header = (const bffheader_t *)bffmap.base;
+    if (bffmap.header->magic == (uint32_t)HEADER_MAGIC)
+        N_Error("G_MapBFF: %s is a v1 bff, rewrite it with -bff convert %s <output>", path, path);
+    if (bffmap.header->magic != BFF_MAGIC) {
+        N_Error("G_MapBFF: header wasn't the correct constant, should be %x, got %x",
+            BFF_MAGIC, bffmap.header->magic);
+    }
+    if (bffmap.header->version != BFF_VERSION)
+        N_Error("G_MapBFF: %s is version %u, only version %i is supported", path, bffmap.header->version, BFF_VERSION);
+    if (bffmap.header->filesize != size)
+        N_Error("G_MapBFF: %s is %lu bytes, its header says %lu", path, size, bffmap.header->filesize);
+    if ((size - sizeof(bffheader_t)) / sizeof(bffchunk_t) < bffmap.header->numchunks)
+        N_Error("G_MapBFF: %s is too small for its table of contents", path);
+
+    bffmap.toc = (const bffchunk_t *)(bffmap.base + sizeof(bffheader_t));
+    if (G_CRC32(0, bffmap.toc, sizeof(bffchunk_t) * bffmap.header->numchunks) != bffmap.header->tocchecksum)
+        N_Error("G_MapBFF: %s has a corrupt table of contents", path);
+
+    memset(bffmap.first, 0, sizeof(bffmap.first));
+    memset(bffmap.count, 0, sizeof(bffmap.count));
+    for (i = 0; i < bffmap.header->numchunks; ++i) {
+        c = &bffmap.toc[i];
+        if (c->type >= NUMCHUNKTYPES || (i && c->type < bffmap.toc[i - 1].type))
+            N_Error("G_MapBFF: chunk %u in %s has a bad type (%i)", i, path, c->type);
+        if (!c->align || (c->align & (c->align - 1)) || c->offset % c->align)
+            N_Error("G_MapBFF: chunk %u in %s is misaligned", i, path);
+        if (c->offset > size || c->size > size - c->offset)
+            N_Error("G_MapBFF: chunk %u in %s runs off the end of the file", i, path);
+        if (c->codec >= NUMBFFCODECS || (c->codec == BC_NONE && c->rawsize != c->size) || c->rawsize > INT32_MAX)
+            N_Error("G_MapBFF: chunk %u in %s has a bad codec (%i)", i, path, c->codec);
+        if ((c->type == CT_SECTOR && c->rawsize != sizeof(bff_sectormap_t))
+        || (c->type == CT_LEVEL && c->rawsize % sizeof(uint16_t))
+        || (c->type == CT_SPAWN && c->rawsize != sizeof(bff_spawnchunk_t)))
+            N_Error("G_MapBFF: chunk %u in %s is the wrong size", i, path);
+
+        if (!bffmap.count[c->type])
+            bffmap.first[c->type] = i;
+        ++bffmap.count[c->type];
     }
-	fclose(bff->fp);
+    if (bffmap.count[CT_SECTOR] != bffmap.count[CT_LEVEL] * NUMSECTORS)
+        N_Error("G_MapBFF: %s has %u sectors for %u levels", path, bffmap.count[CT_SECTOR], bffmap.count[CT_LEVEL]);
+
+    // a chunk sharing an earlier one's offset has to be the same payload, stored the same way
+    bffmap.alias = (uint32_t *)Z_Malloc(sizeof(uint32_t) * (bffmap.header->numchunks + 1), TAG_STATIC, &bffmap.alias, "bffalias");
+    numaliases = 0;
+    for (i = 0; i < bffmap.header->numchunks; ++i) {
+        c = &bffmap.toc[i];
+        bffmap.alias[i] = i;
+        if (!c->size)
+            continue;
+
+        const auto it = payloads.emplace(c->offset | (uint64_t)c->type << 56, i);
+        if (it.second)
+            continue;
+        const bffchunk_t* first = &bffmap.toc[it.first->second];
+        if (first->size != c->size || first->rawsize != c->rawsize || first->codec != c->codec || first->checksum != c->checksum)
+            N_Error("G_MapBFF: chunk %u in %s overlaps chunk %u", i, path, it.first->second);
+        bffmap.alias[i] = it.first->second;
+        ++numaliases;
+    }
+
+    bffmap.checked = (std::atomic<uint8_t> *)Z_Malloc(sizeof(std::atomic<uint8_t>) * (bffmap.header->numchunks + 1), TAG_STATIC, &bffmap.checked, "bffchecked");
+    for (i = 0; i < bffmap.header->numchunks; ++i)
+        new (&bffmap.checked[i]) std::atomic<uint8_t>(0);
+    bffmap.unpacked = (char **)Z_Malloc(sizeof(char *) * (bffmap.header->numchunks + 1), TAG_STATIC, &bffmap.unpacked, "bffunpacked");
+    memset(bffmap.unpacked, 0, sizeof(char *) * bffmap.header->numchunks);
+    if (hunk_base) {
+        bffmap.cached = (cache_user_t *)Z_Malloc(sizeof(cache_user_t) * (bffmap.header->numchunks + 1), TAG_STATIC, &bffmap.cached, "bffcached");
+        memset(bffmap.cached, 0, sizeof(cache_user_t) * bffmap.header->numchunks);
+    }
+    G_UnpackBFF();
+    if (bffmap.cached)
+        G_PrefetchBFF();
+    G_InitSectors();
+
+    bffinfo.numlevels = bffmap.count[CT_LEVEL];
+    bffinfo.numspawns = bffmap.count[CT_SPAWN];
+    bffinfo.numtextures = bffmap.count[CT_TEXTURE];
+    bffinfo.numsounds = bffmap.count[CT_SOUND];
+
+    LOG_INFO("G_MapBFF: mapped {}, {} bytes in {} chunks, {} of them shared", path, size, bffmap.header->numchunks, numaliases);
+}
+
+static void G_UnmapFile(const char *base, uint64_t size)
+{
+#ifdef _WIN32
+    UnmapViewOfFile(base);
+#else
+    munmap((void *)base, size);
+#endif
+}
+
+void G_UnmapBFF(void)
+{
+    if (!bffmap.base)
+        return;
+
+    // the sector jobs are still reading out of the mapping
+    G_ShutdownSectors();
+
+    // nothing but chunks out of the mapping goes in the cache
+    if (bffmap.cached) {
+        Cache_Flush();
+        Z_Free(bffmap.cached);
+    }
+
+    // the chunk count's in the mapping
+    for (uint32_t i = 0; i < bffmap.header->numchunks; ++i) {
+        if (bffmap.unpacked[i])
+            Z_Free(bffmap.unpacked[i]);
+    }
+    Z_Free(bffmap.unpacked);
+    G_UnmapFile(bffmap.base, bffmap.size);
+    Z_Free(bffmap.checked);
+    Z_Free(bffmap.alias);
+    memset(&bffmap, 0, sizeof(bffmap));
+}
+
+uint32_t G_BFFNumChunks(bffchunktype_t type)
+{
+    return bffmap.count[type];
+}
+
+const bffchunk_t* G_BFFChunkInfo(bffchunktype_t type, uint32_t index)
+{
+    if (index >= bffmap.count[type])
+        N_Error("G_BFFChunkInfo: chunk %u of type %i out of range", index, type);
+    return &bffmap.toc[bffmap.first[type] + index];
+}
+
+// the view's good for as long as the archive's mapped
+const void* G_BFFChunk(bffchunktype_t type, uint32_t index, uint64_t* size)
+{
+    const bffchunk_t* c = G_BFFChunkInfo(type, index);
+    const uint32_t first = bffmap.alias[c - bffmap.toc];
+    const char *data = bffmap.base + c->offset;
+    std::atomic<uint8_t>* checked = &bffmap.checked[first];
+
+    if (bffmap.unpacked[first]) {
+        if (size)
+            *size = c->rawsize;
+        return bffmap.unpacked[first];
+    }
+    if (c->codec != BC_NONE)
+        N_Error("G_BFFChunk: chunk %u of type %i is still packed, it has to be paged in or cached", index, type);
+    // the first look pays for reading it all in anyway, two threads checking it at once is harmless
+    if (!checked->load(std::memory_order_acquire)) {
+        if (G_CRC32(0, data, c->size) != c->checksum)
+            N_Error("G_BFFChunk: chunk %u of type %i is corrupt", index, type);
+        checked->store(1, std::memory_order_release);
+    }
+    if (size)
+        *size = c->size;
+    return data;
+}
+
+//
+// G_BFFCacheChunk: G_BFFChunk for the chunks that are left packed for the cache, a miss
+// unpacks it into a new cache entry. The view's only good until the next cache or hunk
+// allocation, use it and let go of it
+//
+const void* G_BFFCacheChunk(bffchunktype_t type, uint32_t index, uint64_t* size)
+{
+    const bffchunk_t* c = G_BFFChunkInfo(type, index);
+    const uint32_t first = bffmap.alias[c - bffmap.toc];
+    cache_user_t* cu;
+    void *data;
+
+    if (!bffmap.cached || c->codec == BC_NONE || bffmap.unpacked[first])
+        return G_BFFChunk(type, index, size);
+
+    // G_PrefetchBFF might already have it on the way
+    cu = &bffmap.cached[first];
+    Cache_Wait(cu);
+    data = Cache_Check(cu);
+    if (!data) {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        data = Cache_Alloc(cu, c->rawsize, "bffchunk");
+        G_ReadPayload(first, (char *)data);
+
+        // what it took to unpack is what it costs to throw out, gdsf keeps the expensive ones
+        Cache_SetCost(cu, std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    if (size)
+        *size = c->rawsize;
+    return data;
+}
+
+uint32_t G_BFFChunkAlias(bffchunktype_t type, uint32_t index)
+{
+    const bffchunk_t* c = G_BFFChunkInfo(type, index);
+    return bffmap.alias[c - bffmap.toc] - bffmap.first[type];
+}
+
+void G_ReadChunk(bffchunktype_t type, uint32_t index, void *out)
+{
+    const bffchunk_t* c = G_BFFChunkInfo(type, index);
+    G_ReadPayload(bffmap.alias[c - bffmap.toc], (char *)out);
+}
+
+const uint16_t* G_BFFLevelSpawns(uint32_t level, uint32_t* count)
+{
+    uint64_t size;
+    const void *data = G_BFFChunk(CT_LEVEL, level, &size);
+
+    *count = size / sizeof(uint16_t);
+    return (const uint16_t *)data;
+}
+
+const bff_spawnchunk_t* G_BFFSpawn(uint32_t index)
+{
+    return (const bff_spawnchunk_t *)G_BFFChunk(CT_SPAWN, index, NULL);
+}
+
+void G_ExtractBFF(const std::string& filepath)
+{
+    const void *data;
+    uint64_t size;
+
+    Z_Init();
+    G_MapBFF(filepath.c_str());
+
+    LOG_INFO("number of level chunks to extract: {}", bffinfo.numlevels);
+    LOG_INFO("number of spawn chunks to extract: {}", bffinfo.numspawns);
+    LOG_INFO("number of sound chunks to extract: {}", bffinfo.numsounds);
+    LOG_INFO("number of texture chunks to extract: {}", bffinfo.numtextures);
 
     std::string outdir = "Files/gamedata/BFF/"+filepath;
 #ifdef __unix__
@@ -184,6 +562,7 @@ void G_ExtractBFF(const std::string& filepath)
         }
         else {
             LOG_INFO("canceling extraction");
+            N_ShutdownJobs();
             exit(EXIT_SUCCESS);
         }
     }
@@ -191,61 +570,103 @@ void G_ExtractBFF(const std::string& filepath)
     outdir += "/";
     LOG_INFO("output directory: {}", outdir);
     
-    for (uint16_t i = 0; i < bff->header.numlevels; ++i) {
+    // levels go back together as the map followed by the spawnlist, the rest is straight
+    // out of the mapping. Sectors skip the resident set, they're only looked at the once
+    for (uint16_t i = 0; i < bffinfo.numlevels; ++i) {
         LOG_INFO("extracting level chunk {}", i);
         std::string path = "NMLVLFILE_"+std::to_string((int)i);
-        N_WriteFile(FILEPATH(path, ".blf", filepath), &bff->levels[i], (MAP_MAX_Y * MAP_MAX_Y));
+        data = G_BFFChunk(CT_LEVEL, i, &size);
+        char *level = (char *)xmalloc(sizeof(bff_levelmap_t) + size);
+        for (uint32_t m = 0; m < NUMSECTORS; ++m)
+            G_ReadChunk(CT_SECTOR, i * NUMSECTORS + m, level + sizeof(bff_sectormap_t) * m);
+        memcpy(level + sizeof(bff_levelmap_t), data, size);
+        N_WriteFile(FILEPATH(path, ".blf", filepath), level, sizeof(bff_levelmap_t) + size);
+        xfree(level);
     }
     
-    for (uint16_t i = 0; i < bff->header.numspawns; ++i) {
+    for (uint16_t i = 0; i < bffinfo.numspawns; ++i) {
         LOG_INFO("extracting spawn chunk {}", i);
         std::string path = "NMSPNFILE_"+std::to_string((int)i);
-        N_WriteFile(FILEPATH(path, ".bsf", filepath), &bff->spawns[i], sizeof(bff_spawn_t) - sizeof(void *));
+        data = G_BFFChunk(CT_SPAWN, i, &size);
+        N_WriteFile(FILEPATH(path, ".bsf", filepath), data, size);
     }
 
-    for (uint16_t i = 0; i < bff->header.numtextures; ++i) {
+    for (uint16_t i = 0; i < bffinfo.numtextures; ++i) {
         LOG_INFO("extracting texture chunk {}", i);
         std::string path = "NMTEXFILE_"+std::to_string((int)i);
-        N_WriteFile(FILEPATH(path, ".bmp", filepath), bff->textures[i].buffer, bff->textures[i].fsize);
+        data = G_BFFChunk(CT_TEXTURE, i, &size);
+        N_WriteFile(FILEPATH(path, ".bmp", filepath), data, size);
     }
 
-    for (uint16_t i = 0; i < bff->header.numsounds; ++i) {
+    for (uint16_t i = 0; i < bffinfo.numsounds; ++i) {
         LOG_INFO("extracting audio chunk {}", i);
         std::string path = "NMSNDFILE_"+std::to_string((int)i);
-        N_WriteFile(FILEPATH(path, ".ogg", filepath), bff->sounds[i].filebuf, bff->sounds[i].fsize);
+        data = G_BFFChunk(CT_SOUND, i, &size);
+        N_WriteFile(FILEPATH(path, ".ogg", filepath), data, size);
     }
 
     FILE *fp = fopen(FILEPATH("bffinfo", ".dat", filepath), "wb");
     if (!fp) {
         N_Error("G_ExtractBFF: failed to create bff info file");
     }
-    fwrite(&bff->header, sizeof(bffinfo_t), 1, fp);
+    fwrite(&bffinfo, sizeof(bffinfo_t), 1, fp);
     fclose(fp);
     
+    N_ShutdownJobs();
     exit(EXIT_SUCCESS);
 }
 
 void G_LoadBFF(const std::string& bffname)
 {
-    bffinfo_t *header;
     Z_Init();
-    N_ReadFile(FILEPATH("bffinfo", ".dat", bffname), (char **)&header);
-
-    std::vector<nomadsnd_t> sounds(header->numsounds);
-    memset(sounds.data(), 0, sounds.size() * sizeof(nomadsnd_t));
-    for (uint16_t i = 0; i < header->numsounds; ++i) {
-        std::string filepath = "NMSNDFILE_"+std::to_string((int)i);
-        int channels{};
-        int samplerate{};
-        short* buffer;
-        int ret = stb_vorbis_decode_filename(FILEPATH(filepath, ".ogg", bffname), &channels, &samplerate, &buffer);
-        
-        alGenSources(1, &sounds[i].source);
-        alGenBuffers(1, &sounds[i].buffer);
-        alBufferData(sounds[i].buffer, channels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16,
-            buffer, ret, samplerate);
-        alSourcei(sounds[i].source, AL_BUFFER, sounds[i].buffer);
-        xfree(buffer);
+    Memory_Init();
+    G_MapBFF(bffname.c_str());
+
+    // scratch for the load goes on the high end of the hunk and all of it goes when this
+    // returns, whatever has to stay is copied out into its zone first
+    HunkScope load("loadbff", true);
+    nomadsnd_t* sounds = (nomadsnd_t *)Hunk_HighAllocName(sizeof(nomadsnd_t) * (bffinfo.numsounds + 1), "sounds");
+    if (!sounds)
+        N_Error("G_LoadBFF: no room in the hunk for %u sounds", bffinfo.numsounds);
+    for (uint16_t i = 0; i < bffinfo.numsounds; ++i) {
+        nomadsnd_t* snd = &sounds[i];
+        const uint32_t first = G_BFFChunkAlias(CT_SOUND, i);
+
+        // every sound gets its own source, the same file twice only gets decoded and buffered once
+        alGenSources(1, &snd->source);
+        if (first != i) {
+            snd->buffer = sounds[first].buffer;
+            snd->samplerate = sounds[first].samplerate;
+            snd->channels = sounds[first].channels;
+            snd->length = sounds[first].length;
+            snd->alias = true;
+        }
+        else {
+            short* buffer = NULL;
+            uint64_t size;
+            int error;
+            const void *data = G_BFFChunk(CT_SOUND, i, &size);
+            stb_vorbis *vorbis = stb_vorbis_open_memory((const unsigned char *)data, (int)size, &error, NULL);
+
+            // the pcm only lives until openal has its copy, decode it straight into the audio zone
+            if (vorbis) {
+                const stb_vorbis_info info = stb_vorbis_get_info(vorbis);
+                snd->channels = info.channels;
+                snd->samplerate = info.sample_rate;
+                snd->length = stb_vorbis_stream_length_in_samples(vorbis) * info.channels;
+                buffer = (short *)Z_ZoneMalloc(ZONE_AUDIO, snd->length * sizeof(short) + 1, TAG_STATIC, NULL, "pcm");
+                // returns samples per channel
+                snd->length = stb_vorbis_get_samples_short_interleaved(vorbis, info.channels, buffer, snd->length) * info.channels;
+                stb_vorbis_close(vorbis);
+            }
+            alGenBuffers(1, &snd->buffer);
+            alBufferData(snd->buffer, snd->channels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16,
+                buffer, snd->length * sizeof(short), snd->samplerate);
+            if (buffer)
+                Z_Free(buffer);
+        }
+        alSourcei(snd->source, AL_BUFFER, snd->buffer);
+        alSourcef(snd->source, AL_GAIN, scf::audio::sfx_vol);
     }
 
     LOG_INFO("initiazing renderer");
@@ -253,79 +674,611 @@ void G_LoadBFF(const std::string& bffname)
 
     Game::Init();
 
-    // pre-cache the bff stuff
-    memmove(&bffinfo, header, sizeof(bffinfo_t));
-    xfree(header);
+    // spawnlists, spawns and textures stay where they are in the mapping, G_BFFLevelSpawns
+    // and friends hand them out. Sectors are paged in as the player gets near them
 
-    levels = bffinfo.numlevels
-        ? (bff_level_t *)Z_Malloc(sizeof(bff_level_t) * bffinfo.numlevels, TAG_STATIC, &levels, "bfflvls") : NULL;
-	//bff->sounds = bff->header.numsounds
-    //    ? (bff_audio_t *)Z_Malloc(sizeof(bff_audio_t) * bff->header.numsounds, TAG_CACHE, &bff->sounds) : NULL;
-	spawns = bffinfo.numspawns
-        ? (bff_spawn_t *)Z_Malloc(sizeof(bff_spawn_t) * bffinfo.numspawns, TAG_STATIC, &spawns, "bffspns") : NULL;
-    textures = bffinfo.numtextures
-        ? (bff_texture_t *)Z_Malloc(sizeof(bff_texture_t) * bffinfo.numtextures, TAG_STATIC, &textures, "bfftextures") : NULL;
-
-    for (uint16_t i = 0; i < bffinfo.numlevels; ++i) {
-        std::string filepath = "NMLVLFILE_"+std::to_string(i);
-        char *buffer;
-        size_t size = N_ReadFile(FILEPATH(filepath, ".blf", bffname), &buffer);
-        memcpy(&levels[i], buffer, sizeof(bff_level_t));
-        xfree(buffer);
-    }
-
-    // transfer sound data from malloc to the zone
-    sfx_cache = (nomadsnd_t *)Z_Malloc(sizeof(nomadsnd_t) * sounds.size(), TAG_STATIC, &sfx_cache);
-    memcpy(sfx_cache, sounds.data(), sizeof(nomadsnd_t) * sounds.size());
-    sounds.clear();
+    // transfer sound data from the hunk to the audio zone
+    sfx_cache = (nomadsnd_t *)Z_ZoneMalloc(ZONE_AUDIO, sizeof(nomadsnd_t) * bffinfo.numsounds, TAG_STATIC, &sfx_cache, "sfxcache");
+    memcpy(sfx_cache, sounds, sizeof(nomadsnd_t) * bffinfo.numsounds);
 
     // all mob/non-player-entity memory will be slapped onto the heap from this point forward,
     // and everything with TAG_CACHE or TAG_STATIC will remain allocated for the entirety of
     // runtime
 
-    for (uint16_t i = 1; i < bffinfo.numspawns + 1; ++i) {
-        Game::Get()->entities.emplace_back();
-        memset(&Game::Get()->entities.back(), 0, sizeof(entity_t));
+    Game::Get()->registry.Clear();
+    for (uint16_t i = 1; i < bffinfo.numspawns + 1; ++i)
+        Game::Get()->entities.Spawn();
+    
+    // spawned entities start out zeroed, the player is always the first one
+    if (!Game::Get()->entities.size())
+        Game::Get()->entities.Spawn();
+    Game::Get()->playr->p = Game::Get()->entities.Handle(0);
+
+    Z_Print(true);
+}
+
+typedef struct
+{
+    const void *parts[2];
+    uint64_t sizes[2];
+    char *packed;           // the compressed copy if there is one, it replaces the parts
+} bffpayload_t;
+
+typedef struct
+{
+    const char *name;
+    bffcodec_t codec;
+    int level;              // 0 for lz4 is the fast one, anything else is lz4hc
+} bffpacker_t;
+
+static const bffpacker_t bffpackers[] = {
+    {"none",    BC_NONE, 0},
+    {"lz4",     BC_LZ4,  0},
+    {"lz4hc",   BC_LZ4,  LZ4HC_CLEVEL_DEFAULT},
+    {"zstd",    BC_ZSTD, 3},
+    {"zstdmax", BC_ZSTD, 19},
+};
+
+#define BFF_MINSAVING 16    // a chunk has to shrink by at least 1/16th to be worth unpacking
+
+static const bffpacker_t* G_FindPacker(const char *name)
+{
+    if (!name)
+        name = "lz4";
+    for (uint32_t i = 0; i < arraylen(bffpackers); ++i) {
+        if (!N_strcasecmp(bffpackers[i].name, name))
+            return &bffpackers[i];
     }
-    for (uint16_t i = 0; i < bffinfo.numsounds; ++i) {
-        alGenSources(1, &sfx_cache[i].source);
-        alGenBuffers(1, &sfx_cache[i].buffer);
-        alSourcei(sfx_cache[i].source, AL_BUFFER, sfx_cache[i].buffer);
-        alBufferData(sfx_cache[i].buffer, sfx_cache[i].channels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16,
-            sfx_cache[i].sndbuf, sfx_cache[i].length * sizeof(short), sfx_cache[i].samplerate);
-        alSourcef(sfx_cache[i].source, AL_GAIN, scf::audio::sfx_vol);
+    N_Error("G_WriteBFF: unknown codec %s, it's none, lz4, lz4hc, zstd or zstdmax", name);
+    return NULL;
+}
+
+//
+// G_PackChunk: compresses a payload, it's left alone if it doesn't come out enough smaller
+//
+static void G_PackChunk(bffchunk_t* c, bffpayload_t* payload, const bffpacker_t* packer)
+{
+    const uint64_t rawsize = payload->sizes[0] + payload->sizes[1];
+    const char *src;
+    char *raw, *out;
+    uint64_t bound, size;
+
+    c->rawsize = rawsize;
+    if (packer->codec == BC_NONE || !rawsize || rawsize > LZ4_MAX_INPUT_SIZE)
+        return;
+
+    // the codecs want it all in one piece
+    raw = NULL;
+    if (payload->sizes[1]) {
+        raw = (char *)xmalloc(rawsize);
+        memcpy(raw, payload->parts[0], payload->sizes[0]);
+        memcpy(raw + payload->sizes[0], payload->parts[1], payload->sizes[1]);
+        src = raw;
     }
-    
-    Game::Get()->playr->p = &Game::Get()->entities.front();
+    else
+        src = (const char *)payload->parts[0];
 
-    memset(Game::Get()->playr->p, 0, sizeof(entity_t));
-    memset(Game::Get()->playr->p->pos.hitbox, 0, sizeof(vec2_t) * 4);
-    memset(&Game::Get()->playr->p->pos.thrust, 0, sizeof(vec3_t));
-    memset(&Game::Get()->playr->p->pos.to, 0, sizeof(vec3_t));
+    bound = packer->codec == BC_LZ4 ? (uint64_t)LZ4_compressBound((int)rawsize) : ZSTD_compressBound(rawsize);
+    out = (char *)xmalloc(bound);
+    if (packer->codec == BC_LZ4) {
+        size = packer->level ? LZ4_compress_HC(src, out, (int)rawsize, (int)bound, packer->level)
+            : LZ4_compress_default(src, out, (int)rawsize, (int)bound);
+    }
+    else {
+        size = ZSTD_compress(out, bound, src, rawsize, packer->level);
+        if (ZSTD_isError(size))
+            size = 0;
+    }
+    if (raw)
+        xfree(raw);
 
-    Z_Print(true);
-    if (levels)
-        Z_ChangeTag(levels, TAG_CACHE);
-    if (spawns)
-        Z_ChangeTag(spawns, TAG_CACHE);
-    if (textures)
-        Z_ChangeTag(textures, TAG_CACHE);
+    if (!size || size > rawsize - rawsize / BFF_MINSAVING) {
+        xfree(out);
+        return;
+    }
+    c->codec = packer->codec;
+    payload->packed = out;
+    payload->parts[0] = out;
+    payload->sizes[0] = size;
+    payload->parts[1] = NULL;
+    payload->sizes[1] = 0;
+}
+
+//
+// the packer: every chunk gets read in, parsed and compressed as its own job, and the
+// main thread writes them out in toc order as they come in. Only a window's worth of
+// chunks is ever in memory, the toc goes in last once every offset and checksum is known
+//
+
+#define BFF_MAXWINDOW   (MAX_JOB_WORKERS * 2)
+#define BFF_DEPMAGIC    0x50454442  // "BDEP"
+
+// what a chunk was built from, kept next to the archive in <outfile>.deps
+typedef struct
+{
+    uint32_t config;        // crc32 of what entries.json says about the chunk, and the codec
+    uint32_t checksum;      // crc32 of the source files
+    uint64_t size;          // of the source files put together
+    int64_t mtime;          // the newest one
+} bffdep_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t numchunks;
+    uint32_t numlevels;
+    uint32_t numspawns;
+} bffdepheader_t;
+
+typedef struct bffentry_s bffentry_t;
+typedef void (*bffingest_t)(bffentry_t* entry);
+
+struct bffentry_s
+{
+    bffchunk_t* chunk;
+    bffpayload_t payload;
+    bffingest_t ingest;     // fills in the payload, NULL if it's already there
+    bool mainthread;        // ingest has to wait until everything before it's been written
+    bool reuse;             // the chunk hasn't changed, it gets copied out of the last build
+    uint32_t index;         // among the chunks of its type
+    char *buffer;           // whatever ingest allocated, freed once the chunk's written
+    bffdep_t dep;
+    const bffdep_t* prevdep;
+    bff_spawnchunk_t spawn;
+};
+
+// the last build, mapped so unchanged chunks can be copied straight across
+typedef struct
+{
+    const char *base;
+    uint64_t size;
+    const bffchunk_t* toc;
+    uint32_t numchunks;
+} bffprev_t;
+
+// whatever the ingest jobs need to know about the build
+typedef struct
+{
+    std::string dirname;
+    json entries;
+    uint16_t markerstart[257];  // spawns by marker, markerspawns[markerstart[spr]..markerstart[spr + 1])
+    uint16_t* markerspawns;
+    int16_t* where;             // [level][spawn][y, x] of the spawn's last marker in each level, -1 for none
+    std::vector<uint32_t>* hits;    // per sector, its markers as spawn << 16 | y << 8 | x, until its level's built
+} bffwriter_t;
+
+static bffwriter_t* writer;
+static const bffpacker_t* bffpacker;
+static jobcounter_t packslots[BFF_MAXWINDOW];
+
+static sprite_t G_CharToSprite(char c)
+{
+    switch (c) {
+    case '#': return SPR_WALL;
+    case '.': return SPR_FLOOR_INSIDE;
+    case ' ': return SPR_FLOOR_OUTSIDE;
+    case '_': return SPR_DOOR_STATIC;
+    case '<': return SPR_DOOR_OPEN;
+    case '>': return SPR_DOOR_CLOSE;
+    case '&': return SPR_ROCK;
+    case ';': return SPR_WATER;
+    default: return SPR_CUSTOM;
+    };
+}
+
+static bool G_StatSource(const std::string& path, bffdep_t* dep)
+{
+#ifdef _WIN32
+    struct _stati64 st;
+    if (_stati64(path.c_str(), &st) == -1)
+        return false;
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1)
+        return false;
+#endif
+    dep->size += st.st_size;
+    if ((int64_t)st.st_mtime > dep->mtime)
+        dep->mtime = st.st_mtime;
+    return true;
 }
 
-void G_WriteBFF(const char* outfile, const char* dirname)
+static char *G_ReadSource(const std::string& path, uint64_t* size, bffdep_t* dep)
 {
+    char *buffer;
+
+    *size = N_ReadFile(path.c_str(), &buffer);
+    dep->checksum = G_CRC32(dep->checksum, buffer, *size);
+    return buffer;
+}
+
+// the checksum's the last resort, a file that's been touched but not changed still gets reused
+static bool G_SourceUnchanged(const bffentry_t* entry)
+{
+    return entry->prevdep && entry->prevdep->config == entry->dep.config && entry->prevdep->size == entry->dep.size
+        && entry->prevdep->checksum == entry->dep.checksum;
+}
+
+//
+// G_IngestSector: reads one sector of a level and finds its spawners in the same pass, the
+// marker lookup gives every cell the spawns it belongs to straight off. The hits come out
+// spawn by spawn, in map order inside that
+//
+static void G_IngestSector(bffentry_t* entry)
+{
+    const uint32_t level = entry->index / NUMSECTORS, m = entry->index % NUMSECTORS;
+    // the const operator[] doesn't touch the tree, other jobs are reading it too
+    const json& entries = writer->entries;
+    const std::string mapfile = entries["level_"+std::to_string(level)]["mapfile_"+std::to_string(m)];
+    std::vector<uint32_t>& hits = writer->hits[entry->index];
+    bff_sectormap_t* map;
+    const char *p, *end;
+    char *text;
+    uint64_t size;
+    uint32_t y, x, i;
+
+    entry->dep.checksum = 0;
+    text = G_ReadSource(writer->dirname+mapfile, &size, &entry->dep);
+
+    // the level needs the hits even if the sector itself comes out the same
+    map = (bff_sectormap_t *)xmalloc(sizeof(bff_sectormap_t));
+    memset(map, 0, sizeof(bff_sectormap_t));
+    hits.clear();
+    y = x = 0;
+    for (p = text, end = text + size; p < end && y < SECTOR_MAX_Y; ++p) {
+        if (*p == '\n') {
+            ++y;
+            x = 0;
+            continue;
+        }
+        if (x < SECTOR_MAX_X) {
+            const sprite_t spr = G_CharToSprite(*p);
+            (*map)[y][x] = spr;
+            for (i = writer->markerstart[spr]; i < writer->markerstart[spr + 1]; ++i)
+                hits.push_back((uint32_t)writer->markerspawns[i] << 16 | y << 8 | x);
+        }
+        ++x;
+    }
+    xfree(text);
+
+    // spawn first, then map order, which is what sorting the packed hits gives
+    std::sort(hits.begin(), hits.end());
+
+    entry->buffer = (char *)map;
+    if (G_SourceUnchanged(entry)) {
+        entry->reuse = true;
+        return;
+    }
+    entry->payload.parts[0] = map;
+    entry->payload.sizes[0] = sizeof(bff_sectormap_t);
+}
+
+//
+// G_IngestLevel: a level's spawnlist, its sectors' hits one after the other. Runs on the main
+// thread once all of them have been written
+//
+static void G_IngestLevel(bffentry_t* entry)
+{
+    const uint32_t numspawns = bff->header.numspawns;
+    int16_t* const where = &writer->where[entry->index * numspawns * 2];
+    std::vector<uint32_t>* const hits = &writer->hits[entry->index * NUMSECTORS];
+    uint16_t* spawnlist;
+    uint32_t count, m, i;
+
+    for (i = 0; i < numspawns * 2; ++i)
+        where[i] = -1;
+
+    count = 0;
+    for (m = 0; m < NUMSECTORS; ++m)
+        count += hits[m].size();
+    spawnlist = (uint16_t *)xmalloc(sizeof(uint16_t) * count + 1);
+    count = 0;
+    for (m = 0; m < NUMSECTORS; ++m) {
+        for (const uint32_t hit : hits[m]) {
+            spawnlist[count++] = hit >> 16;
+            where[(hit >> 16) * 2 + 0] = (hit >> 8) & 0xff;
+            where[(hit >> 16) * 2 + 1] = hit & 0xff;
+        }
+        std::vector<uint32_t>().swap(hits[m]);
+    }
+
+    entry->buffer = (char *)spawnlist;
+    entry->payload.parts[0] = spawnlist;
+    entry->payload.sizes[0] = sizeof(uint16_t) * count;
+}
+
+// textures and sounds go in as they are
+static void G_IngestFile(bffentry_t* entry)
+{
+    const char *node = entry->chunk->type == CT_TEXTURE ? "texture_" : "sound_";
+    const json& entries = writer->entries;
+    const std::string path = entries[node+std::to_string(entry->index)]["filepath"];
+    uint64_t size;
+
+    entry->dep.checksum = 0;
+    entry->buffer = G_ReadSource(writer->dirname+path, &size, &entry->dep);
+    if (G_SourceUnchanged(entry)) {
+        xfree(entry->buffer);
+        entry->buffer = NULL;
+        entry->reuse = true;
+        return;
+    }
+    entry->payload.parts[0] = entry->buffer;
+    entry->payload.sizes[0] = size;
+}
+
+// a spawn's where is its marker's last spot in the last level that has one, so these wait
+// until every level's been ingested
+static void G_IngestSpawn(bffentry_t* entry)
+{
+    const bff_spawn_t* spn = &bff->spawns[entry->index];
+    const uint32_t numspawns = bff->header.numspawns;
+    bff_spawnchunk_t* chunk = &entry->spawn;
+
+    memset(chunk, 0, sizeof(bff_spawnchunk_t));
+    memcpy(chunk->entityid, spn->entityid, sizeof(chunk->entityid));
+    chunk->what = spn->what;
+    chunk->replacement = spn->replacement;
+    chunk->marker = spn->marker;
+    for (uint32_t l = 0; l < bff->header.numlevels; ++l) {
+        const int16_t* where = &writer->where[(l * numspawns + entry->index) * 2];
+        if (where[0] != -1) {
+            chunk->where[0] = where[0];
+            chunk->where[1] = where[1];
+        }
+    }
+    entry->payload.parts[0] = chunk;
+    entry->payload.sizes[0] = sizeof(bff_spawnchunk_t);
+}
+
+static void G_IngestJob(void *arg)
+{
+    bffentry_t* entry = (bffentry_t *)arg;
+
+    if (entry->ingest && !entry->reuse)
+        entry->ingest(entry);
+    if (entry->reuse)
+        return;
+    if (entry->chunk->type == CT_SECTOR || entry->chunk->type == CT_TEXTURE)
+        G_PackChunk(entry->chunk, &entry->payload, bffpacker);
+    else
+        entry->chunk->rawsize = entry->payload.sizes[0] + entry->payload.sizes[1];
+}
+
+static void G_WritePadded(FILE* fp, uint64_t* offset, uint64_t align)
+{
+    static const char zeros[BFF_LEVELALIGN] = {0};
+    const uint64_t aligned = (*offset + align - 1) & ~(align - 1);
+
+    fwrite(zeros, 1, aligned - *offset, fp);
+    *offset = aligned;
+}
+
+//
+// G_SamePayload: whether parts are byte for byte what's already in the file at first's
+// offset, matching checksums only narrow it down
+//
+static bool G_SamePayload(FILE* fp, const bffchunk_t* first, const void *const *parts, const uint64_t* sizes, uint64_t offset)
+{
+    char buffer[BFF_LEVELALIGN * 4];
+    uint64_t pos, n;
+    bool same;
+    uint32_t p;
+
+    same = true;
+    fseek(fp, first->offset, SEEK_SET);
+    for (p = 0; p < 2 && same; ++p) {
+        for (pos = 0; pos < sizes[p] && same; pos += n) {
+            n = sizes[p] - pos < sizeof(buffer) ? sizes[p] - pos : sizeof(buffer);
+            same = fread(buffer, 1, n, fp) == n && !memcmp(buffer, (const char *)parts[p] + pos, n);
+        }
+    }
+    fseek(fp, offset, SEEK_SET);
+    return same;
+}
+
+// payloads are only shared between chunks of the same type, the same way G_MapBFF
+// keys its alias table, the top byte holds the type
+static inline uint64_t G_PayloadKey(const bffchunk_t* c)
+{
+    return (((uint64_t)c->checksum << 24 ^ c->size) & 0x00ffffffffffffffULL) | (uint64_t)c->type << 56;
+}
+
+//
+// G_PackBFF: streams a v2 archive out, entries are in toc order. Chunks marked reuse get
+// copied out of prev instead of being ingested, and a chunk that's the same as one that's
+// already gone out points the toc at that one's payload instead of being written again
+//
+static void G_PackBFF(const char *outfile, bffentry_t* entries, bffchunk_t* toc, uint32_t numchunks,
+    const bffprev_t* prev, const bffpacker_t* packer)
+{
+    std::unordered_map<uint64_t, uint32_t> payloads;
+    bffheader_t header;
+    uint32_t window, packed, reused, shared, n, p;
+    uint64_t offset, saved;
+    FILE* fp;
+
+    // read back to make sure a shared payload really is the same
+    fp = fopen(outfile, "w+b");
+    if (!fp) {
+        N_Error("G_WriteBFF: failed to open output bff file %s", outfile);
+    }
+    bffpacker = packer;
+
+    // the header and the toc get filled in at the end
+    memset(&header, 0, sizeof(header));
+    fwrite(&header, sizeof(bffheader_t), 1, fp);
+    fwrite(toc, sizeof(bffchunk_t), numchunks, fp);
+    offset = sizeof(bffheader_t) + sizeof(bffchunk_t) * numchunks;
+
+    // enough in flight to keep every worker busy while the main thread writes
+    window = N_NumJobWorkers() * 2;
+    if (window > BFF_MAXWINDOW)
+        window = BFF_MAXWINDOW;
+
+    packed = reused = shared = 0;
+    saved = 0;
+    for (n = 0; n < numchunks + window; ++n) {
+        if (n >= window) {
+            bffentry_t* entry = &entries[n - window];
+            bffchunk_t* c = entry->chunk;
+            const bffchunktype_t type = c->type;
+            const int32_t lvl_index = c->lvl_index;
+            const void *parts[2];
+            uint64_t sizes[2];
+
+            N_WaitJobs(&packslots[(n - window) % window]);
+            if (entry->mainthread)
+                G_IngestJob(entry);
+
+            if (entry->reuse) {
+                const bffchunk_t* old = &prev->toc[n - window];
+                *c = *old;
+                c->type = type;
+                c->lvl_index = lvl_index;
+                parts[0] = prev->base + old->offset;
+                sizes[0] = old->size;
+                parts[1] = NULL;
+                sizes[1] = 0;
+                ++reused;
+            }
+            else {
+                c->size = 0;
+                c->checksum = 0;
+                for (p = 0; p < arraylen(entry->payload.parts); ++p) {
+                    parts[p] = entry->payload.parts[p];
+                    sizes[p] = entry->payload.sizes[p];
+                    if (!sizes[p])
+                        continue;
+                    c->size += sizes[p];
+                    c->checksum = G_CRC32(c->checksum, parts[p], sizes[p]);
+                }
+            }
+
+            const auto it = c->size ? payloads.find(G_PayloadKey(c)) : payloads.end();
+            const bffchunk_t* first = it != payloads.end() ? entries[it->second].chunk : NULL;
+            if (first && first->type == c->type && first->size == c->size && first->rawsize == c->rawsize && first->codec == c->codec
+            && !(first->offset % c->align) && G_SamePayload(fp, first, parts, sizes, offset)) {
+                c->offset = first->offset;
+                ++shared;
+                saved += c->size;
+            }
+            else {
+                G_WritePadded(fp, &offset, c->align);
+                c->offset = offset;
+                for (p = 0; p < 2; ++p) {
+                    if (sizes[p])
+                        fwrite(parts[p], 1, sizes[p], fp);
+                }
+                offset += c->size;
+                if (c->size)
+                    payloads.emplace(G_PayloadKey(c), n - window);
+            }
+            if (c->codec != BC_NONE)
+                ++packed;
+
+            if (entry->payload.packed)
+                xfree(entry->payload.packed);
+            if (entry->buffer)
+                xfree(entry->buffer);
+            entry->payload.packed = entry->buffer = NULL;
+        }
+        if (n < numchunks) {
+            bffentry_t* entry = &entries[n];
+            if (!entry->mainthread && !entry->reuse)
+                N_RunJob(G_IngestJob, entry, "bffingest", &packslots[n % window]);
+        }
+    }
+
+    header.magic = BFF_MAGIC;
+    header.version = BFF_VERSION;
+    header.filesize = offset;
+    header.numchunks = numchunks;
+    header.tocchecksum = G_CRC32(0, toc, sizeof(bffchunk_t) * numchunks);
+
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&header, sizeof(bffheader_t), 1, fp);
+    fwrite(toc, sizeof(bffchunk_t), numchunks, fp);
+    if (ferror(fp))
+        N_Error("G_WriteBFF: failed to write bff file %s", outfile);
+    fclose(fp);
+
+    LOG_INFO("wrote {} chunks, {} bytes to {}, {} of them packed with {}, {} unchanged, {} shared ({} bytes saved)",
+        numchunks, header.filesize, outfile, packed, packer->name, reused, shared, saved);
+}
+
+static bool G_MapPrevious(const char *path, bffprev_t* prev)
+{
+    const bffheader_t* header;
+
+    memset(prev, 0, sizeof(*prev));
+    prev->base = G_MapFile(path, &prev->size);
+    if (!prev->base)
+        return false;
+
+    header = (const bffheader_t *)prev->base;
+    if (prev->size < sizeof(bffheader_t) || header->magic != BFF_MAGIC || header->version != BFF_VERSION
+    || header->filesize != prev->size || (prev->size - sizeof(bffheader_t)) / sizeof(bffchunk_t) < header->numchunks
+    || G_CRC32(0, prev->base + sizeof(bffheader_t), sizeof(bffchunk_t) * header->numchunks) != header->tocchecksum) {
+        G_UnmapFile(prev->base, prev->size);
+        prev->base = NULL;
+        return false;
+    }
+    prev->toc = (const bffchunk_t *)(prev->base + sizeof(bffheader_t));
+    prev->numchunks = header->numchunks;
+    for (uint32_t i = 0; i < prev->numchunks; ++i) {
+        if (prev->toc[i].offset > prev->size || prev->toc[i].size > prev->size - prev->toc[i].offset) {
+            G_UnmapFile(prev->base, prev->size);
+            prev->base = NULL;
+            return false;
+        }
+    }
+    return true;
+}
+
+static void G_ReplaceFile(const std::string& from, const char *to)
+{
+#ifdef _WIN32
+    remove(to);
+#endif
+    if (rename(from.c_str(), to) == -1)
+        N_Error("G_WriteBFF: failed to rename %s to %s", from.c_str(), to);
+}
+
+//
+// G_WriteBFF: packs the entries.json in dirname into outfile. If there's a build of it there
+// already along with its .deps, chunks whose sources and settings haven't changed get
+// copied across instead of being read, parsed and compressed all over again
+//
+void G_WriteBFF(const char* outfile, const char* dirname, const char *codec)
+{
+    const bffpacker_t* packer = G_FindPacker(codec);
+    const std::string tmpfile = std::string(outfile)+".tmp", depfile = std::string(outfile)+".deps";
+    bffdepheader_t depheader;
+    bffdep_t* prevdeps;
+    int16_t* prevwhere;
+    bffentry_t* entries;
+    bffchunk_t* toc;
+    bffprev_t prev;
+    uint32_t numchunks, numsectors, n, i;
+    std::string spawnconfig;
+
     if (!outfile)
         return;
 
     Z_Init();
     bff = (bff_file_t *)Z_Malloc(sizeof(bff_file_t), TAG_STATIC, &bff, "BFF");
+    memset(bff, 0, sizeof(bff_file_t));
+    writer = new bffwriter_t;
+    writer->dirname = dirname;
 
-    std::ifstream file(std::string(dirname)+"entries.json", std::ios::in);
+    std::ifstream file(writer->dirname+"entries.json", std::ios::in);
     if (file.fail()) {
-        N_Error("G_WriteBFF: failed to open entries file %s", std::string(std::string(dirname)+"entries.json").c_str());
+        N_Error("G_WriteBFF: failed to open entries file %s", std::string(writer->dirname+"entries.json").c_str());
     }
-    const json data = json::parse(file);
+    writer->entries = json::parse(file);
     file.close();
+    const json& data = writer->entries;
 
     // get the header
     {
@@ -336,196 +1289,391 @@ void G_WriteBFF(const char* outfile, const char* dirname)
         bff->header.numtextures = (uint16_t)header["numtextures"];
     }
 
-    // load the spawns
-    if (bff->header.numspawns) {
-        static auto char_to_sprite = [=](char c) -> sprite_t
-        {
-            switch (c) {
-            case '#': return SPR_WALL; break;
-            case '.': return SPR_FLOOR_INSIDE; break;
-            case ' ': return SPR_FLOOR_OUTSIDE; break;
-            case '_': return SPR_DOOR_STATIC; break;
-            case '<': return SPR_DOOR_OPEN; break;
-            case '>': return SPR_DOOR_CLOSE; break;
-            case '&': return SPR_ROCK; break;
-            case ';': return SPR_WATER; break;
-            default: return SPR_CUSTOM; break;
-            };
-        };
-        bff->spawns = (bff_spawn_t *)Z_Malloc(sizeof(bff_spawn_t) * bff->header.numspawns, TAG_STATIC, &bff->spawns, "bffspns");
-
-        for (uint16_t i = 0; i < bff->header.numspawns; ++i) {
-            const std::string node_name = "spawner_"+std::to_string(i);
-            bff_spawn_t* ptr = &bff->spawns[i];
-            memset(ptr, 0, sizeof(*ptr));
-
-            const std::string replacement = data[node_name]["replacement"];
-            const std::string marker = data[node_name]["marker"];
-            
-            ptr->replacement = char_to_sprite(replacement[0]);
-            ptr->marker = char_to_sprite(marker[0]);
-            const std::string type = data[node_name]["entity"];
-            if (type == "ET_MOB")
-                ptr->what = ET_MOB;
-            else if (type == "ET_PLAYR")
-                ptr->what = ET_PLAYR;
-            else if (type == "ET_ITEM")
-                ptr->what = ET_ITEM;
-            else if (type == "ET_WEAPON")
-                ptr->what = ET_WEAPON;
-            
-            const std::string id = data[node_name]["id"];
-            memset(ptr->entityid, 0, sizeof(ptr->entityid));
-            strncpy(ptr->entityid, id.c_str(), 80);
-        }
-    }
-    // load the levels
-    if (bff->header.numlevels) {
-        bff->levels = (bff_level_t *)Z_Malloc(sizeof(bff_level_t) * bff->header.numlevels, TAG_STATIC, &bff->levels, "bfflvls");
+    // load the spawns, they're small and every level needs their markers
+    bff->spawns = (bff_spawn_t *)Z_Malloc(sizeof(bff_spawn_t) * (bff->header.numspawns + 1), TAG_STATIC, &bff->spawns, "bffspns");
+    writer->markerspawns = (uint16_t *)Z_Malloc(sizeof(uint16_t) * (bff->header.numspawns + 1), TAG_STATIC, &writer->markerspawns, "bffmarkers");
+    memset(writer->markerstart, 0, sizeof(writer->markerstart));
+    for (i = 0; i < bff->header.numspawns; ++i) {
+        const std::string node_name = "spawner_"+std::to_string(i);
+        bff_spawn_t* ptr = &bff->spawns[i];
+        memset(ptr, 0, sizeof(*ptr));
 
-        for (uint16_t i = 0; i < bff->header.numlevels; ++i) {
-            const std::string node_name = "level_"+std::to_string(i);
-            const json lvl = data[node_name];
-            bff_level_t* ptr = &bff->levels[i];
-            memset(ptr, 0, sizeof(*ptr));
+        const std::string replacement = data[node_name]["replacement"];
+        const std::string marker = data[node_name]["marker"];
 
-            LOG_INFO("loading level chunk {}", i);
+        ptr->replacement = G_CharToSprite(replacement[0]);
+        ptr->marker = G_CharToSprite(marker[0]);
+        const std::string type = data[node_name]["entity"];
+        if (type == "ET_MOB")
+            ptr->what = ET_MOB;
+        else if (type == "ET_PLAYR")
+            ptr->what = ET_PLAYR;
+        else if (type == "ET_ITEM")
+            ptr->what = ET_ITEM;
+        else if (type == "ET_WEAPON")
+            ptr->what = ET_WEAPON;
 
-            // load the mapfiles
-            for (uint8_t m = 0; m < NUMSECTORS; ++m) {
-                const std::string mapfile = lvl["mapfile_"+std::to_string(m)];
-                std::ifstream file(std::string(dirname)+mapfile, std::ios::in);
-                if (file.fail()) {
-                    N_Error("G_WriteBFF: failed to open mapfile %s", std::string(std::string(dirname)+mapfile).c_str());
-                }
-                std::vector<std::string> strbuf;
-                std::string line;
-                while (std::getline(file, line)) { strbuf.emplace_back(line); }
-                file.close();
-
-                for (uint16_t y = 0; y < strbuf.size(); ++y) {
-                    for (uint16_t x = 0; x < strbuf[y].size(); ++x) {
-                        sprite_t spr;
-                        switch (strbuf[y][x]) {
-                        case '#': spr = SPR_WALL; break;
-                        case '.': spr = SPR_FLOOR_INSIDE; break;
-                        case ' ': spr = SPR_FLOOR_OUTSIDE; break;
-                        case '_': spr = SPR_DOOR_STATIC; break;
-                        case '<': spr = SPR_DOOR_OPEN; break;
-                        case '>': spr = SPR_DOOR_CLOSE; break;
-                        case '&': spr = SPR_ROCK; break;
-                        case ';': spr = SPR_WATER; break;
-                        default: spr = SPR_CUSTOM; break;
-                        };
-                        ptr->lvl_map[m][y][x] = spr;
-                    }
-                }
-                // link spawners
-                for (uint16_t s = 0; s < bff->header.numspawns; ++s) {
-                    bff_spawn_t* spn = &bff->spawns[s];
-                    for (uint16_t y = 0; y < SECTOR_MAX_Y; ++y) {
-                        for (uint16_t x = 0; x < SECTOR_MAX_X; ++x) {
-                            if (ptr->lvl_map[m][y][x] == spn->marker) {
-                                ptr->spawnlist = (uint16_t *)Z_Realloc(ptr->spawnlist,
-                                    sizeof(uint16_t) * (ptr->spawncount ? ptr->spawncount : 1), &ptr->spawnlist, TAG_STATIC, "spnlist");
-                                ptr->spawnlist[ptr->spawncount] = s;
-                                spn->where = {y, x};
-                                ++ptr->spawncount;
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }
-    // load the textures
-    if (bff->header.numtextures) {
-        bff->textures = (bff_texture_t *)Z_Malloc(sizeof(bff_texture_t) * bff->header.numtextures, TAG_STATIC, &bff->textures, "bfftextures");
-
-        for (uint16_t i = 0; i < bff->header.numtextures; ++i) {
-            const std::string node_name = "texture_"+std::to_string(i);
-            const json tex = data[node_name];
-            bff_texture_t* ptr = &bff->textures[i];
-            memset(ptr, 0, sizeof(*ptr));
-            const std::string texfile = tex["filepath"];
-            ptr->fsize = N_ReadFile(std::string(std::string(dirname)+texfile).c_str(), &ptr->buffer);
-        }
+        const std::string id = data[node_name]["id"];
+        memset(ptr->entityid, 0, sizeof(ptr->entityid));
+        strncpy(ptr->entityid, id.c_str(), 80);
+
+        ++writer->markerstart[ptr->marker + 1];
+        spawnconfig += marker;
     }
-    // load the sounds
-    if (bff->header.numsounds) {
-        bff->sounds = (bff_audio_t *)Z_Malloc(sizeof(bff_audio_t) * bff->header.numsounds, TAG_STATIC, &bff->sounds, "bffsnds");
-
-        for (uint16_t i = 0; i < bff->header.numsounds; ++i) {
-            const std::string node_name = "sound_"+std::to_string(i);
-            const json snd = data[node_name];
-            bff_audio_t* ptr = &bff->sounds[i];
-            memset(ptr, 0, sizeof(*ptr));
-
-            const std::string sndfile = snd["filepath"];
-            if (sndfile.find(".ogg") != std::string::npos || sndfile.find(".OGG") != std::string::npos)
-                ptr->type = FT_OGG;
-            else if (sndfile.find(".wav") != std::string::npos || sndfile.find(".WAV") != std::string::npos)
-                ptr->type = FT_WAV;
-            else if (sndfile.find(".flac") != std::string::npos || sndfile.find(".FLAC") != std::string::npos)
-                ptr->type = FT_FLAC;
-            else if (sndfile.find(".opus") != std::string::npos || sndfile.find(".OPUS") != std::string::npos)
-                ptr->type = FT_OPUS;
-
-            ptr->fsize = N_ReadFile(std::string(std::string(dirname)+sndfile).c_str(), &ptr->filebuf);
-            LOG_INFO("done loading audio chunk {}", i);
-        }
+    // counts into starts, then drop every spawn into its marker's run
+    for (i = 1; i < arraylen(writer->markerstart); ++i)
+        writer->markerstart[i] += writer->markerstart[i - 1];
+    {
+        uint16_t fill[256];
+        memcpy(fill, writer->markerstart, sizeof(fill));
+        for (i = 0; i < bff->header.numspawns; ++i)
+            writer->markerspawns[fill[bff->spawns[i].marker]++] = i;
     }
 
-    Z_Print(true);
-    xalloc_stats();
+    numsectors = bff->header.numlevels * NUMSECTORS;
+    numchunks = numsectors + bff->header.numlevels + bff->header.numspawns + bff->header.numtextures + bff->header.numsounds;
+    toc = (bffchunk_t *)Z_Malloc(sizeof(bffchunk_t) * (numchunks + 1), TAG_STATIC, &toc, "bfftoc");
+    entries = (bffentry_t *)Z_Malloc(sizeof(bffentry_t) * (numchunks + 1), TAG_STATIC, &entries, "bffentries");
+    writer->where = (int16_t *)Z_Malloc(sizeof(int16_t) * 2 * (bff->header.numlevels * bff->header.numspawns + 1), TAG_STATIC,
+        &writer->where, "bffwhere");
+    writer->hits = new std::vector<uint32_t>[numsectors + 1];
+    memset(toc, 0, sizeof(bffchunk_t) * numchunks);
+    memset(entries, 0, sizeof(bffentry_t) * numchunks);
 
-    // write everything
-    FILE* fp = fopen(outfile, "wb");
-    if (!fp) {
-        N_Error("G_WriteBFF: failed to open output bff file %s", outfile);
+    n = 0;
+    for (i = 0; i < numsectors; ++i, ++n) {
+        const std::string mapfile = data["level_"+std::to_string(i / NUMSECTORS)]["mapfile_"+std::to_string(i % NUMSECTORS)];
+        toc[n].type = CT_SECTOR;
+        toc[n].align = BFF_LEVELALIGN;
+        entries[n].ingest = G_IngestSector;
+        entries[n].dep.config = G_CRC32(0, packer->name, strlen(packer->name));
+        entries[n].dep.config = G_CRC32(entries[n].dep.config, mapfile.c_str(), mapfile.size());
+        if (!G_StatSource(writer->dirname+mapfile, &entries[n].dep))
+            N_Error("G_WriteBFF: failed to open mapfile %s", std::string(writer->dirname+mapfile).c_str());
+    }
+    // its sectors' sources put together, anything that changes its spawnlist changes the config
+    for (i = 0; i < bff->header.numlevels; ++i, ++n) {
+        toc[n].type = CT_LEVEL;
+        toc[n].align = BFF_ALIGN;
+        entries[n].ingest = G_IngestLevel;
+        entries[n].mainthread = true;
+        entries[n].dep.config = G_CRC32(0, spawnconfig.c_str(), spawnconfig.size());
+        for (uint32_t m = 0; m < NUMSECTORS; ++m) {
+            const bffdep_t* sector = &entries[i * NUMSECTORS + m].dep;
+            entries[n].dep.config = G_CRC32(entries[n].dep.config, &sector->config, sizeof(sector->config));
+            entries[n].dep.size += sector->size;
+            if (sector->mtime > entries[n].dep.mtime)
+                entries[n].dep.mtime = sector->mtime;
+        }
+    }
+    for (i = 0; i < bff->header.numspawns; ++i, ++n) {
+        toc[n].type = CT_SPAWN;
+        toc[n].align = BFF_ALIGN;
+        entries[n].ingest = G_IngestSpawn;
+        entries[n].mainthread = true;
+    }
+    for (i = 0; i < bff->header.numtextures; ++i, ++n) {
+        const std::string texfile = data["texture_"+std::to_string(i)]["filepath"];
+        toc[n].type = CT_TEXTURE;
+        toc[n].align = BFF_ALIGN;
+        entries[n].ingest = G_IngestFile;
+        entries[n].dep.config = G_CRC32(0, packer->name, strlen(packer->name));
+        entries[n].dep.config = G_CRC32(entries[n].dep.config, texfile.c_str(), texfile.size());
+        if (!G_StatSource(writer->dirname+texfile, &entries[n].dep))
+            N_Error("G_WriteBFF: failed to open texture %s", std::string(writer->dirname+texfile).c_str());
+    }
+    for (i = 0; i < bff->header.numsounds; ++i, ++n) {
+        const std::string sndfile = data["sound_"+std::to_string(i)]["filepath"];
+        toc[n].type = CT_SOUND;
+        toc[n].align = BFF_ALIGN;
+        if (sndfile.find(".ogg") != std::string::npos || sndfile.find(".OGG") != std::string::npos)
+            toc[n].format = FT_OGG;
+        else if (sndfile.find(".wav") != std::string::npos || sndfile.find(".WAV") != std::string::npos)
+            toc[n].format = FT_WAV;
+        else if (sndfile.find(".flac") != std::string::npos || sndfile.find(".FLAC") != std::string::npos)
+            toc[n].format = FT_FLAC;
+        else if (sndfile.find(".opus") != std::string::npos || sndfile.find(".OPUS") != std::string::npos)
+            toc[n].format = FT_OPUS;
+        toc[n].lvl_index = data["sound_"+std::to_string(i)].value("lvl_index", -1);
+        entries[n].ingest = G_IngestFile;
+        entries[n].dep.config = G_CRC32(0, sndfile.c_str(), sndfile.size());
+        entries[n].dep.config = G_CRC32(entries[n].dep.config, &toc[n].lvl_index, sizeof(toc[n].lvl_index));
+        if (!G_StatSource(writer->dirname+sndfile, &entries[n].dep))
+            N_Error("G_WriteBFF: failed to open sound %s", std::string(writer->dirname+sndfile).c_str());
+    }
+    for (n = 0, i = 0; n < numchunks; ++n) {
+        if (n && toc[n].type != toc[n - 1].type)
+            i = 0;
+        entries[n].chunk = &toc[n];
+        entries[n].index = i++;
+        if (toc[n].type != CT_SOUND)
+            toc[n].lvl_index = -1;
     }
-    assert(fp);
 
-    bff->header.magic = HEADER_MAGIC;
-    fwrite(&bff->header, sizeof(bffinfo_t), 1, fp);
+    // whatever the last build left behind, if it lines up with this one
+    prevdeps = NULL;
+    prevwhere = NULL;
+    char *deps = NULL;
+    uint64_t depsize = 0;
+    if (G_MapPrevious(outfile, &prev)) {
+        FILE* fp = fopen(depfile.c_str(), "rb");
+        if (fp) {
+            fseek(fp, 0, SEEK_END);
+            depsize = ftell(fp);
+            fseek(fp, 0, SEEK_SET);
+            deps = (char *)xmalloc(depsize + 1);
+            if (fread(deps, 1, depsize, fp) != depsize)
+                depsize = 0;
+            fclose(fp);
+        }
+        memset(&depheader, 0, sizeof(depheader));
+        if (depsize >= sizeof(bffdepheader_t))
+            memcpy(&depheader, deps, sizeof(depheader));
+        if (depheader.magic == BFF_DEPMAGIC && depheader.numchunks == numchunks && prev.numchunks == numchunks
+        && depheader.numlevels == bff->header.numlevels && depheader.numspawns == bff->header.numspawns
+        && depsize == sizeof(bffdepheader_t) + sizeof(bffdep_t) * numchunks
+            + sizeof(int16_t) * 2 * bff->header.numlevels * bff->header.numspawns) {
+            prevdeps = (bffdep_t *)(deps + sizeof(bffdepheader_t));
+            prevwhere = (int16_t *)(prevdeps + numchunks);
+        }
+        else
+            LOG_INFO("G_WriteBFF: {} doesn't match the last build, rebuilding all of it", depfile);
+    }
+    for (n = 0; n < numchunks && prevdeps; ++n) {
+        // spawns are rebuilt every time, they're next to free
+        if (toc[n].type == CT_SPAWN || prev.toc[n].type != toc[n].type)
+            continue;
+        entries[n].prevdep = &prevdeps[n];
+        entries[n].reuse = prevdeps[n].config == entries[n].dep.config && prevdeps[n].size == entries[n].dep.size
+            && prevdeps[n].mtime == entries[n].dep.mtime;
+        if (entries[n].reuse)
+            entries[n].dep.checksum = prevdeps[n].checksum;
+    }
+    // a level only comes across along with all of its sectors, and one that's rebuilt needs every
+    // sector's hits, the ones that turn out the same still get copied instead of packed
+    for (i = 0; i < bff->header.numlevels; ++i) {
+        bffentry_t* level = &entries[numsectors + i];
+        for (uint32_t m = 0; m < NUMSECTORS; ++m)
+            level->reuse = level->reuse && entries[i * NUMSECTORS + m].reuse;
+        for (uint32_t m = 0; m < NUMSECTORS && !level->reuse; ++m)
+            entries[i * NUMSECTORS + m].reuse = false;
+    }
 
     LOG_INFO("number of level chunks to write: {}", bff->header.numlevels);
     LOG_INFO("number of spawn chunks to write: {}", bff->header.numspawns);
     LOG_INFO("number of sound chunks to write: {}", bff->header.numsounds);
     LOG_INFO("number of texture chunks to write: {}", bff->header.numtextures);
 
-    for (uint16_t i = 0; i < bff->header.numlevels; ++i) {
-        LOG_INFO("writing level chunk {}", i);
-        fwrite(&bff->levels[i].spawncount, sizeof(uint16_t), 1, fp);
-        fwrite(bff->levels[i].spawnlist, sizeof(uint16_t), bff->levels[i].spawncount, fp);
-        if (bff->levels[i].spawnlist) {
-            Z_Free(bff->levels[i].spawnlist);
+    // a level that's reused never gets parsed, its spawns' spots come from the last build
+    for (i = 0; i < bff->header.numlevels && prevwhere; ++i) {
+        memcpy(&writer->where[i * bff->header.numspawns * 2], &prevwhere[i * bff->header.numspawns * 2],
+            sizeof(int16_t) * 2 * bff->header.numspawns);
+    }
+    G_PackBFF(tmpfile.c_str(), entries, toc, numchunks, &prev, packer);
+
+    // the new deps go out before anything gets replaced, a crash in between just means a full rebuild
+    {
+        const std::string tmpdeps = depfile+".tmp";
+        FILE* fp = fopen(tmpdeps.c_str(), "wb");
+        if (!fp)
+            N_Error("G_WriteBFF: failed to open %s", tmpdeps.c_str());
+        depheader.magic = BFF_DEPMAGIC;
+        depheader.numchunks = numchunks;
+        depheader.numlevels = bff->header.numlevels;
+        depheader.numspawns = bff->header.numspawns;
+        fwrite(&depheader, sizeof(bffdepheader_t), 1, fp);
+        for (n = 0; n < numchunks; ++n)
+            fwrite(&entries[n].dep, sizeof(bffdep_t), 1, fp);
+        fwrite(writer->where, sizeof(int16_t) * 2, bff->header.numlevels * bff->header.numspawns, fp);
+        fclose(fp);
+
+        if (prev.base)
+            G_UnmapFile(prev.base, prev.size);
+        remove(depfile.c_str());
+        G_ReplaceFile(tmpfile, outfile);
+        G_ReplaceFile(tmpdeps, depfile.c_str());
+    }
+
+    if (deps)
+        xfree(deps);
+    delete[] writer->hits;
+    delete writer;
+    writer = NULL;
+    N_ShutdownJobs();
+    exit(EXIT_SUCCESS);
+}
+
+static void G_ReadV1(void *buffer, size_t size, FILE* fp, const char *infile)
+{
+    if (size && fread(buffer, 1, size, fp) != size)
+        N_Error("G_ConvertBFF: %s is truncated", infile);
+}
+
+//
+// G_ConvertBFF: rewrites a v1 archive (the layout G_WriteBFF used to put out) as v2. v1 never
+// stored where the spawns are, so they get put back the way G_WriteBFF finds them: the last
+// cell with the spawn's marker, in the last sector that has one
+//
+void G_ConvertBFF(const char* infile, const char* outfile, const char *codec)
+{
+    const bffpacker_t* packer = G_FindPacker(codec);
+    bffentry_t* entries;
+    bffchunk_t* toc;
+    uint32_t numchunks, n;
+    FILE* fp;
+    uint16_t i;
+
+    Z_Init();
+    bff = (bff_file_t *)Z_Malloc(sizeof(bff_file_t), TAG_STATIC, &bff, "BFF");
+    memset(bff, 0, sizeof(bff_file_t));
+
+    fp = fopen(infile, "rb");
+    if (!fp) {
+        N_Error("G_ConvertBFF: failed to open file %s", infile);
+    }
+
+    G_ReadV1(&bff->header, sizeof(bffinfo_t), fp, infile);
+    if (bff->header.magic != HEADER_MAGIC) {
+        N_Error("G_ConvertBFF: header wasn't the correct constant, should be %lx, got %lx",
+            (uint64_t)HEADER_MAGIC, bff->header.magic);
+    }
+
+    bff->levels = (bff_level_t *)Z_Malloc(sizeof(bff_level_t) * (bff->header.numlevels + 1), TAG_STATIC, &bff->levels, "bfflvls");
+    bff->spawns = (bff_spawn_t *)Z_Malloc(sizeof(bff_spawn_t) * (bff->header.numspawns + 1), TAG_STATIC, &bff->spawns, "bffspns");
+    bff->textures = (bff_texture_t *)Z_Malloc(sizeof(bff_texture_t) * (bff->header.numtextures + 1), TAG_STATIC, &bff->textures, "bfftextures");
+    bff->sounds = (bff_audio_t *)Z_Malloc(sizeof(bff_audio_t) * (bff->header.numsounds + 1), TAG_STATIC, &bff->sounds, "bffsnds");
+
+    for (i = 0; i < bff->header.numlevels; ++i) {
+        bff_level_t* const ptr = &bff->levels[i];
+        memset(ptr, 0, sizeof(*ptr));
+
+        G_ReadV1(&ptr->spawncount, sizeof(uint16_t), fp, infile);
+        if (ptr->spawncount) {
+            ptr->spawnlist = (uint16_t *)Z_Malloc(sizeof(uint16_t) * ptr->spawncount, TAG_STATIC, &ptr->spawnlist, "spnlist");
+            G_ReadV1(ptr->spawnlist, sizeof(uint16_t) * ptr->spawncount, fp, infile);
         }
-        fwrite(bff->levels[i].lvl_map, sizeof(sprite_t), MAP_MAX_Y*MAP_MAX_X, fp);
-        fflush(fp);
-    }
-    for (uint16_t i = 0; i < bff->header.numspawns; ++i) { // no need to compress spawners
-        fwrite(bff->spawns[i].entityid, sizeof(char), BFF_STR_SIZE + 1, fp);
-        fwrite(&bff->spawns[i].what, sizeof(uint8_t), 1, fp);
-        fwrite(&bff->spawns[i].replacement, sizeof(sprite_t), 1, fp);
-        fwrite(&bff->spawns[i].marker, sizeof(sprite_t), 1, fp);
-        fflush(fp);
-    }
-    for (uint16_t i = 0; i < bff->header.numtextures; ++i) {
-        fwrite(&bff->textures[i].fsize, sizeof(uint64_t), 1, fp);
-        fwrite(bff->textures[i].buffer, sizeof(char), bff->textures[i].fsize, fp);
-        xfree(bff->textures[i].buffer);
-        fflush(fp);
+        // v1 wrote MAP_MAX_Y*MAP_MAX_X bytes off a map a quarter of that, the rest is junk
+        G_ReadV1(ptr->lvl_map, sizeof(ptr->lvl_map), fp, infile);
+        fseek(fp, MAP_MAX_Y*MAP_MAX_X - sizeof(ptr->lvl_map), SEEK_CUR);
     }
-    for (uint16_t i = 0; i < bff->header.numsounds; ++i) {
-        fwrite(&bff->sounds[i].type, sizeof(uint8_t), 1, fp);
-        fwrite(&bff->sounds[i].lvl_index, sizeof(int32_t), 1, fp);
-        fwrite(&bff->sounds[i].fsize, sizeof(uint64_t), 1, fp);
-        fwrite(bff->sounds[i].filebuf, sizeof(char), bff->sounds[i].fsize, fp);
-        xfree(bff->sounds[i].filebuf);
-        LOG_INFO("wrote audio chunk {}", i);
-        fflush(fp);
+    for (i = 0; i < bff->header.numspawns; ++i) {
+        bff_spawn_t* const ptr = &bff->spawns[i];
+        memset(ptr, 0, sizeof(*ptr));
+
+        G_ReadV1(ptr->entityid, BFF_STR_SIZE + 1, fp, infile);
+        G_ReadV1(&ptr->what, sizeof(uint8_t), fp, infile);
+        G_ReadV1(&ptr->replacement, sizeof(sprite_t), fp, infile);
+        G_ReadV1(&ptr->marker, sizeof(sprite_t), fp, infile);
+    }
+    for (i = 0; i < bff->header.numtextures; ++i) {
+        bff_texture_t* const ptr = &bff->textures[i];
+        memset(ptr, 0, sizeof(*ptr));
+
+        G_ReadV1(&ptr->fsize, sizeof(uint64_t), fp, infile);
+        ptr->buffer = (char *)xmalloc(ptr->fsize + 1);
+        G_ReadV1(ptr->buffer, ptr->fsize, fp, infile);
+    }
+    for (i = 0; i < bff->header.numsounds; ++i) {
+        bff_audio_t* const ptr = &bff->sounds[i];
+        memset(ptr, 0, sizeof(*ptr));
+
+        G_ReadV1(&ptr->type, sizeof(uint8_t), fp, infile);
+        G_ReadV1(&ptr->lvl_index, sizeof(int32_t), fp, infile);
+        G_ReadV1(&ptr->fsize, sizeof(uint64_t), fp, infile);
+        ptr->filebuf = (char *)xmalloc(ptr->fsize + 1);
+        G_ReadV1(ptr->filebuf, ptr->fsize, fp, infile);
     }
     fclose(fp);
+
+    // one pass per sector for where every sprite shows up last
+    for (i = 0; i < bff->header.numlevels; ++i) {
+        for (uint8_t m = 0; m < NUMSECTORS; ++m) {
+            int32_t last[256][2];
+            memset(last, -1, sizeof(last));
+            for (uint16_t y = 0; y < SECTOR_MAX_Y; ++y) {
+                for (uint16_t x = 0; x < SECTOR_MAX_X; ++x) {
+                    last[bff->levels[i].lvl_map[m][y][x]][0] = y;
+                    last[bff->levels[i].lvl_map[m][y][x]][1] = x;
+                }
+            }
+            for (uint16_t s = 0; s < bff->header.numspawns; ++s) {
+                bff_spawn_t* spn = &bff->spawns[s];
+                if (last[spn->marker][0] != -1)
+                    spn->where = {(float)last[spn->marker][0], (float)last[spn->marker][1]};
+            }
+        }
+    }
+
+    // everything's in memory already, the jobs only have compressing to do
+    numchunks = bff->header.numlevels * (NUMSECTORS + 1) + bff->header.numspawns + bff->header.numtextures + bff->header.numsounds;
+    toc = (bffchunk_t *)Z_Malloc(sizeof(bffchunk_t) * (numchunks + 1), TAG_STATIC, &toc, "bfftoc");
+    entries = (bffentry_t *)Z_Malloc(sizeof(bffentry_t) * (numchunks + 1), TAG_STATIC, &entries, "bffentries");
+    memset(toc, 0, sizeof(bffchunk_t) * numchunks);
+    memset(entries, 0, sizeof(bffentry_t) * numchunks);
+
+    n = 0;
+    for (i = 0; i < bff->header.numlevels; ++i) {
+        for (uint8_t m = 0; m < NUMSECTORS; ++m, ++n) {
+            toc[n].type = CT_SECTOR;
+            toc[n].align = BFF_LEVELALIGN;
+            entries[n].payload.parts[0] = bff->levels[i].lvl_map[m];
+            entries[n].payload.sizes[0] = sizeof(bff_sectormap_t);
+        }
+    }
+    for (i = 0; i < bff->header.numlevels; ++i, ++n) {
+        toc[n].type = CT_LEVEL;
+        toc[n].align = BFF_ALIGN;
+        entries[n].payload.parts[0] = bff->levels[i].spawnlist;
+        entries[n].payload.sizes[0] = sizeof(uint16_t) * bff->levels[i].spawncount;
+    }
+    for (i = 0; i < bff->header.numspawns; ++i, ++n) {
+        const bff_spawn_t* spn = &bff->spawns[i];
+        bff_spawnchunk_t* chunk = &entries[n].spawn;
+        memcpy(chunk->entityid, spn->entityid, sizeof(chunk->entityid));
+        chunk->what = spn->what;
+        chunk->replacement = spn->replacement;
+        chunk->marker = spn->marker;
+        chunk->where[0] = spn->where.y;
+        chunk->where[1] = spn->where.x;
+
+        toc[n].type = CT_SPAWN;
+        toc[n].align = BFF_ALIGN;
+        entries[n].payload.parts[0] = chunk;
+        entries[n].payload.sizes[0] = sizeof(bff_spawnchunk_t);
+    }
+    for (i = 0; i < bff->header.numtextures; ++i, ++n) {
+        toc[n].type = CT_TEXTURE;
+        toc[n].align = BFF_ALIGN;
+        entries[n].payload.parts[0] = bff->textures[i].buffer;
+        entries[n].payload.sizes[0] = bff->textures[i].fsize;
+    }
+    for (i = 0; i < bff->header.numsounds; ++i, ++n) {
+        toc[n].type = CT_SOUND;
+        toc[n].format = bff->sounds[i].type;
+        toc[n].align = BFF_ALIGN;
+        toc[n].lvl_index = bff->sounds[i].lvl_index;
+        entries[n].payload.parts[0] = bff->sounds[i].filebuf;
+        entries[n].payload.sizes[0] = bff->sounds[i].fsize;
+    }
+    for (n = 0; n < numchunks; ++n) {
+        entries[n].chunk = &toc[n];
+        if (toc[n].type != CT_SOUND)
+            toc[n].lvl_index = -1;
+    }
+
+    LOG_INFO("converting {} to {}", infile, outfile);
+    G_PackBFF(outfile, entries, toc, numchunks, NULL, packer);
+
+    for (i = 0; i < bff->header.numlevels; ++i) {
+        if (bff->levels[i].spawnlist)
+            Z_Free(bff->levels[i].spawnlist);
+    }
+    for (i = 0; i < bff->header.numtextures; ++i)
+        xfree(bff->textures[i].buffer);
+    for (i = 0; i < bff->header.numsounds; ++i)
+        xfree(bff->sounds[i].filebuf);
+    Z_Free(entries);
+    Z_Free(toc);
+    N_ShutdownJobs();
     exit(EXIT_SUCCESS);
-}
\ No newline at end of file
+}
@@ -119,15 +119,132 @@ typedef struct bff_file_s
     bff_texture_t* textures;
 } bff_file_t;
 
+//
+// v2 archives: a header, a table of contents, then the chunk payloads, each one starting on
+// its own alignment. The runtime maps the whole file and hands out const views straight into
+// it, nothing's copied. A chunk can be compressed, those get unpacked into the zone when the
+// archive's mapped, sectors whenever they're paged in. Chunks with the same contents share one payload, their toc entries point
+// at the same offset. v1 archives (HEADER_MAGIC) only go through G_ConvertBFF
+//
+
+#define BFF_MAGIC       0x32464642  // "BFF2"
+#define BFF_VERSION     4           // 3 added per chunk compression, 4 split levels into sectors and shared payloads
+#define BFF_ALIGN       64          // payloads start on a cache line
+#define BFF_LEVELALIGN  4096        // sectors on a page, so they can be paged per sector
+
+// sectors come first, a level's spawnlist is built out of what its sectors turned up
+typedef enum : uint8_t
+{
+    CT_SECTOR,
+    CT_LEVEL,
+    CT_SPAWN,
+    CT_TEXTURE,
+    CT_SOUND,
+
+    NUMCHUNKTYPES
+} bffchunktype_t;
+
+typedef enum : uint8_t
+{
+    BC_NONE,
+    BC_LZ4,         // lz4 and lz4hc write the same format, hc just spends longer finding matches
+    BC_ZSTD,
+
+    NUMBFFCODECS
+} bffcodec_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t filesize;      // catches a truncated archive before anything's read off the end
+    uint32_t numchunks;
+    uint32_t tocchecksum;   // crc32 of the toc
+} bffheader_t;
+
+// the toc is sorted by type, a chunk's index is its place among the ones of its type
+typedef struct
+{
+    bffchunktype_t type;
+    uint8_t format;         // FT_* for sounds
+    uint16_t align;
+    int32_t lvl_index;      // sounds tied to a level, -1 for everything else
+    uint64_t offset;        // from the start of the archive
+    uint64_t size;          // what's in the archive
+    uint64_t rawsize;       // what it unpacks to, the same as size if it isn't compressed
+    uint32_t checksum;      // crc32 of the payload as it's stored, checked the first time it's looked at
+    bffcodec_t codec;
+    uint8_t pad[3];
+} bffchunk_t;
+
+// level l is sector chunks l*NUMSECTORS..l*NUMSECTORS+NUMSECTORS-1, its own chunk is just
+// the spawnlist
+typedef sprite_t bff_sectormap_t[SECTOR_MAX_Y][SECTOR_MAX_X];
+typedef sprite_t bff_levelmap_t[NUMSECTORS][SECTOR_MAX_Y][SECTOR_MAX_X];
+
+typedef struct
+{
+    char entityid[BFF_STR_SIZE+1];
+    uint8_t what;
+    sprite_t replacement;
+    sprite_t marker;
+    float where[2];         // y, x inside the sector the marker was in
+} bff_spawnchunk_t;
+
+static_assert(sizeof(bffheader_t) == 24, "bffheader_t is on disk, it can't change size");
+static_assert(sizeof(bffchunk_t) == 40, "bffchunk_t is on disk, it can't change size");
+static_assert(sizeof(bff_spawnchunk_t) == 92, "bff_spawnchunk_t is on disk, it can't change size");
+
 extern uint64_t extra_heap;
 extern bff_file_t* bff;
-extern bff_level_t* levels;
-extern bff_texture_t* textures;
-extern bff_spawn_t* spawns;
 extern bffinfo_t bffinfo;
 
 void G_LoadBFF(const std::string& bffname);
 void G_ExtractBFF(const std::string& filepath);
-void G_WriteBFF(const char* outfile, const char* dirname);
+// codec is what levels and textures get packed with: none, lz4, lz4hc, zstd or zstdmax,
+// NULL for lz4
+void G_WriteBFF(const char* outfile, const char* dirname, const char *codec);
+void G_ConvertBFF(const char* infile, const char* outfile, const char *codec);
+
+uint32_t G_CRC32(uint32_t crc, const void *data, size_t size);
+
+void G_MapBFF(const char *path);
+void G_UnmapBFF(void);
+uint32_t G_BFFNumChunks(bffchunktype_t type);
+const bffchunk_t* G_BFFChunkInfo(bffchunktype_t type, uint32_t index);
+const void* G_BFFChunk(bffchunktype_t type, uint32_t index, uint64_t* size);
+// compressed textures go through the hunk's cache, the view's gone after the next cache allocation
+const void* G_BFFCacheChunk(bffchunktype_t type, uint32_t index, uint64_t* size);
+// the first chunk of the same type with the same payload, index itself if nothing before it has one
+uint32_t G_BFFChunkAlias(bffchunktype_t type, uint32_t index);
+// unpacks or copies a chunk into out, which has to hold its rawsize, safe to call from a job
+void G_ReadChunk(bffchunktype_t type, uint32_t index, void *out);
+const uint16_t* G_BFFLevelSpawns(uint32_t level, uint32_t* count);
+const bff_spawnchunk_t* G_BFFSpawn(uint32_t index);
+
+//
+// sectors aren't unpacked when the archive's mapped, they're paged in as the player gets
+// near them. The last scf::memory::level_sectors of them that got used stay resident in the
+// level zone, older ones go purgable and are taken back if the zone hasn't thrown them out
+// by the time they're wanted again, so what's in memory doesn't grow with the level count.
+// A level's sectors sit in a grid SECTORS_ACROSS wide, sector m at row m / SECTORS_ACROSS
+// and column m % SECTORS_ACROSS. None of this is thread safe, the loading code and the tics
+// are the only ones that call in and never at the same time
+//
+
+#define SECTORS_ACROSS      2
+#define SECTOR_PREFETCH     16      // cells off a sector's edge the player has to be for it to get unpacked ahead of time
+
+// G_MapBFF and G_UnmapBFF take care of these
+void G_InitSectors(void);
+void G_ShutdownSectors(void);
+// the level G_UpdateSectors goes by, switching levels exits the old one first
+void G_EnterLevel(uint32_t level);
+// pages every sector out, in one go if the level zone has a budget of its own
+void G_ExitLevel(void);
+// once a tic, pages in the sector the player's in and starts on the ones they're close to
+void G_UpdateSectors(float y, float x);
+// pages the sector in if it isn't already, the view's good until the next sector's paged in
+const bff_sectormap_t* G_BFFLevelSector(uint32_t level, uint32_t sector);
 
 #endif
\ No newline at end of file
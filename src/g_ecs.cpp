@@ -0,0 +1,154 @@
+#include "n_shared.h"
+#include "g_game.h"
+
+static std::atomic<uint32_t> numcomponents{0};
+
+// per thread so systems in the same phase can run side by side
+static thread_local const system_t* running;
+
+uint32_t G_NewComponentId(void)
+{
+    const uint32_t id = numcomponents++;
+    if (id >= MAX_COMPONENTS)
+        N_Error("G_NewComponentId: more than %i component types", MAX_COMPONENTS);
+    return id;
+}
+
+void Registry::Init(EntityStore* entities)
+{
+    store = entities;
+    memset(sets, 0, sizeof(sets));
+    numsystems = numphases = 0;
+}
+
+void Registry::Shutdown(void)
+{
+    for (uint32_t i = 0; i < MAX_COMPONENTS; ++i) {
+        if (!sets[i])
+            continue;
+        sets[i]->~ComponentSetBase();
+        Z_Free(sets[i]);
+    }
+    numsystems = numphases = 0;
+}
+
+void Registry::Clear(void)
+{
+    for (uint32_t i = 0; i < MAX_COMPONENTS; ++i) {
+        if (sets[i])
+            sets[i]->Clear();
+    }
+    store->Clear();
+}
+
+entityhandle_t Registry::Create(void)
+{
+    return store->Spawn();
+}
+
+void Registry::Destroy(entityhandle_t h)
+{
+    if (!store->Valid(h))
+        N_Error("Registry::Destroy: stale entity handle %x", h);
+
+    for (uint32_t i = 0; i < MAX_COMPONENTS; ++i) {
+        if (sets[i] && sets[i]->Has(h))
+            sets[i]->Remove(h);
+    }
+    store->Kill(h);
+}
+
+void Registry::CheckAccess(componentmask_t reads, componentmask_t writes) const
+{
+    // outside of a system anything goes
+    if (!running)
+        return;
+
+    if (reads & ~(running->reads | running->writes))
+        N_Error("Registry::Each: system %s reads components it didn't declare", running->name);
+    if (writes & ~running->writes)
+        N_Error("Registry::Each: system %s writes components it didn't declare", running->name);
+}
+
+//
+// Registry::AddSystem: systems run in the order they're added, except that one that
+// doesn't conflict with anything registered since the last conflicting one is pulled
+// up into that phase. Everything in a phase can run at the same time
+//
+void Registry::AddSystem(const char *name, componentmask_t reads, componentmask_t writes, systemfunc_t func)
+{
+    system_t* sys;
+    uint32_t i, phase;
+
+    if (numsystems >= MAX_SYSTEMS)
+        N_Error("Registry::AddSystem: more than %i systems", MAX_SYSTEMS);
+
+    phase = 0;
+    for (i = 0; i < numsystems; ++i) {
+        const system_t* other = &systems[i];
+        if ((writes & (other->reads | other->writes)) || (other->writes & reads))
+            phase = other->phase + 1 > phase ? other->phase + 1 : phase;
+    }
+
+    sys = &systems[numsystems++];
+    sys->name = name;
+    sys->reads = reads;
+    sys->writes = writes;
+    sys->func = func;
+    sys->phase = phase;
+    if (phase + 1 > numphases)
+        numphases = phase + 1;
+
+    LOG_DEBUG("Registry::AddSystem: {} in phase {}", name, phase);
+}
+
+void Registry::RunSystem(const system_t* sys)
+{
+    const system_t* const prev = running;
+
+    running = sys;
+    sys->func(*this);
+    running = prev;
+}
+
+typedef struct
+{
+    Registry* reg;
+    const system_t* sys;
+} systemjob_t;
+
+static void G_SystemJob(void *arg)
+{
+    const systemjob_t* job = (const systemjob_t *)arg;
+    job->reg->RunSystem(job->sys);
+}
+
+// phases go in order, within one the order doesn't matter since nothing in it conflicts, so
+// a phase with more than one system in it goes out to the job workers
+void Registry::RunSystems(void)
+{
+    systemjob_t args[MAX_SYSTEMS];
+    job_t jobs[MAX_SYSTEMS];
+    jobcounter_t pending{0};
+    uint32_t n;
+
+    for (uint32_t phase = 0; phase < numphases; ++phase) {
+        n = 0;
+        for (uint32_t i = 0; i < numsystems; ++i) {
+            if (systems[i].phase != phase)
+                continue;
+            args[n].reg = this;
+            args[n].sys = &systems[i];
+            jobs[n].func = G_SystemJob;
+            jobs[n].arg = &args[n];
+            jobs[n].name = systems[i].name;
+            ++n;
+        }
+        if (n == 1)
+            RunSystem(args[0].sys);
+        else if (n > 1) {
+            N_RunJobs(jobs, n, &pending);
+            N_WaitJobs(&pending);
+        }
+    }
+}
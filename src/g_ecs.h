@@ -0,0 +1,338 @@
+#ifndef _G_ECS_
+#define _G_ECS_
+
+#pragma once
+
+// component registry on top of the EntityStore, every component type gets its own
+// sparse set: a slot-indexed sparse table pointing into a packed array of components
+// and the handles that own them, so iterating a component is a linear walk and
+// add/remove/lookup are O(1)
+
+#define MAX_COMPONENTS 64
+
+typedef uint64_t componentmask_t;
+
+uint32_t G_NewComponentId(void);
+
+// ids are handed out on first use, const doesn't make a different component
+template<typename T>
+inline uint32_t G_ComponentId(void)
+{
+    static const uint32_t id = G_NewComponentId();
+    return id;
+}
+template<typename T>
+inline uint32_t G_ComponentIdOf(void)
+{ return G_ComponentId<std::remove_cv_t<T>>(); }
+
+template<typename... Ts>
+inline componentmask_t G_ComponentMask(void)
+{ return (componentmask_t(0) | ... | (componentmask_t(1) << G_ComponentIdOf<Ts>())); }
+// just the ones that aren't const
+template<typename... Ts>
+inline componentmask_t G_WriteMask(void)
+{ return (componentmask_t(0) | ... | (std::is_const_v<Ts> ? componentmask_t(0) : componentmask_t(1) << G_ComponentIdOf<Ts>())); }
+
+#define COMPONENT_NONE 0xffff
+
+class ComponentSetBase
+{
+protected:
+    uint16_t* sparse;           // slot -> packed index
+    entityhandle_t* handles;    // packed index -> owner
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t numsparse;
+
+    inline void InitBase(void)
+    {
+        sparse = NULL;
+        handles = NULL;
+        count = capacity = numsparse = 0;
+    }
+    inline void ShutdownBase(void)
+    {
+        if (sparse)
+            Z_Free(sparse);
+        if (handles)
+            Z_Free(handles);
+        InitBase();
+    }
+    inline void GrowSparse(uint32_t slot)
+    {
+        uint32_t nsparse = numsparse ? numsparse : 64;
+        while (nsparse <= slot)
+            nsparse <<= 1;
+        sparse = (uint16_t *)Z_Realloc(sparse, sizeof(*sparse) * nsparse, &sparse, TAG_STATIC, "compsparse");
+        memset(sparse + numsparse, 0xff, sizeof(*sparse) * (nsparse - numsparse));
+        numsparse = nsparse;
+    }
+    // claims a packed index for h, the caller constructs the component there
+    inline uint32_t Link(entityhandle_t h)
+    {
+        const uint32_t slot = ENTITY_SLOT(h);
+        if (slot >= numsparse)
+            GrowSparse(slot);
+        sparse[slot] = count;
+        handles[count] = h;
+        return count++;
+    }
+public:
+    virtual ~ComponentSetBase() = default;
+
+    virtual void Remove(entityhandle_t h) = 0;
+    virtual void Clear(void) = 0;
+    virtual void Shutdown(void) = 0;
+
+    inline uint32_t size(void) const { return count; }
+    inline const entityhandle_t* Handles(void) const { return handles; }
+    inline bool Has(entityhandle_t h) const
+    {
+        const uint32_t slot = ENTITY_SLOT(h);
+        if (slot >= numsparse || sparse[slot] >= count)
+            return false;
+        return handles[sparse[slot]] == h;
+    }
+    inline uint32_t Index(entityhandle_t h) const
+    {
+        if (!Has(h))
+            N_Error("ComponentSet::Index: entity %x doesn't have the component", h);
+        return sparse[ENTITY_SLOT(h)];
+    }
+};
+
+template<typename T>
+class ComponentSet : public ComponentSetBase
+{
+private:
+    T* data;
+
+    void Grow(uint32_t ncapacity)
+    {
+        T* ndata;
+
+        if (ncapacity > MAX_ENTITIES)
+            ncapacity = MAX_ENTITIES;
+        if (ncapacity <= capacity)
+            N_Error("ComponentSet::Grow: more than %i components", MAX_ENTITIES);
+
+        // components aren't assumed to be trivially copyable, so no Z_Realloc for the data
+        ndata = (T *)Z_Malloc(sizeof(T) * ncapacity, TAG_STATIC, NULL, "components");
+        for (uint32_t i = 0; i < count; ++i) {
+            new (&ndata[i]) T(std::move(data[i]));
+            data[i].~T();
+        }
+        if (data)
+            Z_Free(data);
+        data = ndata;
+        handles = (entityhandle_t *)Z_Realloc(handles, sizeof(*handles) * ncapacity, &handles, TAG_STATIC, "comphandles");
+        capacity = ncapacity;
+    }
+public:
+    ComponentSet(void)
+    {
+        InitBase();
+        data = NULL;
+    }
+    virtual ~ComponentSet() { Shutdown(); }
+
+    template<typename... Args>
+    T& Add(entityhandle_t h, Args&&... args)
+    {
+        uint32_t index;
+
+        if (Has(h))
+            N_Error("ComponentSet::Add: entity %x already has the component", h);
+        if (count == capacity)
+            Grow(capacity ? capacity * 2 : 64);
+
+        index = Link(h);
+        return *new (&data[index]) T(std::forward<Args>(args)...);
+    }
+    // the last component fills the hole, so removing never leaves a gap in the packed array
+    virtual void Remove(entityhandle_t h) override
+    {
+        const uint32_t index = Index(h);
+        const uint32_t last = count - 1;
+
+        if (index != last) {
+            data[index].~T();
+            new (&data[index]) T(std::move(data[last]));
+            handles[index] = handles[last];
+            sparse[ENTITY_SLOT(handles[index])] = index;
+        }
+        data[last].~T();
+        sparse[ENTITY_SLOT(h)] = COMPONENT_NONE;
+        --count;
+    }
+    virtual void Clear(void) override
+    {
+        for (uint32_t i = 0; i < count; ++i) {
+            sparse[ENTITY_SLOT(handles[i])] = COMPONENT_NONE;
+            data[i].~T();
+        }
+        count = 0;
+    }
+    virtual void Shutdown(void) override
+    {
+        Clear();
+        if (data)
+            Z_Free(data);
+        data = NULL;
+        ShutdownBase();
+    }
+
+    inline T& Get(entityhandle_t h) { return data[Index(h)]; }
+    inline T* TryGet(entityhandle_t h) { return Has(h) ? &data[sparse[ENTITY_SLOT(h)]] : NULL; }
+    inline T* Data(void) { return data; }
+    inline T& operator[](uint32_t index) { return data[index]; }
+};
+
+class Registry;
+typedef void (*systemfunc_t)(Registry& reg);
+
+// reads and writes are the components the system touches, two systems can share a
+// phase as long as neither writes anything the other one touches
+typedef struct
+{
+    const char *name;
+    componentmask_t reads;
+    componentmask_t writes;
+    systemfunc_t func;
+    uint32_t phase;
+} system_t;
+
+#define MAX_SYSTEMS 64
+
+template<typename... Ts>
+class View
+{
+private:
+    std::tuple<ComponentSet<std::remove_cv_t<Ts>>*...> sets;
+    ComponentSetBase* lead;
+
+    // the lead set is already at the right index, the rest go through their sparse tables
+    template<typename U>
+    inline U* Fetch(ComponentSet<U>* set, uint32_t i, entityhandle_t h) const
+    { return set == lead ? &set->Data()[i] : set->TryGet(h); }
+public:
+    View(ComponentSet<std::remove_cv_t<Ts>>*... s)
+        : sets(s...), lead(NULL)
+    {
+        // walk the smallest set, a missing one means the intersection is empty
+        ComponentSetBase* const all[] = { s... };
+        for (ComponentSetBase* set : all) {
+            if (!set) {
+                lead = NULL;
+                return;
+            }
+            if (!lead || set->size() < lead->size())
+                lead = set;
+        }
+    }
+
+    // func(entityhandle_t, Ts&...) for every entity that has all of Ts, in packed
+    // order of the smallest set. Goes back to front so func can remove the entity
+    // it's been handed without the swap skipping anybody
+    template<typename Func>
+    void Each(Func&& func)
+    {
+        if (!lead)
+            return;
+
+        for (uint32_t i = lead->size(); i-- > 0;) {
+            const entityhandle_t h = lead->Handles()[i];
+            const std::tuple<std::remove_cv_t<Ts>*...> c(Fetch(std::get<ComponentSet<std::remove_cv_t<Ts>>*>(sets), i, h)...);
+            if ((std::get<std::remove_cv_t<Ts>*>(c) && ...))
+                func(h, *std::get<std::remove_cv_t<Ts>*>(c)...);
+        }
+    }
+    inline uint32_t SizeHint(void) const { return lead ? lead->size() : 0; }
+};
+
+// not constructed either, Game owns it
+class Registry
+{
+private:
+    EntityStore* store;
+    ComponentSetBase* sets[MAX_COMPONENTS];
+    system_t systems[MAX_SYSTEMS];
+    uint32_t numsystems;
+    uint32_t numphases;
+
+    template<typename T>
+    inline ComponentSet<T>* Find(void) const
+    { return static_cast<ComponentSet<T> *>(sets[G_ComponentId<T>()]); }
+    void CheckAccess(componentmask_t reads, componentmask_t writes) const;
+public:
+    void Init(EntityStore* entities);
+    void Shutdown(void);
+    // drops every component and every entity, for level changes and loads
+    void Clear(void);
+
+    entityhandle_t Create(void);
+    // strips the components before the handle goes stale, entities with components
+    // should never be Kill'd on the store directly
+    void Destroy(entityhandle_t h);
+    inline bool Valid(entityhandle_t h) const { return store->Valid(h); }
+    inline EntityStore* Entities(void) const { return store; }
+
+    // sets are made on first use, so the first Add of a component type shouldn't
+    // happen inside a phase that's running in parallel
+    template<typename T>
+    ComponentSet<T>* Set(void)
+    {
+        const uint32_t id = G_ComponentId<T>();
+        if (!sets[id]) {
+            void *mem = Z_Malloc(sizeof(ComponentSet<T>), TAG_STATIC, &sets[id], "compset");
+            new (mem) ComponentSet<T>();
+        }
+        return static_cast<ComponentSet<T> *>(sets[id]);
+    }
+
+    template<typename T, typename... Args>
+    inline T& Add(entityhandle_t h, Args&&... args)
+    {
+        if (!store->Valid(h))
+            N_Error("Registry::Add: stale entity handle %x", h);
+        return Set<T>()->Add(h, std::forward<Args>(args)...);
+    }
+    template<typename T>
+    inline void Remove(entityhandle_t h) { Set<T>()->Remove(h); }
+    template<typename T>
+    inline bool Has(entityhandle_t h) const
+    {
+        const ComponentSet<T>* set = Find<T>();
+        return set && set->Has(h);
+    }
+    template<typename T>
+    inline T& Get(entityhandle_t h) { return Set<T>()->Get(h); }
+    template<typename T>
+    inline T* TryGet(entityhandle_t h)
+    {
+        ComponentSet<T>* set = Find<T>();
+        return set ? set->TryGet(h) : NULL;
+    }
+
+    // const components are reads, everything else is a write, debug builds hold the
+    // running system to what it declared
+    template<typename... Ts>
+    View<Ts...> Each(void)
+    {
+#ifdef _NOMAD_DEBUG
+        CheckAccess(G_ComponentMask<Ts...>(), G_WriteMask<Ts...>());
+#endif
+        return View<Ts...>(Find<std::remove_cv_t<Ts>>()...);
+    }
+    template<typename... Ts, typename Func>
+    inline void Each(Func&& func) { Each<Ts...>().Each(std::forward<Func>(func)); }
+
+    void AddSystem(const char *name, componentmask_t reads, componentmask_t writes, systemfunc_t func);
+    inline uint32_t NumSystems(void) const { return numsystems; }
+    inline uint32_t NumPhases(void) const { return numphases; }
+    inline const system_t* System(uint32_t i) const { return &systems[i]; }
+    void RunSystem(const system_t* sys);
+    void RunSystems(void);
+};
+
+#endif
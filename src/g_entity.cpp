@@ -0,0 +1,138 @@
+#include "n_shared.h"
+#include "g_game.h"
+
+void EntityStore::Init(uint32_t initial)
+{
+    coords = NULL;
+    thrust = NULL;
+    health = NULL;
+    flags = NULL;
+    state = NULL;
+    info = NULL;
+    slots = NULL;
+    dense = NULL;
+    generation = NULL;
+    freeslots = NULL;
+    numfree = count = capacity = numslots = 0;
+
+    Grow(initial ? initial : 64);
+}
+
+void EntityStore::Shutdown(void)
+{
+    if (!capacity)
+        return;
+
+    Z_Free(coords);
+    Z_Free(thrust);
+    Z_Free(health);
+    Z_Free(flags);
+    Z_Free(state);
+    Z_Free(info);
+    Z_Free(slots);
+    Z_Free(dense);
+    Z_Free(generation);
+    Z_Free(freeslots);
+    capacity = 0;
+}
+
+// every array grows together, the slot tables grow with them since there
+// can never be more slots than entities that were alive at once
+void EntityStore::Grow(uint32_t ncapacity)
+{
+    if (ncapacity > MAX_ENTITIES)
+        ncapacity = MAX_ENTITIES;
+    if (ncapacity <= capacity)
+        N_Error("EntityStore::Grow: more than %i entities", MAX_ENTITIES);
+
+    coords = (glm::vec3 *)Z_Realloc(coords, sizeof(*coords) * ncapacity, &coords, TAG_STATIC, "entcoords");
+    thrust = (glm::vec3 *)Z_Realloc(thrust, sizeof(*thrust) * ncapacity, &thrust, TAG_STATIC, "entthrust");
+    health = (uint32_t *)Z_Realloc(health, sizeof(*health) * ncapacity, &health, TAG_STATIC, "enthealth");
+    flags = (entityflag_t *)Z_Realloc(flags, sizeof(*flags) * ncapacity, &flags, TAG_STATIC, "entflags");
+    state = (state_t *)Z_Realloc(state, sizeof(*state) * ncapacity, &state, TAG_STATIC, "entstate");
+    info = (entityinfo_t *)Z_Realloc(info, sizeof(*info) * ncapacity, &info, TAG_STATIC, "entinfo");
+    slots = (uint16_t *)Z_Realloc(slots, sizeof(*slots) * ncapacity, &slots, TAG_STATIC, "entslots");
+    dense = (uint16_t *)Z_Realloc(dense, sizeof(*dense) * ncapacity, &dense, TAG_STATIC, "entdense");
+    generation = (uint16_t *)Z_Realloc(generation, sizeof(*generation) * ncapacity, &generation, TAG_STATIC, "entgens");
+    freeslots = (uint16_t *)Z_Realloc(freeslots, sizeof(*freeslots) * ncapacity, &freeslots, TAG_STATIC, "entfree");
+    capacity = ncapacity;
+}
+
+void EntityStore::Clear(void)
+{
+    uint32_t i;
+
+    // bump every generation so nothing handed out before survives the clear
+    for (i = 0; i < numslots; ++i) {
+        if (++generation[i] == 0)
+            generation[i] = 1;
+        freeslots[i] = numslots - 1 - i;
+    }
+    numfree = numslots;
+    count = 0;
+}
+
+entityhandle_t EntityStore::Spawn(void)
+{
+    uint32_t index;
+    uint16_t slot;
+
+    if (count == capacity)
+        Grow(capacity * 2);
+
+    if (numfree)
+        slot = freeslots[--numfree];
+    else {
+        slot = numslots++;
+        generation[slot] = 1;
+    }
+
+    index = count++;
+    dense[slot] = index;
+    slots[index] = slot;
+
+    coords[index] = glm::vec3(0.0f);
+    thrust[index] = glm::vec3(0.0f);
+    health[index] = 0;
+    flags[index] = (entityflag_t)0;
+    memset(&state[index], 0, sizeof(state_t));
+    memset(&info[index], 0, sizeof(entityinfo_t));
+
+    return Handle(index);
+}
+
+void EntityStore::Kill(entityhandle_t h)
+{
+    uint32_t index, last;
+    uint16_t slot;
+
+    index = Index(h);
+    slot = ENTITY_SLOT(h);
+    last = --count;
+
+    // the last one fills the hole
+    if (index != last) {
+        coords[index] = coords[last];
+        thrust[index] = thrust[last];
+        health[index] = health[last];
+        flags[index] = flags[last];
+        state[index] = state[last];
+        info[index] = info[last];
+        slots[index] = slots[last];
+        dense[slots[index]] = index;
+    }
+
+    if (++generation[slot] == 0)
+        generation[slot] = 1;
+    freeslots[numfree++] = slot;
+}
+
+void EntityStore::Move(void)
+{
+    glm::vec3* const c = coords;
+    const glm::vec3* const t = thrust;
+    const uint32_t n = count;
+
+    for (uint32_t i = 0; i < n; ++i)
+        c[i] += t[i];
+}
@@ -91,4 +91,102 @@ typedef struct entity_s
     struct entity_s* target;
 } entity_t;
 
+//
+// entity store: every field of every live entity sits in its own packed array, indexed
+// 0..count-1, so a pass that only needs positions only walks positions. Killing an entity
+// moves the last one into its place, so anything held across frames has to be a handle
+// rather than an index or a pointer
+//
+
+// low 16 bits are the slot, high 16 bits the generation of the slot, a handle
+// goes stale once the entity it named is killed
+typedef uint32_t entityhandle_t;
+
+#define ENTITY_NONE          ((entityhandle_t)0)
+#define ENTITY_SLOTBITS      16
+#define ENTITY_SLOT(h)       ((h) & ((1 << ENTITY_SLOTBITS) - 1))
+#define ENTITY_GENERATION(h) ((h) >> ENTITY_SLOTBITS)
+#define MAX_ENTITIES         ((1 << ENTITY_SLOTBITS) - 1)
+
+// the parts nothing touches every tic
+typedef struct
+{
+    char name[80];
+    armortype_t armor;
+    entitytype_t type;
+    statenum_t spawnstate;
+    statenum_t deadstate;
+    sprite_t sprite;
+    glm::vec2 lookangle;
+    vec2_t hitbox[4];
+    vec3_t to;
+    int64_t ticker;
+    uint8_t dir;
+    entityhandle_t target;
+} entityinfo_t;
+
+class EntityStore
+{
+public:
+    // hot, one array per field
+    glm::vec3* coords;
+    glm::vec3* thrust;
+    uint32_t* health;
+    entityflag_t* flags;
+    state_t* state;
+    // cold
+    entityinfo_t* info;
+
+    // dense index -> slot
+    uint16_t* slots;
+private:
+    // slot -> dense index and generation, free slots are a stack
+    uint16_t* dense;
+    uint16_t* generation;
+    uint16_t* freeslots;
+    uint32_t numfree;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t numslots;
+
+    void Grow(uint32_t ncapacity);
+public:
+    // the store lives in the zone like the rest of Game, so there's no constructor to lean on
+    void Init(uint32_t initial);
+    void Shutdown(void);
+    void Clear(void);
+
+    entityhandle_t Spawn(void);
+    void Kill(entityhandle_t h);
+
+    inline uint32_t size(void) const { return count; }
+    inline bool Valid(entityhandle_t h) const
+    {
+        uint32_t slot = ENTITY_SLOT(h);
+        return h != ENTITY_NONE && slot < numslots && generation[slot] == ENTITY_GENERATION(h);
+    }
+    // dense index of a live handle, only good until the next Kill
+    inline uint32_t Index(entityhandle_t h) const
+    {
+        if (!Valid(h))
+            N_Error("EntityStore::Index: stale entity handle %x", h);
+        return dense[ENTITY_SLOT(h)];
+    }
+    inline entityhandle_t Handle(uint32_t index) const
+    {
+        uint16_t slot = slots[index];
+        return ((entityhandle_t)generation[slot] << ENTITY_SLOTBITS) | slot;
+    }
+
+    inline glm::vec3& Coords(entityhandle_t h) { return coords[Index(h)]; }
+    inline glm::vec3& Thrust(entityhandle_t h) { return thrust[Index(h)]; }
+    inline uint32_t& Health(entityhandle_t h) { return health[Index(h)]; }
+    inline entityflag_t& Flags(entityhandle_t h) { return flags[Index(h)]; }
+    inline state_t& State(entityhandle_t h) { return state[Index(h)]; }
+    inline entityinfo_t& Info(entityhandle_t h) { return info[Index(h)]; }
+
+    // coords += thrust for everybody, the shape every hot pass over the store should have
+    void Move(void);
+};
+
 #endif
\ No newline at end of file
@@ -71,7 +71,10 @@ void Log::Init()
 
 void Game::Init()
 {
-    gptr = (Game *)Z_Malloc(sizeof(Game), TAG_STATIC, &gptr, "gptr");
+    // constructed in place so members with real constructors (the linked_list
+    // sentinel, default member initializers) aren't left as zeroed zone memory,
+    // the shutdown paths already run ~Game() explicitly
+    gptr = new (Z_Malloc(sizeof(Game), TAG_STATIC, &gptr, "gptr")) Game();
     assert(gptr);
     void *pad = Z_Malloc(64, TAG_STATIC, &pad, "padding64");
     memset(Game::Get()->bffname, 0, sizeof(Game::Get()->bffname));
@@ -83,6 +86,9 @@ void Game::Init()
     strncpy(Game::Get()->scfname, "default.scf", sizeof(Game::Get()->scfname));
     strncpy(Game::Get()->svfile, "nomadsv.ngd", sizeof(Game::Get()->svfile));
     Game::Get()->gamestate = GS_MENU;
+    Game::Get()->entities.Init(MAX_MOBS_ACTIVE + 1);
+    Game::Get()->registry.Init(&Game::Get()->entities);
+    Game::Get()->registry.AddSystem("mobthink", 0, G_ComponentMask<Mob>(), M_Think);
 
     Game::Get()->playrs = (playr_t *)Z_Malloc(sizeof(playr_t) * 10, TAG_STATIC, &Game::Get()->playrs, "pstructs");
     pad = Z_Malloc(64, TAG_STATIC, &pad, "padding64"); // will not need to be freed
@@ -97,12 +103,24 @@ void Game::Init()
 
 Game::~Game()
 {
+    N_ShutdownJobs();
+    Z_FlushEvents();
     Log::GetLogger()->flush();
     if (!bff_mode) {
 //        ImGui_ShutDown();
         Snd_Kill();
         R_ShutDown();
+        G_UnmapBFF();
+        Memory_Shutdown();
     }
     xalloc_stats();
     xalloc_destroy();
-}
\ No newline at end of file
+}
+entityhandle_t G_SpawnItem(const item_t& item)
+{
+    Registry& reg = Game::Get()->registry;
+
+    const entityhandle_t h = reg.Create();
+    reg.Add<item_t>(h, item);
+    return h;
+}
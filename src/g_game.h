@@ -6,9 +6,13 @@
 
 inline void N_DebugWindowClear();
 inline void N_DebugWindowDraw();
+void G_PaceFrame(void);
 
-#include "g_entity.h"
 #include "g_zone.h"
+#include "n_alloc.h"
+#include "n_jobs.h"
+#include "g_entity.h"
+#include "g_ecs.h"
 #include "n_console.h"
 #include "n_scf.h"
 #include "m_renderer.h"
@@ -68,7 +72,7 @@ inline void N_DebugWindowDraw()
     SDL_GL_SwapWindow(renderer->window);
     //R_FlushBuffer();
 
-    sleepfor(scf::renderer::ticrate);
+    G_PaceFrame();
 }
 
 inline void N_DrawFPS()
@@ -132,7 +136,8 @@ public:
     playr_t* playrs = NULL; // for when multiplayer is added
     playr_t* playr; // player on the current machine
     gamestate_t gamestate;
-    linked_list<entity_t> entities;
+    EntityStore entities;
+    Registry registry;
     uint8_t difficulty;
 
     bff_file_t* file = NULL;
@@ -155,8 +160,7 @@ inline bool imgui_on = false;
 void G_SaveGame();
 void G_LoadGame();
 json& N_GetSaveJSon();
-void G_SpawnItem(item_t item);
-void G_SpawnItem(const item_t& item);
+entityhandle_t G_SpawnItem(const item_t& item);
 
 inline coord_t E_GetDir(byte dir)
 {
@@ -178,4 +182,13 @@ void ImGui_ShutDown();
 void I_NomadInit(int argc, char** argv);
 void N_MainLoop();
 
+void G_Ticker(void);
+void G_RunFrame(jobfunc_t input, void *arg);
+void G_ResetTics(void);
+uint32_t G_RunTics(void (*ticker)(void));
+float G_TicLerp(void);
+int64_t G_FrameTimeLeft(void);
+
+void P_RunPhysics(void);
+
 #endif
\ No newline at end of file
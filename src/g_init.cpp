@@ -206,7 +206,7 @@ void mainLoop()
     fbo->SetScreenTexture(screenTexture);
 
 
-    renderer->camera = CONSTRUCT(Camera, "camera", -3.0f, 3.0f, -3.0f, 3.0f);
+    renderer->camera = ZONE_CONSTRUCT(ZONE_RENDERER, Camera, "camera", -3.0f, 3.0f, -3.0f, 3.0f);
     std::vector<glm::vec3> translations = {
         glm::vec3(0, -1, 0),
         glm::vec3(1, 0, 0),
@@ -219,7 +219,7 @@ void mainLoop()
 
     float light_intensity = 1.0f;
 
-    std::chrono::high_resolution_clock::time_point next = std::chrono::high_resolution_clock::now();
+    G_ResetTics();
     while (1) {
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) {
@@ -284,8 +284,9 @@ void mainLoop()
 //            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL);
 //            screenTexture->Unbind();
 //        }
-        next += std::chrono::milliseconds(1000 / scf::renderer::ticrate);
-        
+        // the events are polled above since they poke at the loop's locals
+        G_RunFrame(NULL, NULL);
+
         fbo->SetDefault();
 
         shader->Bind();
@@ -309,7 +310,17 @@ void mainLoop()
 
         SDL_GL_SwapWindow(renderer->window);
 
-        std::this_thread::sleep_until(next);
+        Z_CheckHeapStep();
+        Z_FlushEvents();
+        Z_FlipTemp();
+        Cache_UpdatePrefetch();
+
+        // whatever's left of the frame goes to defragmenting the zone
+        const int64_t idle = G_FrameTimeLeft();
+        if (idle > 2)
+            Z_Compact(idle - 2);
+
+        G_PaceFrame();
     }
 }
 
@@ -331,43 +342,97 @@ void I_NomadInit(int argc, char** argv)
     if (i != -1) {
         bff_mode = true;
 
-        bool operations[4];
+        // the operation's the argument after -bff, its arguments come after that
+        const char *op = i < myargc - 1 ? myargv[i + 1] : "";
+        bool operations[5];
         memset(operations, false, sizeof(operations));
-        if (strstr(myargv[i], "help"))
+        if (strstr(op, "help"))
             operations[0] = true;
-        else if (strstr(myargv[i], "write"))
+        else if (strstr(op, "write"))
             operations[1] = true;
-        else if (strstr(myargv[i], "read"))
+        else if (strstr(op, "read"))
             operations[2] = true;
-        else if (strstr(myargv[i], "extract"))
+        else if (strstr(op, "extract"))
             operations[3] = true;
+        else if (strstr(op, "convert"))
+            operations[4] = true;
 
-        if (operations[0] || (!operations[1] && !operations[2] && !operations[3])) {
+        if (operations[0] || (!operations[1] && !operations[2] && !operations[3] && !operations[4])) {
             fprintf(stdout,
                 "%s -bff [operation] <arguments...>\n"
                 "operations:\n"
-                "  write [output] [dirpath]    write a bff file given an output file and a directory path\n"
-                "  extract [input]             extract a written bff file to the game's file tree to use as a mod\n",
+                "  write [output] [dirpath] <codec>    write a bff file given an output file and a directory path\n"
+                "  extract [input]                     extract a written bff file to the game's file tree to use as a mod\n"
+                "  convert [input] [output] <codec>    rewrite a version 1 bff file as version 2\n"
+                "codecs for levels and textures: none, lz4 (the default), lz4hc, zstd, zstdmax\n",
             myargv[0]);
             exit(EXIT_SUCCESS);
         }
         
+        // the packer and the unpacker both farm their chunks out, every operation shuts the
+        // workers down again before it exits
+        const int jobs = I_GetParm("-jobs");
+        N_InitJobs(jobs != -1 && jobs < myargc - 1 ? atoi(myargv[jobs + 1]) : 0);
+        const char *codec = myargc > i + 4 && myargv[i + 4][0] != '-' ? myargv[i + 4] : NULL;
+
         if (operations[1]) {
-            if (myargc < (i + 1) || myargc < (i + 2)) {
+            if (myargc <= i + 3) {
                 N_Error("output and/or dirpath not provided to bff write operations, aborting.");
             }
-            G_WriteBFF(myargv[i + 1], myargv[i + 2]);
+            G_WriteBFF(myargv[i + 2], myargv[i + 3], codec);
         }
         else if (operations[3]) {
-            if (myargc < (i + 1)) {
+            if (myargc <= i + 2) {
                 N_Error("input file must be provided to bff extract operations, aborting.");
             }
-            G_ExtractBFF(myargv[i + 1]);
+            G_ExtractBFF(myargv[i + 2]);
+        }
+        else if (operations[4]) {
+            if (myargc <= i + 3) {
+                N_Error("input and/or output not provided to bff convert operations, aborting.");
+            }
+            G_ConvertBFF(myargv[i + 2], myargv[i + 3], codec);
         }
     }
+    i = I_GetParm("-zonereport");
+    if (i != -1) {
+        Z_PrintReport(i < myargc - 1 ? myargv[i + 1] : ZONE_EVENT_FILE);
+        exit(EXIT_SUCCESS);
+    }
+    i = I_GetParm("-zonebench");
+    if (i != -1) {
+        Z_Init();
+        Z_Benchmark(i < myargc - 1 ? strtoul(myargv[i + 1], NULL, 10) : 0);
+        exit(EXIT_SUCCESS);
+    }
+    i = I_GetParm("-zonestress");
+    if (i != -1) {
+        Z_Init();
+        Z_StressTest(i < myargc - 1 && atoi(myargv[i + 1]) > 0 ? atoi(myargv[i + 1]) : 8,
+            i < myargc - 2 && atol(myargv[i + 2]) > 0 ? atol(myargv[i + 2]) : 1000000);
+        exit(EXIT_SUCCESS);
+    }
+
+    // the zone budgets come from the scf, so it has to be parsed before Z_Init
+    con.ConPrintf("G_LoadSCF: parsing scf file");
+    G_LoadSCF();
+
+    // up before the bff so the compressed chunks get unpacked in parallel
+    i = I_GetParm("-jobs");
+    N_InitJobs(i != -1 && i < myargc - 1 ? atoi(myargv[i + 1]) : 0);
+
     con.ConPrintf("G_LoadBFF: loading bff file");
     G_LoadBFF("nomadmain.bff");
 
+    i = I_GetParm("-thinkcheck");
+    if (i != -1) {
+        M_CheckThink(i < myargc - 1 && atoi(myargv[i + 1]) > 0 ? atoi(myargv[i + 1]) : 3000,
+            i < myargc - 2 && atoi(myargv[i + 2]) > 0 ? atoi(myargv[i + 2]) : 200,
+            MAX_JOB_WORKERS);
+        N_ShutdownJobs();
+        exit(EXIT_SUCCESS);
+    }
+
     fprintf(stdout,
         "+===========================================================+\n"
          "\"The Nomad\" is free software distributed under the terms\n"
@@ -376,15 +441,11 @@ void I_NomadInit(int argc, char** argv)
          "+==========================================================+\n"
     );
 
-    con.ConPrintf("G_LoadSCF: parsing scf file");
-    G_LoadSCF();
-
 //    LOG_INFO("setting up imgui");
 //    ImGui_Init();
 
     con.ConFlush();
 
-
     LOG_INFO("running main gameplay loop");
     mainLoop();
 }
\ No newline at end of file
@@ -8,6 +8,185 @@ static inline void done()
     exit(EXIT_SUCCESS);
 }
 
+//
+// the sim runs at a fixed scf::renderer::ticrate no matter how fast frames go by: real time
+// piles up in the accumulator and G_RunTics spends it a tic at a time, whatever's left over is
+// how far the frame is between two tics. Frames are paced separately, to fpscap if there is one
+//
+
+#define MAX_CATCHUP_TICS    5       // any further behind than this and the rest are dropped
+#define FRAME_SPINTAIL      std::chrono::microseconds(1500)  // sleep up to this close to a deadline, spin the rest
+
+typedef std::chrono::steady_clock ticclock_t;
+
+static ticclock_t::time_point tic_last;
+static ticclock_t::duration tic_accum;
+static ticclock_t::time_point frame_next;
+static uint64_t tics_dropped;
+
+static inline ticclock_t::duration G_TicLength(void)
+{
+    return std::chrono::duration_cast<ticclock_t::duration>(std::chrono::nanoseconds(1000000000 / scf::renderer::ticrate));
+}
+
+//
+// a frame is a job graph: input first, on the main thread since SDL wants it there, then the
+// tics, then mixing the sound and building the render batches side by side since neither
+// touches what the other does. Every tic is a graph of its own, the think systems and then
+// physics. Nothing in either one calls GL, the caller draws once G_RunFrame's back
+//
+
+static JobGraph framegraph;
+static JobGraph ticgraph;
+static jobfunc_t frameinput;
+static void *frameinputarg;
+
+static void G_ThinkJob(void *)
+{
+    Game::Get()->registry.RunSystems();
+}
+
+static void G_PhysicsJob(void *)
+{
+    P_RunPhysics();
+}
+
+// the sector the player's in has to be resident before anything in the tic looks at it
+static void G_PageSectors(void)
+{
+    EntityStore* entities = &Game::Get()->entities;
+    const playr_t* playr = Game::GetPlayr();
+
+    if (entities->Valid(playr->p)) {
+        const glm::vec3& pos = entities->Coords(playr->p);
+        G_UpdateSectors(pos.y, pos.x);
+    }
+}
+
+void G_Ticker(void)
+{
+    G_PageSectors();
+    if (!ticgraph.NumNodes()) {
+        ticgraph.Init();
+        ticgraph.Depend(ticgraph.Add("physics", G_PhysicsJob, NULL), ticgraph.Add("think", G_ThinkJob, NULL));
+    }
+    ticgraph.Run();
+}
+
+static void G_InputJob(void *)
+{
+    if (frameinput)
+        frameinput(frameinputarg);
+}
+
+static void G_TicsJob(void *)
+{
+    G_RunTics(G_Ticker);
+}
+
+static void G_SoundJob(void *)
+{
+    G_RunSound();
+}
+
+static void G_RenderPrepJob(void *)
+{
+    R_BuildMobBatch(G_TicLerp());
+}
+
+void G_RunFrame(jobfunc_t input, void *arg)
+{
+    if (!framegraph.NumNodes()) {
+        jobnode_t *in, *tics;
+
+        framegraph.Init();
+        in = framegraph.Add("input", G_InputJob, NULL, true);
+        tics = framegraph.Add("tics", G_TicsJob, NULL);
+        framegraph.Depend(tics, in);
+        framegraph.Depend(framegraph.Add("soundmix", G_SoundJob, NULL), tics);
+        framegraph.Depend(framegraph.Add("renderprep", G_RenderPrepJob, NULL), tics);
+    }
+
+    frameinput = input;
+    frameinputarg = arg;
+    framegraph.Run();
+}
+
+// after anything that stopped the clock (loading, pausing), so the sim doesn't try to make it up
+void G_ResetTics(void)
+{
+    tic_last = ticclock_t::now();
+    tic_accum = ticclock_t::duration::zero();
+    frame_next = tic_last;
+}
+
+uint32_t G_RunTics(void (*ticker)(void))
+{
+    const ticclock_t::time_point now = ticclock_t::now();
+    const ticclock_t::duration len = G_TicLength();
+    uint32_t ran;
+
+    tic_accum += now - tic_last;
+    tic_last = now;
+
+    for (ran = 0; tic_accum >= len; ++ran) {
+        if (ran == MAX_CATCHUP_TICS) {
+            // a hitch or a breakpoint, running every missed tic back to back would only make
+            // the next frame later still
+            tics_dropped += tic_accum / len;
+            LOG_DEBUG("G_RunTics: {} tics behind, dropping them", tic_accum / len);
+            tic_accum %= len;
+            break;
+        }
+        ticker();
+        ++ticcount;
+        tic_accum -= len;
+    }
+    return ran;
+}
+
+// how far between the last tic and the next one this frame is, in [0, 1)
+float G_TicLerp(void)
+{
+    return (float)((double)tic_accum.count() / (double)G_TicLength().count());
+}
+
+// milliseconds until the frame's due, 0 when frames aren't capped
+int64_t G_FrameTimeLeft(void)
+{
+    if (!scf::renderer::fpscap)
+        return 0;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(frame_next - ticclock_t::now()).count();
+}
+
+//
+// G_PaceFrame: holds frames to fpscap. The deadline moves by exactly one frame each time so the
+// rate doesn't drift, sleeping only gets within FRAME_SPINTAIL of it since a sleep can wake up
+// late by more than a millisecond, and the rest is spun off against the clock
+//
+void G_PaceFrame(void)
+{
+    ticclock_t::time_point now;
+    ticclock_t::duration len;
+
+    if (!scf::renderer::fpscap)
+        return;
+
+    len = std::chrono::duration_cast<ticclock_t::duration>(std::chrono::nanoseconds(1000000000 / scf::renderer::fpscap));
+    now = ticclock_t::now();
+    frame_next += len;
+    if (frame_next < now - len) {
+        // fell more than a frame behind, start over from here rather than rushing frames out
+        frame_next = now;
+        return;
+    }
+
+    if (frame_next - now > FRAME_SPINTAIL)
+        std::this_thread::sleep_for(frame_next - now - FRAME_SPINTAIL);
+    while (ticclock_t::now() < frame_next)
+        ;
+}
+
 static void N_HandleWindowEvent(const SDL_Event& event)
 {
     switch (event.window.event) {
@@ -57,40 +236,50 @@ struct profiler_stats
     double avg = 0;
 };
 
+static void N_LevelInput(void *)
+{
+    SDL_Event event;
+
+    while (SDL_PollEvent(&event)) {
+        if (event.type == SDL_QUIT) {
+            done();
+        }
+        else if (event.type == SDL_WINDOWEVENT) {
+            N_HandleWindowEvent(event);
+        }
+        else if (event.type == SDL_KEYDOWN) {
+            switch (event.key.keysym.sym) {
+            case SDLK_ESCAPE:
+                Game::Get()->gamestate = GS_PAUSE;
+                break;
+            };
+            for (const auto& i : scf::kb_binds) {
+                if (i.button == (scf::button_t)event.key.keysym.sym) {
+                    i.action();
+                }
+            }
+        }
+    }
+}
+
 static void N_Level()
 {
     LOG_INFO("gamestate = GS_LEVEL");
-    SDL_Event event;
     LOG_INFO("beginning level loop, ticrate: {}", scf::renderer::ticrate);
 #ifdef _NOMAD_DEBUG
-    float renderer_time, events_time, loop_time;
-    profiler_stats renderer, events, loop;
+    float renderer_time, loop_time;
+    profiler_stats renderer, loop;
 #endif
+    N_ClearJobStats();
+    G_ResetTics();
     while (Game::Get()->gamestate == GS_LEVEL) {
         PROFILE_FUNC(loop_time);
         N_DebugWindowClear();
-        while (SDL_PollEvent(&event)) {
-            PROFILE_SCOPE(events_time);
-            if (event.type == SDL_QUIT) {
-                done();
-            }
-            else if (event.type == SDL_WINDOWEVENT) {
-                N_HandleWindowEvent(event);
-            }
-            else if (event.type == SDL_KEYDOWN) {
-                switch (event.key.keysym.sym) {
-                case SDLK_ESCAPE:
-                    Game::Get()->gamestate = GS_PAUSE;
-                    break;
-                };
-                for (const auto& i : scf::kb_binds) {
-                    if (i.button == (scf::button_t)event.key.keysym.sym) {
-                        i.action();
-                    }
-                }
-            }
-        }
+        G_RunFrame(N_LevelInput, NULL);
         {
+            // anything drawn that moves goes at G_TicLerp() of the way from where it was at
+            // the start of the last tic (M_World for mobs) to where it is now, R_MobBatch
+            // already has the mobs done that way
             PROFILE_SCOPE(renderer_time);
 #if 0
             R_ClearScreen();
@@ -102,24 +291,28 @@ static void N_Level()
             R_DrawFilledBox(SCREEN_HEIGHT - 150, 180, 350, 100, 0, 0, 255, 255);
 #endif
         }
+        Z_CheckHeapStep();
+        Z_FlushEvents();
+        Z_FlipTemp();
+        Cache_UpdatePrefetch();
+        G_PaceFrame();
 #ifdef _NOMAD_DEBUG
         loop.total++;
         renderer.total++;
-        events.total++;
         loop.avg += loop_time;
         renderer.avg += renderer_time;
-        events.avg += events_time;
 #endif
 //        IMGUI_BEGIN("Profiler");
 //        IMGUI_TEXT("[Render (Scope)]: %f", renderer_time);
-//        IMGUI_TEXT("[Event Poll (Scope)]: %f", events_time);
 //        IMGUI_TEXT("[N_Level (Function)]: %f", loop_time);
 //        IMGUI_END();
 //        N_DebugWindowDraw();
     }
     LOG_TRACE("renderer average time: {}", renderer.avg / renderer.total);
-    LOG_TRACE("event loop average time: {}", events.avg / events.total);
     LOG_TRACE("loop average time: {}", loop.avg / loop.total);
+    LOG_TRACE("tics dropped catching up: {}", tics_dropped);
+    // the event poll's timing is the input job's now
+    N_PrintJobStats();
     LOG_INFO("exiting level loop");
 }
 
@@ -130,6 +323,8 @@ static void N_PauseMenu()
 {
     LOG_INFO("gamestate = GS_PAUSE");
     while (Game::Get()->gamestate == GS_PAUSE) {
+        // nothing's running, a good time to defragment the zone
+        Z_Compact(2);
         int selected = R_DrawMenu("AlegreyaFont.ttf",
                                 {"Resume", "Load Save", "Save Game", "Settings", "Exit To Desktop", "Exit To Menu"},
                                 "Pause Menu");
@@ -151,6 +346,7 @@ static void N_PauseMenu()
             done();
             break;
         case 5:
+            G_ExitLevel();
             Game::Get()->gamestate = GS_MENU;
             break;
         default: break;
@@ -167,6 +363,8 @@ static void N_MainMenu()
                                 "Main Menu");
         switch (selected) {
         case 0:
+            if (bffinfo.numlevels)
+                G_EnterLevel(0);
             Game::Get()->gamestate = GS_LEVEL;
             break;
         case 1:
@@ -276,8 +474,10 @@ static inline void N_RenderSettings(bool *open)
         ImGui::Checkbox("VSYNC", &scf::renderer::vsync);
         ImGui::SameLine(200);
         ImGui::Text("%s", N_booltostr2(scf::renderer::vsync));
-        ImGui::SliderScalar("FPS Cap", ImGuiDataType_U16, &scf::renderer::ticrate,
+        ImGui::SliderScalar("Tic Rate", ImGuiDataType_U16, &scf::renderer::ticrate,
             &scf::renderer::ticrate_min, &scf::renderer::ticrate_max);
+        ImGui::SliderScalar("FPS Cap", ImGuiDataType_U16, &scf::renderer::fpscap,
+            &scf::renderer::fpscap_min, &scf::renderer::fpscap_max);
     }
     ImGui::NewLine();
     {
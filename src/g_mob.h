@@ -53,6 +53,8 @@ enum
 
 extern mobj_t mobinfo[NUMMOBS];
 
+uint32_t M_MobjIndex(const mobj_t* m);
+
 class Mob
 {
 public:
@@ -62,6 +64,7 @@ public:
     uint32_t flags;
     coord_t mpos;
     uint8_t mdir;
+    uint32_t type;
 public:
     Mob();
     Mob(const Mob &) = delete;
@@ -72,9 +75,11 @@ public:
         c_mob = m;
         health = m.health;
         flags = m.flags;
+        type = M_MobjIndex(&m);
         return *this;
     }
     inline Mob& operator=(const Mob &m) {
+        type = m.type;
         flags = m.flags;
         health = m.health;
         mpos = m.mpos;
@@ -86,18 +91,65 @@ public:
     inline void gendir(void)
     { mdir = P_Random() & 3; }
     inline uint32_t getmobjindex() const
-    {
-        for (uint32_t i = 0; i < NUMMOBS; ++i) {
-            if (memcmp(&mobinfo[i], &c_mob, sizeof(mobj_t))) {
-                return i;
-                break;
-            }
-        }
-        LOG_WARN("Mob::getmobjindex: mob has invalid mobj_t type, returning 0");
-        return 0;
-    }
+    { return type; }
 };
 
-void M_RunThinker(linked_list<Mob*>::iterator it);
+// what a thinker gets to see of a mob, copied out of the live mobs at the start of
+// every tic so nobody's reading something another thinker is in the middle of changing
+typedef struct
+{
+    coord_t mpos;
+    int16_t health;
+    uint8_t mdir;
+    uint32_t type;
+    entityhandle_t h;
+} mobsnap_t;
+
+typedef struct
+{
+    mobsnap_t* mobs;        // packed order of the Mob components
+    uint32_t nummobs;
+    uint32_t capacity;
+    coord_t playrpos;
+    entityhandle_t playr;
+    uint32_t seed;          // drawn off P_Random once a tic, every mob's randoms come from it
+    uint64_t tic;
+} mobworld_t;
+
+// thinkers never touch the world, they say what they want done and the merge at the
+// end of the tic does it
+typedef enum : uint8_t
+{
+    MI_MOVE,
+    MI_ATTACK,
+    MI_SOUND
+} mobintenttype_t;
+
+typedef struct
+{
+    uint32_t actor;         // index into the snapshot
+    mobintenttype_t type;
+    uint8_t dir;
+    uint16_t sfx;
+    uint32_t amount;
+} mobintent_t;
+
+typedef struct
+{
+    mobintent_t* intents;
+    uint32_t count;
+    uint32_t capacity;
+} mobcmdbuf_t;
+
+// the most intents a single mob can put out in one tic
+#define MOB_MAXINTENTS 2
+
+class Registry;
+
+entityhandle_t M_SpawnMob(uint32_t type);
+void M_RunThinker(const mobworld_t* world, uint32_t index, mobcmdbuf_t* cmds);
+void M_Think(Registry& reg);
+const mobworld_t* M_World(bool previous);
+void M_CheckThink(uint32_t nummobs, uint32_t tics, uint32_t maxworkers);
 
 #endif
\ No newline at end of file
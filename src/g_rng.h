@@ -25,6 +25,8 @@ constexpr unsigned char rndtable[256] = {
     120, 163, 236, 249
 };
 
+extern int rndindex;
+
 int G_GetRandom(int difficulty);
 int P_Random(void);
 void G_ClearRandom(void);
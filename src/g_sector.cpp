@@ -0,0 +1,283 @@
+#include "n_shared.h"
+#include "g_game.h"
+
+//
+// level sector paging: every sector chunk has a slot, the ones in memory are on the resident
+// list or the cached list, most recently used first. Going over the budget moves the oldest
+// resident sector to TAG_CACHE, going over it in the cache frees the oldest one outright, so
+// the zone never holds more than twice the budget whatever the archive has in it. Prefetches
+// get their block here and a job unpacks into it, nothing else about a slot is touched off
+// the calling thread
+//
+
+typedef enum : uint8_t
+{
+    SS_OUT,         // not in memory, or the zone purged it
+    SS_RESIDENT,    // TAG_LEVEL, might still be getting unpacked
+    SS_CACHED,      // TAG_CACHE, the zone's free to take it
+} sectorstate_t;
+
+typedef struct sectorslot_s
+{
+    bff_sectormap_t* data;      // the zone's user pointer, NULLed if it purges a cached one
+    jobcounter_t loading;       // the unpack job, if one's still out
+    uint32_t index;             // its sector chunk
+    sectorstate_t state;
+    struct sectorslot_s* prev;
+    struct sectorslot_s* next;
+} sectorslot_t;
+
+typedef struct
+{
+    sectorslot_t head;
+    uint32_t count;
+} sectorlist_t;
+
+static sectorslot_t* slots;     // one per sector chunk, an alias goes through its first one's
+static uint32_t numslots;
+static sectorlist_t resident;
+static sectorlist_t cached;
+static uint32_t budget;
+static int64_t curlevel = -1;
+static uint64_t pageins, prefetches, reclaims;
+
+static void G_InitSectorList(sectorlist_t* list)
+{
+    list->head.prev = list->head.next = &list->head;
+    list->count = 0;
+}
+
+static void G_LinkSector(sectorlist_t* list, sectorslot_t* slot)
+{
+    slot->prev = &list->head;
+    slot->next = list->head.next;
+    list->head.next->prev = slot;
+    list->head.next = slot;
+    ++list->count;
+}
+
+static void G_UnlinkSector(sectorlist_t* list, sectorslot_t* slot)
+{
+    slot->prev->next = slot->next;
+    slot->next->prev = slot->prev;
+    --list->count;
+}
+
+void G_InitSectors(void)
+{
+    G_ShutdownSectors();
+
+    numslots = G_BFFNumChunks(CT_SECTOR);
+    slots = (sectorslot_t *)Z_Malloc(sizeof(sectorslot_t) * (numslots + 1), TAG_STATIC, &slots, "sectorslots");
+    for (uint32_t i = 0; i < numslots; ++i) {
+        new (&slots[i].loading) jobcounter_t(0);
+        slots[i].data = NULL;
+        slots[i].index = i;
+        slots[i].state = SS_OUT;
+    }
+    G_InitSectorList(&resident);
+    G_InitSectorList(&cached);
+
+    // a whole level at least, so the sector the player's in never gets pushed out by its neighbours
+    budget = scf::memory::level_sectors < NUMSECTORS ? NUMSECTORS : scf::memory::level_sectors;
+    curlevel = -1;
+    pageins = prefetches = reclaims = 0;
+}
+
+void G_ShutdownSectors(void)
+{
+    if (!slots)
+        return;
+
+    G_ExitLevel();
+    LOG_INFO("G_ShutdownSectors: {} sectors paged in, {} of them prefetched, {} taken back out of the cache",
+        pageins, prefetches, reclaims);
+
+    Z_Free(slots);
+    slots = NULL;
+    numslots = 0;
+}
+
+//
+// G_ExitLevel: pages every sector out. Sectors are the only thing in the level zone, so when
+// it has a budget of its own the whole zone is dropped at once instead of freeing them one at
+// a time, otherwise they're sharing the main zone and have to go by hand
+//
+void G_ExitLevel(void)
+{
+    sectorslot_t* slot;
+    zonestats_t stats;
+
+    if (!slots)
+        return;
+
+    // nothing can be dropped out from under an unpack job
+    for (uint32_t i = 0; i < numslots; ++i)
+        N_WaitJobs(&slots[i].loading);
+
+    Z_ZoneStats(ZONE_LEVEL, &stats);
+    if (!stats.shared)
+        Z_ZoneDrop(ZONE_LEVEL);
+    for (uint32_t i = 0; i < numslots; ++i) {
+        slot = &slots[i];
+        if (stats.shared && slot->state != SS_OUT
+        && (slot->state != SS_CACHED || Z_Reclaim(&slot->data, TAG_LEVEL)))
+            Z_Free(slot->data);
+        slot->data = NULL;
+        slot->state = SS_OUT;
+    }
+    G_InitSectorList(&resident);
+    G_InitSectorList(&cached);
+    curlevel = -1;
+}
+
+static void G_SectorJob(void *arg)
+{
+    sectorslot_t* slot = (sectorslot_t *)arg;
+    G_ReadChunk(CT_SECTOR, slot->index, slot->data);
+}
+
+static sectorslot_t* G_SectorSlot(uint32_t level, uint32_t sector)
+{
+    if (sector >= NUMSECTORS)
+        N_Error("G_BFFLevelSector: sector %u out of range", sector);
+    if (level >= G_BFFNumChunks(CT_LEVEL))
+        N_Error("G_BFFLevelSector: level %u out of range", level);
+    return &slots[G_BFFChunkAlias(CT_SECTOR, level * NUMSECTORS + sector)];
+}
+
+//
+// G_TouchSector: makes slot the most recently used resident sector, paging it in if it
+// isn't in memory. A prefetch hands the unpacking to a job, anybody that wants to read it
+// has to wait on slot->loading first
+//
+static void G_TouchSector(sectorslot_t* slot, bool prefetch)
+{
+    if (slot->state == SS_RESIDENT)
+        G_UnlinkSector(&resident, slot);
+    else if (slot->state == SS_CACHED) {
+        G_UnlinkSector(&cached, slot);
+        if (Z_Reclaim(&slot->data, TAG_LEVEL)) {
+            slot->state = SS_RESIDENT;
+            ++reclaims;
+        }
+        else
+            slot->state = SS_OUT;
+    }
+
+    if (slot->state == SS_OUT) {
+        Z_ZoneMalloc(ZONE_LEVEL, sizeof(bff_sectormap_t), TAG_LEVEL, &slot->data, "sector");
+        slot->state = SS_RESIDENT;
+        ++pageins;
+        if (prefetch) {
+            N_RunJob(G_SectorJob, slot, "sectorload", &slot->loading);
+            ++prefetches;
+        }
+        else
+            G_SectorJob(slot);
+    }
+    G_LinkSector(&resident, slot);
+}
+
+// the oldest sectors past the budget go purgable, the oldest past it in the cache are freed
+static void G_TrimSectors(void)
+{
+    sectorslot_t* slot;
+
+    while (resident.count > budget) {
+        slot = resident.head.prev;
+        // the job's writing into it, it can't be purged out from under it
+        N_WaitJobs(&slot->loading);
+        G_UnlinkSector(&resident, slot);
+        Z_ChangeTag(slot->data, TAG_CACHE);
+        slot->state = SS_CACHED;
+        G_LinkSector(&cached, slot);
+    }
+    while (cached.count > budget) {
+        slot = cached.head.prev;
+        G_UnlinkSector(&cached, slot);
+        if (Z_Reclaim(&slot->data, TAG_LEVEL))
+            Z_Free(slot->data);
+        slot->state = SS_OUT;
+    }
+}
+
+const bff_sectormap_t* G_BFFLevelSector(uint32_t level, uint32_t sector)
+{
+    sectorslot_t* slot = G_SectorSlot(level, sector);
+
+    G_TouchSector(slot, false);
+    G_TrimSectors();
+    N_WaitJobs(&slot->loading);
+    return slot->data;
+}
+
+void G_EnterLevel(uint32_t level)
+{
+    if (level >= G_BFFNumChunks(CT_LEVEL))
+        N_Error("G_EnterLevel: level %u out of range", level);
+    if (curlevel != (int64_t)level)
+        G_ExitLevel();
+    curlevel = level;
+}
+
+// how far a point is from a sector's box, in cells along whichever axis is further off
+static float G_SectorDistance(uint32_t sector, float y, float x)
+{
+    const float top = (float)(sector / SECTORS_ACROSS * SECTOR_MAX_Y);
+    const float left = (float)(sector % SECTORS_ACROSS * SECTOR_MAX_X);
+    const float dy = y < top ? top - y : (y >= top + SECTOR_MAX_Y ? y - (top + SECTOR_MAX_Y) : 0);
+    const float dx = x < left ? left - x : (x >= left + SECTOR_MAX_X ? x - (left + SECTOR_MAX_X) : 0);
+
+    return dy > dx ? dy : dx;
+}
+
+typedef struct
+{
+    uint32_t sector;
+    float dist;
+} nearsector_t;
+
+void G_UpdateSectors(float y, float x)
+{
+    const int32_t rows = (NUMSECTORS + SECTORS_ACROSS - 1) / SECTORS_ACROSS;
+    nearsector_t* near;
+    uint32_t numnear;
+    int32_t row, col;
+    uint32_t here;
+
+    if (!slots || curlevel < 0)
+        return;
+
+    // anywhere off the grid counts as the closest sector to it
+    row = (int32_t)floorf(y / SECTOR_MAX_Y);
+    col = (int32_t)floorf(x / SECTOR_MAX_X);
+    row = row < 0 ? 0 : (row >= rows ? rows - 1 : row);
+    col = col < 0 ? 0 : (col >= SECTORS_ACROSS ? SECTORS_ACROSS - 1 : col);
+    here = row * SECTORS_ACROSS + col;
+    if (here >= NUMSECTORS)
+        here = NUMSECTORS - 1;
+
+    // this frame's near list, only good until the next Z_FlipTemp. Farthest goes first so the
+    // nearer a sector is the more recently used it ends up, and the trim takes the far ones
+    near = (nearsector_t *)Z_AllocTemp(sizeof(nearsector_t) * NUMSECTORS, "nearsectors");
+    numnear = 0;
+    for (uint32_t m = 0; m < NUMSECTORS; ++m) {
+        const float dist = G_SectorDistance(m, y, x);
+        uint32_t i;
+
+        if (m == here || dist > SECTOR_PREFETCH)
+            continue;
+        for (i = numnear; i > 0 && near[i - 1].dist < dist; --i)
+            near[i] = near[i - 1];
+        near[i].sector = m;
+        near[i].dist = dist;
+        numnear++;
+    }
+    for (uint32_t i = 0; i < numnear; ++i)
+        G_TouchSector(G_SectorSlot(curlevel, near[i].sector), true);
+
+    // last, so it's the most recently used
+    G_TouchSector(G_SectorSlot(curlevel, here), false);
+    G_TrimSectors();
+}
@@ -16,13 +16,17 @@ void Snd_Kill()
         return;
 
     if (scf::audio::sfx_on) {
+        // every source lets go before any buffer goes, an alias's source can still have its owner's
         for (uint32_t i = 0; i < numsfx; ++i) {
             if (!sfx_cache[i].failed) {
                 alSourcei(sfx_cache[i].source, AL_BUFFER, 0);
-                alDeleteBuffers(1, &sfx_cache[i].buffer);
                 alDeleteSources(1, &sfx_cache[i].source);
             }
         }
+        for (uint32_t i = 0; i < numsfx; ++i) {
+            if (!sfx_cache[i].failed && !sfx_cache[i].alias)
+                alDeleteBuffers(1, &sfx_cache[i].buffer);
+        }
     }
     if (scf::audio::music_on) {
     }
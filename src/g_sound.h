@@ -41,6 +41,7 @@ typedef struct nomadsnd_s
 
     bool queued = false;
     bool failed = false; // if the pre-caching effort failed for this specific sound
+    bool alias = false; // shares an earlier sound's buffer, that one owns it
 } nomadsnd_t;
 
 extern nomadsnd_t* sfx_cache;
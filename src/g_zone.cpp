@@ -26,9 +26,9 @@
 //----------------------------------------------------------
 
 //
-// If the program calls Z_Free on a block that doesn't have the ZONEID,
-// meaning that it wasn't allocated via Z_Malloc, the allocater will
-// throw an error
+// If the program calls Z_Free on a pointer that doesn't look like a zone
+// block, meaning that it wasn't allocated via Z_Malloc, the allocater will
+// throw an error (debug builds also check it against the side table)
 //
 
 //
@@ -43,7 +43,7 @@
 //
 
 #include "n_shared.h"
-#include "g_zone.h"
+#include "g_game.h"
 
 void* operator new[](size_t size, const char* pName, int flags, unsigned debugFlags, const char* file, int line)
 {
@@ -70,43 +70,95 @@ void* operator new[](size_t size, size_t alignment, size_t alignmentOffset, cons
 }
 
 #define UNOWNED    ((void *)666)
-#define ZONEID     0xa21d49
 
 #define CHUNK_SIZE 32
 #define ZONE_HISTORY 10
 #define MIN_FRAGMENT 256
 
-#define DEFAULT_SIZE (900*1024*1024) // 990 MiB
-#define MIN_SIZE     (500*1024*1024) // 500 MiB
+#define MIN_SIZE     (500*1024*1024) // 500 MiB, the arena isn't shrunk below this (or -ram) on a failed reservation
+#define MIN_MAINZONE (64*1024*1024) // budgets are scaled down before the main zone goes below this
+#define MIN_BUDGET   (1024*1024) // a zone scaled down below this shares the main zone instead
+#define BUDGET_GRAIN (64*1024) // scaled budgets are rounded down to this so the zones stay page aligned
 
 // tunables
-#define ZONEDEBUG
-#define ZONEIDCHECK
+#ifdef _NOMAD_DEBUG
+#define ZONEDEBUG // keep names, ids and call sites in a side table
+#endif
 #define CHECKHEAP
 
 #define MEM_ALIGN  16
 #define RETRY_AMOUNT (256*1024)
+#define HUGEPAGE_SIZE (2*1024*1024)
 
-static int indexer = 0;
+// default op interval for ZONE_CHECK_SAMPLED, and how many blocks the
+// incremental verifier walks per Z_CheckHeapStep
+#define CHECK_SAMPLE_RATE 128
+#define CHECK_SLICE_SIZE  256
+
+// blocks Z_Compact walks between looks at the clock, must be a power of two
+#define COMPACT_CHECK_INTERVAL 32
 
 #ifdef __GNUC__
 #define ZONE_PACK(x) x __attribute__((packed))
-#elif defined(_MSVC_VER)
-#define ZONE_PACK(x) __pragma(push(pack,1)) x __pragma(pop)
+#elif defined(_MSC_VER)
+#define ZONE_PACK(x) __pragma(pack(push,1)) x __pragma(pack(pop))
 #endif
 
+//
+// the tag of a block a thread cache owns is changed without the zone lock while
+// other threads walk past it under the lock, so it's its own byte and always
+// accessed atomically (relaxed, nothing is published through it)
+//
+typedef struct blocktag_s
+{
+	uint8_t value;
+
+	inline operator int(void) const { return __atomic_load_n(&value, __ATOMIC_RELAXED); }
+	inline blocktag_s& operator=(int tag) { __atomic_store_n(&value, (uint8_t)tag, __ATOMIC_RELAXED); return *this; }
+} blocktag_t;
+
+//
+// 32 bytes and never packed, every block starts on a ZONE_GRAIN boundary and is
+// a multiple of it in size so every payload is at least ZONE_GRAIN aligned, with
+// stricter alignments going through Z_AlignedAlloc (those are pinned so Z_Compact
+// can't break the alignment). names, ids and call sites live in the debug side table
+//
 typedef struct memblock_s
 {
-	char name[15];
-	size_t size;
-	void **user;
-#ifdef ZONEIDCHECK
-	unsigned id;
-#endif
 	struct memblock_s* next;
 	struct memblock_s* prev;
-	int tag;
-} __attribute__((packed)) memblock_t;
+	void **user;
+	uint64_t size : 47; // including the header
+	uint64_t pinned : 1; // never moved by Z_Compact
+	blocktag_t tag;
+	uint8_t cache; // owning thread cache + 1, 0 if the block never went through one
+} memblock_t;
+
+static_assert(sizeof(memblock_t) == 32, "memblock_t must stay 32 bytes");
+
+#define ZONE_GRAIN    16
+#define ZONE_MINBLOCK 48 // header plus the free list links
+
+#ifdef ZONEDEBUG
+#define ZONE_CALLER() __builtin_return_address(0)
+#else
+#define ZONE_CALLER() NULL
+#endif
+
+//
+// free blocks are indexed by power-of-two size class, the bin links live in the
+// (otherwise unused) payload of the free block, so the header doesn't grow.
+// bin n holds free blocks with a size in [2^n, 2^(n+1))
+//
+#define ZONE_NUMBINS 64
+
+typedef struct freelink_s
+{
+	memblock_t* next;
+	memblock_t* prev;
+} freelink_t;
+
+#define FREELINK(block) ((freelink_t *)((byte *)(block) + sizeof(memblock_t)))
 
 typedef struct memzone_s
 {
@@ -114,518 +166,1513 @@ typedef struct memzone_s
 	memblock_t blocklist;
 
 	size_t size;
-	
-	// the roving block for general operations
-	memblock_t* rover;
-} __attribute__((packed)) memzone_t;
 
-static size_t numzones = 0;
-static memzone_t** memzones;
-static memzone_t* mainzone; // the currently active zone
-static memblock_t* tmp; // a lot like Quake's Hunk_TempAlloc, but has dynamic size of whatever's left at the top of the zone, min size, however, of 1024 bytes
+	// segregated free lists, one per size class
+	memblock_t* freebins[ZONE_NUMBINS];
 
+	// bit n is set if freebins[n] isn't empty
+	uint64_t binmap;
 
-static size_t active_memory = 0;
-static size_t free_memory = 0;
-static size_t inactive_memory = 0;
-static size_t purgable_memory = 0;
+	const char *name;
+	int id;
+	int purge; // ZONE_PURGE_*
 
-void* Z_ZoneBegin(void)
+	size_t active_memory;
+	size_t free_memory;
+	size_t purgable_memory;
+	size_t peak_memory;
+	size_t numallocs, numfrees;
+
+	// where the incremental verifier picks up next frame
+	memblock_t* check_rover;
+
+	// where Z_Compact picks up, NULL to start a new sweep
+	memblock_t* compact_rover;
+	size_t nummoves, movedbytes;
+} memzone_t;
+
+static const char* zonenames[NUMZONES] = { "main", "renderer", "audio", "level", "scratch" };
+
+// every zone is carved out of one arena, the main zone gets whatever the budgets leave over
+static byte *zone_base;
+static size_t zone_size;
+
+static int numzones = 0;
+static memzone_t* zonelist[NUMZONES]; // the distinct zones
+static memzone_t* memzones[NUMZONES]; // indexed by ZONE_*, zones without a budget point at the main zone
+static memzone_t* mainzone;
+
+#ifdef _NOMAD_DEBUG
+static int check_level = ZONE_CHECK_LOCAL;
+#else
+static int check_level = ZONE_CHECK_OFF;
+#endif
+static int check_rate = CHECK_SAMPLE_RATE;
+static int check_count = 0;
+
+// everything that touches the block list or the bins goes through this,
+// it's recursive because purging and magazine refills call back into the zone
+static std::recursive_mutex zone_lock;
+
+#define ZONE_LOCK() std::lock_guard<std::recursive_mutex> zone_guard(zone_lock)
+
+//
+// per-thread magazines, small non-purgable blocks are handed out from a thread
+// local stack of zone blocks that are already allocated (tagged TAG_MAGAZINE),
+// the zone lock is only taken to refill or drain a magazine a batch at a time.
+// a block freed on a thread other than the one that cached it is pushed onto the
+// owner's lock-free return stack, the owner takes the whole stack on its next refill
+//
+#define ZONE_MAXTHREADS 64
+#define MAG_NUMCLASSES  6 // 32, 64, 128, 256, 512 and 1024 bytes
+#define MAG_MINSHIFT    5
+#define MAG_MAXSIZE     (1 << (MAG_MINSHIFT + MAG_NUMCLASSES - 1))
+#define MAG_SIZE        64 // blocks held per class
+#define MAG_BATCH       32 // blocks moved to or from the zone at once
+
+#define MAG_CLASSSIZE(c) ((size_t)1 << ((c) + MAG_MINSHIFT))
+
+typedef struct
 {
-	return (void *)mainzone;
-}
+	memblock_t* blocks[MAG_NUMCLASSES][MAG_SIZE];
+	int count[MAG_NUMCLASSES];
 
-void* Z_ZoneEnd(void)
+	// blocks given back by other threads, linked through FREELINK()->next
+	std::atomic<memblock_t*> returned;
+	std::atomic<bool> inuse;
+
+	// the zone was cleared if this doesn't match zone_generation, everything cached is gone
+	unsigned generation;
+} zonecache_t;
+
+// releases the thread's cache when it exits
+struct threadcache_t
 {
-	return (void *)(mainzone+sizeof(memzone_t)+mainzone->size);
-}
+	zonecache_t* cache;
+	~threadcache_t();
+};
 
-#define TMP_BLOCK_MAX_SIZE (64*1024*1024)
-#define TMP_BLOCK_MIN_SIZE (1*1024)
+static zonecache_t zone_caches[ZONE_MAXTHREADS];
+static std::atomic<unsigned> zone_generation;
+static thread_local threadcache_t thread_cache;
 
-void* Z_AllocTemp(size_t size, int tag, void* user, const char *name)
+static const char* Z_TagName(int tag)
 {
+	switch (tag) {
+	case TAG_FREE: return "free";
+	case TAG_STATIC: return "static";
+	case TAG_LEVEL: return "level";
+	case TAG_SFX: return "sfx";
+	case TAG_MUSIC: return "music";
+	case TAG_MAGAZINE: return "magazine";
+	case TAG_PURGELEVEL: return "purgelevel";
+	case TAG_CACHE: return "cache";
+	};
+	return "unknown";
 }
 
+#ifdef ZONEDEBUG
+//
+// debug side table for everything the header doesn't need, only
+// allocated blocks have an entry
+//
+typedef struct
+{
+	char name[15];
+	unsigned id; // allocation serial number
+	const void *caller; // return address of the zone call that made the block
+} blockinfo_t;
+
+static std::unordered_map<const memblock_t*, blockinfo_t> blockinfo;
+static std::mutex blockinfo_lock;
+static unsigned blockinfo_serial;
 
-byte *I_ZoneMemory(size_t *size)
+static void Z_SetBlockInfo(const memblock_t* block, const char *name, const void *caller)
 {
-	byte *ptr;
-	int p;
-	size_t current_size = DEFAULT_SIZE;
-	const size_t min_size = MIN_SIZE;
-    p = I_GetParm("-ram");
-	if (p != -1) {
-	}
-	ptr = (byte *)malloc_aligned(16, current_size);
-	while (ptr == NULL) {
-		if (current_size < min_size) {
-			N_Error("Z_Init: failed to allocate zone memory of %li bytes (aligned_alloc, 16)", current_size);
-		}
-		ptr = (byte *)malloc_aligned(16, current_size);
-		if (ptr == NULL) {
-			current_size -= RETRY_AMOUNT;
-		}
-	}
+	std::lock_guard<std::mutex> lock(blockinfo_lock);
+	blockinfo_t* info = &blockinfo[block];
 
-    return ptr;
+	memset(info->name, 0, sizeof(info->name));
+	strncpy(info->name, name, sizeof(info->name) - 1);
+	info->id = ++blockinfo_serial;
+	if (caller)
+		info->caller = caller;
 }
 
-void Z_Init()
+static void Z_ClearBlockInfo(const memblock_t* block)
 {
-	srand(time(NULL));
-	memblock_t* base;
-	size_t size = DEFAULT_SIZE;
-	numzones = 1;
-	memzones = (memzone_t **)malloc_aligned(16, sizeof(memzone_t *) * 1); // preallocating memzones
-	mainzone = (memzone_t *)I_ZoneMemory(&size);
-	if (!mainzone)
-		N_Error("Z_Init: memory allocation failed");
+	std::lock_guard<std::mutex> lock(blockinfo_lock);
+	blockinfo.erase(block);
+}
 
-	mainzone->size = size;
-	
-	mainzone->blocklist.next = 
-	mainzone->blocklist.prev = 
-	base = (memblock_t *)((byte *)mainzone+sizeof(memzone_t));
+static const char* Z_BlockName(const memblock_t* block)
+{
+	static thread_local char name[15];
+	std::lock_guard<std::mutex> lock(blockinfo_lock);
+	std::unordered_map<const memblock_t*, blockinfo_t>::const_iterator it = blockinfo.find(block);
+
+	if (it == blockinfo.end())
+		return Z_TagName(block->tag);
 	
-	mainzone->blocklist.user = (void **)mainzone;
-	mainzone->blocklist.tag = TAG_STATIC;
-	mainzone->blocklist.id = ZONEID;
-	mainzone->rover = base;
+	memcpy(name, it->second.name, sizeof(name));
+	return name;
+}
+
+// Z_Compact slid a block down
+static void Z_MoveBlockInfo(const memblock_t* from, const memblock_t* to)
+{
+	std::lock_guard<std::mutex> lock(blockinfo_lock);
+	std::unordered_map<const memblock_t*, blockinfo_t>::iterator it = blockinfo.find(from);
+
+	if (it == blockinfo.end())
+		return;
 	
-	base->prev = base->next = &mainzone->blocklist;
-	base->user = (void **)NULL;
-	base->size = mainzone->size - sizeof(memzone_t);
-	base->id = ZONEID;
-	memset(base->name, 0, 15);
-	strncpy(base->name, "base", 14);
-	free_memory = mainzone->size;
+	blockinfo[to] = it->second;
+	blockinfo.erase(from);
+}
 
-	printf("Allocated zone daemon from %p to %p, size of %li bytes (%li MiB)\n",
-		(void *)mainzone, (void *)((byte *)mainzone+mainzone->size+sizeof(memzone_t)),
-		mainzone->size, mainzone->size >> 20);
+static bool Z_HasBlockInfo(const memblock_t* block)
+{
+	std::lock_guard<std::mutex> lock(blockinfo_lock);
+	return blockinfo.find(block) != blockinfo.end();
 }
 
-static void Z_MergePB(memblock_t* block)
+// a zone's blocks went away without being freed one at a time (Z_ZoneDrop, Z_ClearZone)
+static void Z_DropBlockInfo(const void *start, const void *end)
 {
-	memblock_t* other;
-	LOG_TRACE("Z_MergePB: merging prev block for block at {}", (void *)block);
-	
-	other = block->prev;
-	if (other->tag == TAG_FREE) {
-		// merge with previous free block
-		other->size += block->size;
-		other->next = block->next;
-		other->next->prev = other;
-		
-		if (block == mainzone->rover)
-			mainzone->rover = other;
-		
-		block = other;
+	std::lock_guard<std::mutex> lock(blockinfo_lock);
+	for (std::unordered_map<const memblock_t*, blockinfo_t>::iterator it = blockinfo.begin(); it != blockinfo.end(); ) {
+		if ((const void *)it->first >= start && (const void *)it->first < end)
+			it = blockinfo.erase(it);
+		else
+			++it;
 	}
+}
+#else
+#define Z_SetBlockInfo(block,name,caller)
+#define Z_ClearBlockInfo(block)
+#define Z_DropBlockInfo(start,end)
+#define Z_MoveBlockInfo(from,to)
+#define Z_BlockName(block) Z_TagName((block)->tag)
+#endif
+
+// sanity check for pointers handed back to the zone, an allocated block
+// always has consistent links (and a side table entry in debug builds)
+static inline bool Z_IsZoneBlock(const memblock_t* block)
+{
+	if (block->next->prev != block || block->prev->next != block)
+		return false;
+#ifdef ZONEDEBUG
+	if (block->tag != TAG_FREE && !Z_HasBlockInfo(block))
+		return false;
+#endif
+	return true;
+}
+
+// Z_IsZoneBlock for a block a thread cache hands out, its links belong to the zone
+// lock and can't be looked at without it, the rest of the header is the caller's
+static inline bool Z_IsCachedBlock(const memblock_t* block)
+{
+	if ((const byte *)block < zone_base || (const byte *)block >= zone_base + zone_size)
+		return false;
+	if (!block->cache || block->cache > ZONE_MAXTHREADS)
+		return false;
+#ifdef ZONEDEBUG
+	return Z_HasBlockInfo(block);
+#else
+	return true;
+#endif
+}
+
+//
+// allocation event ring, written lock-free from the allocating thread with no
+// formatting or i/o, Z_FlushEvents dumps whatever is complete to ZONE_EVENT_FILE
+// once per tic, -zonereport turns the file into histograms offline.
+// Off unless -zoneevents [MiB] is given, the file is rotated to ZONE_EVENT_FILE.1
+// once it passes the cap so a long session can't fill the disk
+//
+#define EVENT_RING_SIZE (64*1024) // must be a power of two
+#define EVENT_MAGIC     0x5a455654 // "ZEVT"
+#define EVENT_VERSION   1
+#define EVENT_FILE_CAP  64 // MiB, default for -zoneevents
+
+typedef struct
+{
+	std::atomic<uint64_t> seq; // index+1 once the event is complete, 0 while it's being written
+	zone_event_t ev;
+} eventslot_t;
+
+static eventslot_t event_ring[EVENT_RING_SIZE];
+static std::atomic<uint64_t> event_head;
+static uint64_t event_tail;
+static uint64_t event_dropped;
+static FILE* event_fp;
+static size_t event_written;
+static size_t event_cap;
+static bool event_enabled;
+
+static inline uint64_t Z_EventTime(void)
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// floor(log2(size))
+static inline int Z_SizeToBin(size_t size)
+{
+	return (int)(sizeof(unsigned long long) * 8 - 1) - __builtin_clzll((unsigned long long)size);
+}
+
+static void Z_BinBlock(memzone_t* zone, memblock_t* block)
+{
+	freelink_t* link;
+	int bin;
+
+	bin = Z_SizeToBin(block->size);
+	link = FREELINK(block);
+
+	link->prev = NULL;
+	link->next = zone->freebins[bin];
+	if (link->next)
+		FREELINK(link->next)->prev = block;
+
+	zone->freebins[bin] = block;
+	zone->binmap |= (uint64_t)1 << bin;
+}
+
+static void Z_UnbinBlock(memzone_t* zone, memblock_t* block)
+{
+	freelink_t* link;
+	int bin;
+
+	bin = Z_SizeToBin(block->size);
+	link = FREELINK(block);
+
+	if (link->prev)
+		FREELINK(link->prev)->next = link->next;
 	else
-		LOG_TRACE("Z_MergeFB: prev block not TAG_FREE");
+		zone->freebins[bin] = link->next;
+	if (link->next)
+		FREELINK(link->next)->prev = link->prev;
+
+	if (!zone->freebins[bin])
+		zone->binmap &= ~((uint64_t)1 << bin);
 }
 
-static void Z_MergeNB(memblock_t* block)
+//
+// Z_FindFreeBlock: returns a free block of at least size bytes, or NULL.
+// The request is rounded up to the next size class so that the head of any
+// non-empty bin at or above it is guaranteed to fit, if that comes up empty
+// the request's own class is walked first-fit as a last resort
+//
+static memblock_t* Z_FindFreeBlock(memzone_t* zone, size_t size)
 {
-	memblock_t* other;
-	LOG_TRACE("Z_MergeNB: merging next block for block at {}", (void *)block);
-	
-	other = block->next;
-	if (other->tag == TAG_FREE) {
-		// merge the free block onto the end
-		block->size += other->size;
-		block->next = other->next;
-		block->next->prev = block;
-		
-		if (other == mainzone->rover)
-			mainzone->rover = block;
-	}
+	memblock_t* block;
+	uint64_t mask;
+	int bin;
+
+	bin = Z_SizeToBin(size);
+	if (size > ((size_t)1 << bin) && bin < ZONE_NUMBINS - 1)
+		mask = zone->binmap & (~(uint64_t)0 << (bin + 1));
 	else
-		LOG_TRACE("Z_MergeNB: next block not TAG_FREE");
+		mask = zone->binmap & (~(uint64_t)0 << bin);
+
+	if (mask)
+		return zone->freebins[__builtin_ctzll(mask)];
+
+	for (block = zone->freebins[bin]; block; block = FREELINK(block)->next) {
+		if (block->size >= size)
+			return block;
+	}
+	return NULL;
 }
 
-void Z_ScanForBlock(void *start, void *end)
+void Z_RecordEvent(int op, int tag, size_t size, const void *addr, const char *name)
 {
-	memblock_t *block;
-	void **mem;
-	size_t i, len, tag;
-	
-	block = mainzone->blocklist.next;
-	
-	while (block->next != &mainzone->blocklist) {
-		tag = block->tag;
-		
-		if (tag == TAG_STATIC) {
-			// scan for pointers on the assumption the pointers are aligned
-			// on word boundaries (word size depending on pointer size)
-			mem = (void **)( (byte *)block + sizeof(memblock_t) );
-			len = (block->size - sizeof(memblock_t)) / sizeof(void *);
-			for (i = 0; i < len; ++i) {
-				if (start <= mem[i] && mem[i] <= end) {
-					LOG_WARN(
-						"Z_ScanForBlock: "
-						"{} ({}) has dangling pointer into freed block "
-						"{} ({} -> {})",
-					(void *)mem, block->name, start, (void *)&mem[i],
-					mem[i]);
-				}
+	if (!event_enabled)
+		return;
+
+	const uint64_t index = event_head.fetch_add(1, std::memory_order_relaxed);
+	eventslot_t* slot = &event_ring[index & (EVENT_RING_SIZE - 1)];
+
+	slot->seq.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	slot->ev.time = Z_EventTime();
+	slot->ev.addr = (uint64_t)(uintptr_t)addr;
+	slot->ev.size = (uint64_t)size;
+	slot->ev.op = (uint8_t)op;
+	slot->ev.tag = (uint8_t)tag;
+	memset(slot->ev.name, 0, sizeof(slot->ev.name));
+	if (name)
+		strncpy(slot->ev.name, name, sizeof(slot->ev.name) - 1);
+
+	slot->seq.store(index + 1, std::memory_order_release);
+}
+
+static size_t Z_LargestFreeBlock(memzone_t* zone)
+{
+	memblock_t* block;
+	size_t largest;
+
+	if (!zone->binmap)
+		return 0;
+
+	largest = 0;
+	for (block = zone->freebins[63 - __builtin_clzll(zone->binmap)]; block; block = FREELINK(block)->next) {
+		if (block->size > largest)
+			largest = block->size;
+	}
+	return largest;
+}
+
+//
+// Z_FlushEvents: writes every complete event since the last flush to the event file,
+// also records a fragmentation sample of the main zone (largest free block vs total free memory).
+// Anything that got lapped by the writers is counted as dropped
+//
+void Z_FlushEvents(void)
+{
+	zone_event_t ev;
+	eventslot_t* slot;
+	uint64_t head, seq;
+
+	if (!mainzone || !event_enabled)
+		return;
+
+	{
+		ZONE_LOCK();
+		Z_RecordEvent(ZEV_FRAGMENT, TAG_FREE, Z_LargestFreeBlock(mainzone), (void *)mainzone->free_memory, "fragment");
+	}
+
+	if (event_fp && event_written >= event_cap) {
+		fclose(event_fp);
+		event_fp = NULL;
+		remove(ZONE_EVENT_FILE ".1");
+		if (rename(ZONE_EVENT_FILE, ZONE_EVENT_FILE ".1") == -1)
+			LOG_WARN("Z_FlushEvents: failed to rotate {}, starting it over", ZONE_EVENT_FILE);
+	}
+	if (!event_fp) {
+		const uint32_t header[3] = { EVENT_MAGIC, EVENT_VERSION, sizeof(zone_event_t) };
+
+		event_fp = fopen(ZONE_EVENT_FILE, "wb");
+		if (!event_fp) {
+			LOG_WARN("Z_FlushEvents: failed to open {}, zone events won't be saved", ZONE_EVENT_FILE);
+			event_tail = event_head.load(std::memory_order_relaxed);
+			event_enabled = false;
+			return;
+		}
+		fwrite(header, sizeof(header), 1, event_fp);
+		event_written = sizeof(header);
+	}
+
+	head = event_head.load(std::memory_order_acquire);
+	if (head - event_tail > EVENT_RING_SIZE) {
+		event_dropped += head - event_tail - EVENT_RING_SIZE;
+		event_tail = head - EVENT_RING_SIZE;
+	}
+
+	for (; event_tail < head; ++event_tail) {
+		slot = &event_ring[event_tail & (EVENT_RING_SIZE - 1)];
+
+		seq = slot->seq.load(std::memory_order_acquire);
+		if (seq != event_tail + 1) {
+			if (seq > event_tail + 1) {
+				// lapped while we were reading
+				++event_dropped;
+				continue;
 			}
+			break; // still being written, get it next time
+		}
+		memcpy(&ev, &slot->ev, sizeof(ev));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot->seq.load(std::memory_order_relaxed) != seq) {
+			++event_dropped;
+			continue;
 		}
-		block = block->next;
+		fwrite(&ev, sizeof(ev), 1, event_fp);
+		event_written += sizeof(ev);
 	}
-	if (indexer++ > 60) {
-		indexer = 0;
-		Z_Print(true);
+	fflush(event_fp);
+
+	if (event_dropped) {
+		LOG_WARN("Z_FlushEvents: {} zone events were dropped, the ring is too small for this frame", event_dropped);
+		event_dropped = 0;
 	}
 }
 
-void Z_ClearZone(void)
+void* Z_ZoneBegin(void)
 {
-	LOG_TRACE("clearing zone");
-	memblock_t*		block;
-
-	// set the entire zone to one free block
-	mainzone->blocklist.next =
-	mainzone->blocklist.prev =
-	block = (memblock_t *)( (byte *)mainzone + sizeof(memzone_t) );
-	
-	mainzone->blocklist.user = (void **)mainzone;
-	mainzone->blocklist.tag = TAG_STATIC;
-	mainzone->blocklist.id = ZONEID;
-	mainzone->rover = block;
-	
-	block->prev = block->next = &mainzone->blocklist;
-	block->id = ZONEID;
-	memset(block->name, 0, 15);
-	strncpy(block->name, "base", 14);
-	free_memory = mainzone->size;
-	active_memory = purgable_memory = 0;
-	
-	// a free block.
-	block->tag = TAG_FREE;
-	
-	block->size = mainzone->size - sizeof(memzone_t);
+	return (void *)zone_base;
 }
 
-// counts the number of blocks by the tag
-static int Z_NumBlocks(int tag)
+void* Z_ZoneEnd(void)
 {
-	memblock_t* block;
-	int count = 0;
-	for (block = mainzone->blocklist.next; block != &mainzone->blocklist; block = block->next) {
-		if (block->tag == tag) {
-			++count;
-		}
-	}
-	if (indexer++ > 60) {
-		indexer = 0;
-		Z_Print(true);
+	return (void *)(zone_base + zone_size);
+}
+
+// finds the zone a block lives in
+static memzone_t* Z_BlockZone(const memblock_t* block)
+{
+	memzone_t* zone;
+	int i;
+
+	for (i = 0; i < numzones; ++i) {
+		zone = zonelist[i];
+		if ((const byte *)block > (const byte *)zone && (const byte *)block < (const byte *)zone + zone->size)
+			return zone;
 	}
-	return count;
+	N_Error("Z_BlockZone: %p isn't inside any zone", (const void *)block);
+	return NULL;
 }
 
-void Z_Free(void *ptr)
+// lays the whole zone out as one free block
+static memblock_t* Z_ResetBlocks(memzone_t* zone)
 {
-	memblock_t* other;
-	memblock_t* block;
-	
-	block = (memblock_t *)((byte *)ptr - sizeof(memblock_t));
-	
-	if (block->id != ZONEID)
-		N_Error("Z_Free: freed a pointer without ZONEID");
-	if (block->tag != TAG_FREE && block->user != (void **)NULL) {
-		// clear the user's mark
-		*block->user = NULL;
+	memblock_t* base;
+
+	base = (memblock_t *)(((uintptr_t)zone + sizeof(memzone_t) + ZONE_GRAIN - 1) & ~(uintptr_t)(ZONE_GRAIN - 1));
+
+	zone->blocklist.next =
+	zone->blocklist.prev = base;
+	zone->blocklist.user = (void **)zone;
+	zone->blocklist.tag = TAG_STATIC;
+	zone->blocklist.size = 0;
+	zone->blocklist.cache = 0;
+	zone->blocklist.pinned = 1;
+
+	base->prev = base->next = &zone->blocklist;
+	base->user = (void **)NULL;
+	base->size = ((byte *)zone + zone->size - (byte *)base) & ~(size_t)(ZONE_GRAIN - 1);
+	base->tag = TAG_FREE;
+	base->cache = 0;
+	base->pinned = 0;
+	zone->free_memory = base->size;
+	zone->active_memory = zone->purgable_memory = 0;
+
+	memset(zone->freebins, 0, sizeof(zone->freebins));
+	zone->binmap = 0;
+	Z_BinBlock(zone, base);
+	zone->check_rover = base;
+	zone->compact_rover = NULL;
+
+#ifdef ZONEDEBUG
+	std::lock_guard<std::mutex> lock(blockinfo_lock);
+	for (std::unordered_map<const memblock_t*, blockinfo_t>::iterator it = blockinfo.begin(); it != blockinfo.end();) {
+		if ((const byte *)it->first > (const byte *)zone && (const byte *)it->first < (const byte *)zone + zone->size)
+			it = blockinfo.erase(it);
+		else
+			++it;
 	}
-	
-	free_memory += block->size;
-	if (block->tag >= TAG_PURGELEVEL)
-	    purgable_memory -= block->size;
-	else
-	    active_memory -= block->size;
-	
-	// mark as free
-	block->tag = TAG_FREE;
-	block->user = (void **)NULL;
-	block->id = ZONEID;
-	memset(block->name, 0, sizeof(block->name));
-	strncpy(block->name, "freed", sizeof(block->name) - 1);
-	
-#ifdef _NOMAD_DEBUG
-	memset(ptr, 0, block->size - sizeof(memblock_t));
-	Z_ScanForBlock(ptr, (byte *)ptr + block->size - sizeof(memblock_t));
 #endif
+	return base;
+}
+
+static memzone_t* Z_CreateZone(byte *base, size_t size, int id, int purge)
+{
+	memzone_t* zone;
+
+	zone = (memzone_t *)base;
+	memset(zone, 0, sizeof(memzone_t));
+	zone->size = size;
+	zone->name = zonenames[id];
+	zone->id = id;
+	zone->purge = purge;
+	Z_ResetBlocks(zone);
+
+	zonelist[numzones++] = zone;
+	return zone;
+}
+
+static memblock_t* Z_FreeBlock(memzone_t* zone, memblock_t* block);
+static memblock_t* Z_AllocBlock(memzone_t* zone, size_t alignment, size_t size, int tag, void *user, const char* name, const void *caller);
+
+//
+// per-frame temp memory, two linear buffers carved out of the arena behind the zones.
+// Z_AllocTemp bumps through the current one and Z_FlipTemp swaps them at the end of
+// every tic, rewinding the one that comes up, so temp memory is good through the end
+// of the next tic. Whatever doesn't fit goes to the scratch zone and is freed when
+// its buffer comes around again
+//
+typedef struct
+{
+	byte *base;
+	size_t size;
+	std::atomic<size_t> used; // keeps counting past size once the buffer overflows
+	void *overflow; // scratch zone blocks, chained through their first bytes
+} tempbuf_t;
+
+static tempbuf_t tempbufs[2];
+static int temp_current;
+static size_t temp_highwater;
+
+void* Z_AllocTemp(size_t size, const char *name)
+{
+	tempbuf_t* buf;
+	size_t offset;
+	void **link;
+
+	buf = &tempbufs[temp_current];
+	size = (size + MEM_ALIGN - 1) & ~(size_t)(MEM_ALIGN - 1);
+	offset = buf->used.fetch_add(size, std::memory_order_relaxed);
+	if (offset + size <= buf->size)
+		return buf->base + offset;
 	
-	Z_MergePB(block);
-	Z_MergeNB(block);
-	if (indexer++ > 60) {
-		indexer = 0;
-		Z_Print(true);
+	ZONE_LOCK();
+	link = (void **)((byte *)Z_AllocBlock(memzones[ZONE_SCRATCH], MEM_ALIGN, size + MEM_ALIGN, TAG_STATIC, NULL, name, ZONE_CALLER())
+		+ sizeof(memblock_t));
+	*link = buf->overflow;
+	buf->overflow = link;
+	return (byte *)link + MEM_ALIGN;
+}
+
+// the zone lock must be held
+static void Z_FreeTempOverflow(tempbuf_t* buf)
+{
+	void *link;
+	void *next;
+
+	for (link = buf->overflow; link; link = next) {
+		next = *(void **)link;
+		Z_FreeBlock(memzones[ZONE_SCRATCH], (memblock_t *)((byte *)link - sizeof(memblock_t)));
 	}
+	buf->overflow = NULL;
 }
 
-void* Z_Malloc(size_t size, int tag, void *user)
-{ return Z_Malloc(size, tag, user, "unknown"); }
+// forgets everything in both buffers, for when the scratch zone went down under them
+static void Z_ResetTemp(void)
+{
+	tempbufs[0].overflow = tempbufs[1].overflow = NULL;
+	tempbufs[0].used.store(0, std::memory_order_relaxed);
+	tempbufs[1].used.store(0, std::memory_order_relaxed);
+}
 
-void* Z_AlignedAlloc(size_t alignment, size_t size, int tag, void *user, const char* name)
+//
+// Z_FlipTemp: called once at the end of every tic, nothing can be allocating
+// temp memory while it runs
+//
+void Z_FlipTemp(void)
 {
-#ifdef CHECKHEAP
-	Z_CheckHeap();
-#endif
-	if (tag >= TAG_PURGELEVEL && !user)
-		N_Error("Z_Malloc: an owner is required for purgable blocks, name: %s", name);
-	if (size == 0)
-		N_Error("Z_Malloc: bad size, name: %s", name);
-	
-	memblock_t* rover;
-	memblock_t* newblock;
-	memblock_t* base;
-	memblock_t* start;
-	size_t extra;
-	bool tryagain;
-	
-	size = (size + alignment - 1) & ~(alignment - 1);
-	tryagain = false;
-	
-	// accounting for header size
-	size += sizeof(memblock_t);
+	tempbuf_t* buf;
+	size_t used;
+
+	if (!tempbufs[0].base)
+		return;
 	
-	base = mainzone->rover;
+	buf = &tempbufs[temp_current];
+	used = buf->used.load(std::memory_order_relaxed);
+	if (used > temp_highwater) {
+		temp_highwater = used;
+		if (used > buf->size)
+			LOG_WARN("Z_FlipTemp: temp memory high-water mark is now {} bytes, {} bytes over the {} byte frame buffer went to the scratch zone",
+				used, used - buf->size, buf->size);
+	}
+
+	// everything from two tics ago is dead
+	temp_current ^= 1;
+	buf = &tempbufs[temp_current];
+	if (buf->overflow) {
+		ZONE_LOCK();
+		Z_FreeTempOverflow(buf);
+	}
+	buf->used.store(0, std::memory_order_relaxed);
+}
+
+// reserves the arena, nothing is committed until it's touched
+static byte *I_MapZoneMemory(size_t size, int hugepages)
+{
+#ifdef _WIN32
+	(void)hugepages;
+	return (byte *)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+	void *ptr;
+
+#ifdef MAP_HUGETLB
+	if (hugepages == ZONE_HUGEPAGES_EXPLICIT) {
+		// no MAP_NORESERVE here, a hugetlb fault with nothing reserved is a SIGBUS instead of a failed mmap
+		ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr != MAP_FAILED)
+			return (byte *)ptr;
+		
+		LOG_WARN("I_ZoneMemory: no explicit huge pages available (see /proc/sys/vm/nr_hugepages), falling back to transparent huge pages");
+	}
+#endif
+	// over-reserve so the arena can start on a huge page boundary
+	ptr = mmap(NULL, size + HUGEPAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (ptr == MAP_FAILED)
+		return NULL;
 	
-	// checking behind the rover
-	if (base->prev->tag == TAG_FREE)
-		base = base->prev;
+	ptr = (void *)(((uintptr_t)ptr + HUGEPAGE_SIZE - 1) & ~(uintptr_t)(HUGEPAGE_SIZE - 1));
+#ifdef MADV_HUGEPAGE
+	if (hugepages != ZONE_HUGEPAGES_OFF && madvise(ptr, size, MADV_HUGEPAGE) == -1)
+		LOG_WARN("I_ZoneMemory: madvise(MADV_HUGEPAGE) failed, transparent huge pages are probably disabled");
+#endif
+	return (byte *)ptr;
+#endif
+}
 
-	rover = base;
-	start = base->prev;
+//
+// I_ZoneMemory: the arena is sized by -ram <MiB>, or the scf's memory.zone_size,
+// and shrunk in RETRY_AMOUNT steps if the reservation fails
+//
+byte *I_ZoneMemory(size_t *size)
+{
+	byte *ptr;
+	int p, hugepages;
+	size_t current_size, min_size;
 
-	do {
-		if (rover == start) {
-			LOG_WARN("zone size wasn't big enough for Z_Malloc size given, clearing cache");
-			Z_FreeTags(TAG_PURGELEVEL, TAG_CACHE);
-			if (tryagain)
-				N_Error("Z_Malloc: failed allocation of %li bytes because zone wasn't big enough", size);
-			
-			tryagain = true;
+	current_size = (size_t)scf::memory::zone_size << 20;
+	p = I_GetParm("-ram");
+	if (p != -1) {
+		if (p < myargc - 1)
+			current_size = (size_t)atol(myargv[p+1]) << 20;
+		else
+			N_Error("I_ZoneMemory: you must specify a size in MiB after -ram");
+	}
+	hugepages = scf::memory::hugepages;
+	p = I_GetParm("-hugepages");
+	if (p != -1) {
+		if (p < myargc - 1)
+			hugepages = atoi(myargv[p+1]);
+		else
+			N_Error("I_ZoneMemory: you must specify a mode (0-2) after -hugepages");
+	}
+	if (hugepages < ZONE_HUGEPAGES_OFF || hugepages > ZONE_HUGEPAGES_EXPLICIT)
+		N_Error("I_ZoneMemory: invalid huge page mode %i", hugepages);
+	if (!current_size)
+		N_Error("I_ZoneMemory: zone size can't be 0");
+	
+	current_size = (current_size + HUGEPAGE_SIZE - 1) & ~(size_t)(HUGEPAGE_SIZE - 1);
+	min_size = current_size < MIN_SIZE ? current_size : MIN_SIZE;
+
+	ptr = I_MapZoneMemory(current_size, hugepages);
+	while (ptr == NULL) {
+		if (current_size < min_size + RETRY_AMOUNT) {
+			N_Error("I_ZoneMemory: failed to reserve zone memory of %li bytes", current_size);
 		}
-		if (rover->tag != TAG_FREE) {
-			if (rover->tag < TAG_PURGELEVEL) {
-				// hit a block that can't be purged,
-				// so move the base past it
-				base = rover = rover->next;
-			}
-			else {
-				LOG_INFO("rover->tag is >=  TAG_PURGELEVEL, freeing");
-				
-				// free the rover block (adding to the size of the base)
-				// the rover can be the base block
-				base = base->prev;
-				Z_Free((byte *)rover+sizeof(memblock_t));
-				base = base->next;
-				rover = base->next;
-			}
+		current_size -= RETRY_AMOUNT;
+		ptr = I_MapZoneMemory(current_size, hugepages);
+	}
+
+	*size = current_size;
+	return ptr;
+}
+
+void Z_Init()
+{
+	srand(time(NULL));
+	int p, i;
+	size_t size;
+	size_t budgets[NUMZONES], total, offset, tempsize, mainsize;
+	int purges[NUMZONES];
+	double scale;
+
+	zone_base = I_ZoneMemory(&size);
+	if (!zone_base)
+		N_Error("Z_Init: memory allocation failed");
+	zone_size = size;
+
+	budgets[ZONE_MAIN] = 0;
+	budgets[ZONE_RENDERER] = (size_t)scf::memory::renderer_zone << 20;
+	budgets[ZONE_AUDIO] = (size_t)scf::memory::audio_zone << 20;
+	budgets[ZONE_LEVEL] = (size_t)scf::memory::level_zone << 20;
+	budgets[ZONE_SCRATCH] = (size_t)scf::memory::scratch_zone << 20;
+	purges[ZONE_MAIN] = ZONE_PURGE_CACHE;
+	purges[ZONE_RENDERER] = scf::memory::renderer_purge ? ZONE_PURGE_CACHE : ZONE_PURGE_NONE;
+	purges[ZONE_AUDIO] = scf::memory::audio_purge ? ZONE_PURGE_CACHE : ZONE_PURGE_NONE;
+	purges[ZONE_LEVEL] = scf::memory::level_purge ? ZONE_PURGE_CACHE : ZONE_PURGE_NONE;
+	purges[ZONE_SCRATCH] = scf::memory::scratch_purge ? ZONE_PURGE_CACHE : ZONE_PURGE_NONE;
+
+	tempsize = (size_t)scf::memory::temp_size << 20;
+
+	total = tempsize * 2;
+	for (i = 0; i < NUMZONES; ++i)
+		total += budgets[i];
+
+	// a small -ram scales the budgets down with the arena instead of refusing to start, the
+	// main zone keeps MIN_MAINZONE or half the arena if that's less. a budget that ends up
+	// under MIN_BUDGET is dropped and that zone shares the main zone
+	mainsize = size / 2 < MIN_MAINZONE ? size / 2 : MIN_MAINZONE;
+	if (total + mainsize > size) {
+		LOG_WARN("Z_Init: zone budgets ({} MiB) leave less than {} MiB of the {} MiB zone for the main zone, scaling them down",
+			total >> 20, mainsize >> 20, size >> 20);
+		scale = (double)(size - mainsize) / total;
+		total = 0;
+		for (i = 1; i < NUMZONES; ++i) {
+			budgets[i] = (size_t)(budgets[i] * scale) & ~(size_t)(BUDGET_GRAIN - 1);
+			if (budgets[i] < MIN_BUDGET)
+				budgets[i] = 0;
+			total += budgets[i];
 		}
-		else {
-			rover = rover->next;
+		tempsize = (size_t)(tempsize * scale) & ~(size_t)(BUDGET_GRAIN - 1);
+		total += tempsize * 2;
+	}
+
+	// the main zone comes first and gets the remainder, the budgeted zones and the temp buffers follow it
+	numzones = 0;
+	offset = size - total;
+	mainzone = memzones[ZONE_MAIN] = Z_CreateZone(zone_base, offset, ZONE_MAIN, purges[ZONE_MAIN]);
+	for (i = 1; i < NUMZONES; ++i) {
+		if (!budgets[i]) {
+			memzones[i] = mainzone;
+			continue;
 		}
-	} while (base->tag != TAG_FREE || base->size < size);
-	// old: (base->user || base->size < size)
-	
-	free_memory -= rover->size;
-	if (tag >= TAG_PURGELEVEL)
-		purgable_memory += rover->size;
+		memzones[i] = Z_CreateZone(zone_base + offset, budgets[i], i, purges[i]);
+		offset += budgets[i];
+	}
+	for (i = 0; i < 2; ++i) {
+		tempbufs[i].base = zone_base + offset;
+		tempbufs[i].size = tempsize;
+		offset += tempsize;
+	}
+	temp_current = 0;
+	temp_highwater = 0;
+	Z_ResetTemp();
+
+	p = I_GetParm("-zonecheck");
+	if (p != -1) {
+		if (p < myargc - 1)
+			check_level = atoi(myargv[p+1]);
+		else
+			N_Error("Z_Init: you must specify a level (0-3) after -zonecheck");
+	}
+	p = I_GetParm("-zonecheckrate");
+	if (p != -1) {
+		if (p < myargc - 1)
+			check_rate = atoi(myargv[p+1]);
+		else
+			N_Error("Z_Init: you must specify an op count after -zonecheckrate");
+	}
+	Z_SetCheckLevel(check_level, check_rate);
+
+	p = I_GetParm("-zoneevents");
+	if (p != -1) {
+		event_cap = (size_t)(p < myargc - 1 && atoi(myargv[p+1]) > 0 ? atoi(myargv[p+1]) : EVENT_FILE_CAP) << 20;
+		event_enabled = true;
+	}
+
+	printf("Allocated zone daemon from %p to %p, size of %li bytes (%li MiB)\n",
+		Z_ZoneBegin(), Z_ZoneEnd(), zone_size, zone_size >> 20);
+	for (i = 0; i < numzones; ++i) {
+		printf("  %-8s zone at %p, %li MiB, %s\n", zonelist[i]->name, (void *)zonelist[i], zonelist[i]->size >> 20,
+			zonelist[i]->purge == ZONE_PURGE_CACHE ? "purges its cache when full" : "no purging");
+	}
+	printf("  2 temp buffers at %p, %li KiB each\n", (void *)tempbufs[0].base, tempsize >> 10);
+}
+
+// the block passed in must not be binned, returns the merged block (unbinned)
+static memblock_t* Z_MergePB(memzone_t* zone, memblock_t* block)
+{
+	memblock_t* other;
+	LOG_TRACE("Z_MergePB: merging prev block for block at {}", (void *)block);
+
+	other = block->prev;
+	if (other->tag == TAG_FREE) {
+		// merge with previous free block
+		Z_UnbinBlock(zone, other);
+		other->size += block->size;
+		other->next = block->next;
+		other->next->prev = other;
+
+		if (block == zone->check_rover)
+			zone->check_rover = other;
+		if (block == zone->compact_rover)
+			zone->compact_rover = other;
+
+		block = other;
+	}
 	else
-		active_memory += rover->size;
-	
-	extra = base->size - size;
-	
-	if (extra > MIN_FRAGMENT) {
-		newblock = (memblock_t *)((byte *)base + size);
-		newblock->size = extra;
-		newblock->user = NULL;
-		newblock->prev = base;
-		newblock->next = base->next;
-		newblock->next->prev = newblock;
-		
-		base->next = newblock;
-		base->size = size;
+		LOG_TRACE("Z_MergeFB: prev block not TAG_FREE");
+
+	return block;
+}
+
+// the block passed in must not be binned, returns the merged block (unbinned)
+static memblock_t* Z_MergeNB(memzone_t* zone, memblock_t* block)
+{
+	memblock_t* other;
+	LOG_TRACE("Z_MergeNB: merging next block for block at {}", (void *)block);
+
+	other = block->next;
+	if (other->tag == TAG_FREE) {
+		// merge the free block onto the end
+		Z_UnbinBlock(zone, other);
+		block->size += other->size;
+		block->next = other->next;
+		block->next->prev = block;
+
+		if (other == zone->check_rover)
+			zone->check_rover = block;
+		if (other == zone->compact_rover)
+			zone->compact_rover = block;
 	}
-	else if (tag >= TAG_PURGELEVEL)
-		purgable_memory += size;
-	
-	base->user = (void **)user;
-	base->tag = tag;
-	
-	if (tag >= TAG_PURGELEVEL)
-	    purgable_memory += size;
 	else
-	    active_memory += size;
-	
-	free_memory -= size;
+		LOG_TRACE("Z_MergeNB: next block not TAG_FREE");
+
+	return block;
+}
+
+void Z_ScanForBlock(void *start, void *end)
+{
+	memzone_t* zone;
+	memblock_t *block;
+	void **mem;
+	size_t i, len, tag;
+	int z;
 	
-	void *retn = (void *)( (byte *)base + sizeof(memblock_t) );
+	for (z = 0; z < numzones; ++z) {
+		zone = zonelist[z];
+		for (block = zone->blocklist.next; block != &zone->blocklist; block = block->next) {
+			tag = block->tag;
+			
+			if (tag == TAG_STATIC) {
+				// scan for pointers on the assumption the pointers are aligned
+				// on word boundaries (word size depending on pointer size)
+				mem = (void **)( (byte *)block + sizeof(memblock_t) );
+				len = (block->size - sizeof(memblock_t)) / sizeof(void *);
+				for (i = 0; i < len; ++i) {
+					if (start <= mem[i] && mem[i] <= end) {
+						LOG_WARN(
+							"Z_ScanForBlock: "
+							"{} ({}) has dangling pointer into freed block "
+							"{} ({} -> {})",
+						(void *)mem, Z_BlockName(block), start, (void *)&mem[i],
+						mem[i]);
+					}
+				}
+			}
+		}
+	}
+}
+
+void Z_ClearZone(void)
+{
+	int i;
+
+	LOG_TRACE("clearing zone");
+
+	ZONE_LOCK();
+	// every thread cache is holding blocks that don't exist anymore
+	zone_generation.fetch_add(1, std::memory_order_release);
+
+	// set every zone to one free block
+	for (i = 0; i < numzones; ++i)
+		Z_ResetBlocks(zonelist[i]);
+	Z_DropBlockInfo(zone_base, zone_base + zone_size);
+	Z_ResetTemp();
+}
+
+//
+// Z_ZoneDrop: throws away everything in a zone at once, for level teardown and the like.
+// The chain isn't walked so nobody's user pointer is cleared and nothing is logged
+// per block, whoever drops a zone has to forget everything they had in it. Debug
+// builds still have to clear the side table's entries for it
+//
+void Z_ZoneDrop(int zone)
+{
+	if (zone <= ZONE_MAIN || zone >= NUMZONES)
+		N_Error("Z_ZoneDrop: bad zone %i (the main zone can only go with Z_ClearZone)", zone);
+	if (memzones[zone] == mainzone)
+		N_Error("Z_ZoneDrop: zone %s has no budget of its own and shares the main zone", zonenames[zone]);
 	
-	if (base->user)
-		*base->user = retn;
+	LOG_TRACE("dropping zone {}", zonenames[zone]);
 
-	// next allocation will start looking here
-	mainzone->rover = base->next;
-	base->id = ZONEID;
+	ZONE_LOCK();
+	Z_RecordEvent(ZEV_PURGE, TAG_FREE, memzones[zone]->active_memory + memzones[zone]->purgable_memory, memzones[zone], zonenames[zone]);
+	memzones[zone]->numfrees = memzones[zone]->numallocs;
+	Z_ResetBlocks(memzones[zone]);
+	Z_DropBlockInfo(memzones[zone], (byte *)memzones[zone] + memzones[zone]->size);
+	if (memzones[zone] == memzones[ZONE_SCRATCH])
+		Z_ResetTemp();
+}
+
+void Z_ZoneStats(int zone, zonestats_t* stats)
+{
+	memzone_t* z;
+
+	if (zone < ZONE_MAIN || zone >= NUMZONES)
+		N_Error("Z_ZoneStats: bad zone %i", zone);
 	
-    strncpy(base->name, name, sizeof(base->name) - 1);
-	if (indexer++ > 60) {
-		indexer = 0;
-		Z_Print(true);
+	ZONE_LOCK();
+	z = memzones[zone];
+	stats->name = z->name;
+	stats->size = z->size;
+	stats->active = z->active_memory;
+	stats->purgable = z->purgable_memory;
+	stats->free = z->free_memory;
+	stats->peak = z->peak_memory;
+	stats->allocs = z->numallocs;
+	stats->frees = z->numfrees;
+	stats->largest = Z_LargestFreeBlock(z);
+	stats->moves = z->nummoves;
+	stats->movedbytes = z->movedbytes;
+	stats->purge = z->purge;
+	stats->shared = zone != ZONE_MAIN && z == mainzone;
+}
+
+// counts the number of blocks by the tag
+static int Z_NumBlocks(int tag)
+{
+	memblock_t* block;
+	int count = 0;
+	int i;
+	for (i = 0; i < numzones; ++i) {
+		for (block = zonelist[i]->blocklist.next; block != &zonelist[i]->blocklist; block = block->next) {
+			if (block->tag == tag) {
+				++count;
+			}
+		}
 	}
-#ifdef CHECKHEAP
-	Z_CheckHeap();
+	return count;
+}
+
+//
+// Z_CheckBlock: verifies a single block and its links to its neighbors,
+// cheap enough to run on every operation
+//
+static void Z_CheckBlock(memzone_t* zone, memblock_t* block)
+{
+	if (block == &zone->blocklist)
+		return;
+
+	if (block->next->prev != block)
+		N_Error("Z_CheckBlock: next block doesn't have proper back linkage, name: %s, back linked name: %s", Z_BlockName(block), Z_BlockName(block->next));
+	if (block->prev->next != block)
+		N_Error("Z_CheckBlock: prev block doesn't have proper forward linkage, name: %s", Z_BlockName(block));
+	if ((uintptr_t)block & (ZONE_GRAIN - 1) || block->size & (ZONE_GRAIN - 1))
+		N_Error("Z_CheckBlock: block isn't on a %i byte boundary, name: %s", ZONE_GRAIN, Z_BlockName(block));
+	if (block->next != &zone->blocklist && (byte *)block + block->size != (byte *)block->next)
+		N_Error("Z_CheckBlock: block size doesn't touch next block, name: %s", Z_BlockName(block));
+	if (block->tag == TAG_FREE && (block->next->tag == TAG_FREE || block->prev->tag == TAG_FREE))
+		N_Error("Z_CheckBlock: two consecutive free blocks, name: %s", Z_BlockName(block));
+#ifdef ZONEDEBUG
+	if (block->tag != TAG_FREE && !Z_HasBlockInfo(block))
+		N_Error("Z_CheckBlock: allocated block at %p has no side table entry", (void *)block);
 #endif
+}
+
+void Z_SetCheckLevel(int level, int rate)
+{
+	if (level < ZONE_CHECK_OFF || level > ZONE_CHECK_FULL)
+		N_Error("Z_SetCheckLevel: invalid check level %i", level);
+	if (rate < 1)
+		N_Error("Z_SetCheckLevel: invalid sample rate %i", rate);
 
-    return retn;
+	check_level = level;
+	check_rate = rate;
+	check_count = 0;
 }
 
-// Z_Malloc: garbage collection and zone block allocater that returns a block of free memory
-// from within the zone without calling malloc
-void* Z_Malloc(size_t size, int tag, void *user, const char* name)
+static void Z_CheckZone(memzone_t* zone);
+static void Z_FreeZoneTags(memzone_t* zone, int lowtag, int hightag);
+
+//
+// Z_ValidateHeap: runs the heap check for the current check level,
+// block is the block that was just touched (or NULL), only its zone is checked.
+// The NULL calls are the entry checks, sampling only counts the exit ones so the
+// rate is one check per check_rate operations rather than per call
+//
+static void Z_ValidateHeap(memzone_t* zone, memblock_t* block)
+{
+	switch (check_level) {
+	case ZONE_CHECK_OFF:
+		break;
+	case ZONE_CHECK_SAMPLED:
+		if (block && ++check_count >= check_rate) {
+			check_count = 0;
+			Z_CheckZone(zone);
+		}
+		break;
+	case ZONE_CHECK_LOCAL:
+		if (block) {
+			Z_CheckBlock(zone, block->prev);
+			Z_CheckBlock(zone, block);
+			Z_CheckBlock(zone, block->next);
+		}
+		break;
+	case ZONE_CHECK_FULL:
+		Z_CheckZone(zone);
+		break;
+	};
+}
+
+//
+// Z_CheckHeapStep: incremental verifier, checks the next CHECK_SLICE_SIZE blocks
+// of every zone's chain, meant to be run once per tic so the zones get covered over
+// a few frames without stalling any single one
+//
+void Z_CheckHeapStep(void)
+{
+	memzone_t* zone;
+	int i, z;
+
+	if (check_level == ZONE_CHECK_OFF)
+		return;
+
+	ZONE_LOCK();
+	for (z = 0; z < numzones; ++z) {
+		zone = zonelist[z];
+		for (i = 0; i < CHECK_SLICE_SIZE; ++i) {
+			if (zone->check_rover == &zone->blocklist)
+				zone->check_rover = zone->blocklist.next;
+
+			Z_CheckBlock(zone, zone->check_rover);
+			zone->check_rover = zone->check_rover->next;
+		}
+	}
+}
+
+// frees the block and coalesces it with its neighbors, returns the resulting free block
+static memblock_t* Z_FreeBlock(memzone_t* zone, memblock_t* block)
+{
+	void *ptr;
+
+	ptr = (void *)((byte *)block + sizeof(memblock_t));
+
+	if (block->tag == TAG_FREE)
+		N_Error("Z_Free: freed a pointer that was already freed");
+	if (!Z_IsZoneBlock(block))
+		N_Error("Z_Free: freed a pointer that isn't a zone block");
+	if (block->user != (void **)NULL) {
+		// clear the user's mark
+		*block->user = NULL;
+	}
+	// magazine traffic is invisible to the event stream, the alloc/free pairs come from the thread cache
+	if (block->tag != TAG_MAGAZINE)
+		Z_RecordEvent(ZEV_FREE, block->tag, block->size, block, NULL);
+	Z_ClearBlockInfo(block);
+	
+	zone->free_memory += block->size;
+	if (block->tag >= TAG_PURGELEVEL)
+	    zone->purgable_memory -= block->size;
+	else
+	    zone->active_memory -= block->size;
+	++zone->numfrees;
+	
+	// mark as free
+	block->tag = TAG_FREE;
+	block->user = (void **)NULL;
+	block->cache = 0;
+	block->pinned = 0;
+	
+#ifdef _NOMAD_DEBUG
+	memset(ptr, 0, block->size - sizeof(memblock_t));
+	// the dangling pointer scan reads every static block in the zone
+	if (check_level == ZONE_CHECK_FULL)
+		Z_ScanForBlock(ptr, (byte *)ptr + block->size - sizeof(memblock_t));
+#endif
+	
+	block = Z_MergePB(zone, block);
+	block = Z_MergeNB(zone, block);
+	Z_BinBlock(zone, block);
+
+	return block;
+}
+
+// the zone lock must be held
+static memblock_t* Z_AllocBlock(memzone_t* zone, size_t alignment, size_t size, int tag, void *user, const char* name, const void *caller)
 {
 #ifdef CHECKHEAP
-	Z_CheckHeap();
+	Z_ValidateHeap(zone, NULL);
 #endif
 	if (tag >= TAG_PURGELEVEL && !user)
 		N_Error("Z_Malloc: an owner is required for purgable blocks, name: %s", name);
 	if (size == 0)
 		N_Error("Z_Malloc: bad size, name: %s", name);
+	if (alignment & (alignment - 1))
+		N_Error("Z_Malloc: alignment %li isn't a power of two, name: %s", alignment, name);
 	
-	memblock_t* rover;
 	memblock_t* newblock;
 	memblock_t* base;
-	memblock_t* start;
-	size_t extra;
-	bool tryagain;
+	size_t extra, search, gap;
 	
-	size = (size + MEM_ALIGN - 1) & ~(MEM_ALIGN - 1);
-	tryagain = false;
+	size = (size + ZONE_GRAIN - 1) & ~(size_t)(ZONE_GRAIN - 1);
 	
 	// accounting for header size
 	size += sizeof(memblock_t);
+
+	// payloads are always ZONE_GRAIN aligned, anything stricter needs
+	// room to slide the block up past a free block in front of it
+	search = size;
+	if (alignment > ZONE_GRAIN)
+		search += alignment + ZONE_MINBLOCK;
 	
-	base = mainzone->rover;
-	
-	// checking behind the rover
-	if (base->prev->tag == TAG_FREE)
-		base = base->prev;
+	base = Z_FindFreeBlock(zone, search);
+	if (!base) {
+		if (zone->purge != ZONE_PURGE_CACHE)
+			N_Error("Z_Malloc: failed allocation of %li bytes, the %s zone is over its budget of %li bytes, name: %s",
+				size, zone->name, zone->size, name);
+		
+		LOG_WARN("{} zone wasn't big enough for Z_Malloc size given, clearing cache", zone->name);
+		Z_RecordEvent(ZEV_PURGE, tag, size, NULL, name);
+		Z_FreeZoneTags(zone, TAG_PURGELEVEL, TAG_CACHE);
 
-	rover = base;
-	start = base->prev;
+		base = Z_FindFreeBlock(zone, search);
+		if (!base)
+			N_Error("Z_Malloc: failed allocation of %li bytes because the %s zone wasn't big enough", size, zone->name);
+	}
+	Z_UnbinBlock(zone, base);
 
-	do {
-		if (rover == start) {
-			LOG_WARN("zone size wasn't big enough for Z_Malloc size given, clearing cache");
-			Z_FreeTags(TAG_PURGELEVEL, TAG_CACHE);
-			if (tryagain)
-				N_Error("Z_Malloc: failed allocation of %li bytes because zone wasn't big enough", size);
-			
-			tryagain = true;
-		}
-		if (rover->tag != TAG_FREE) {
-			if (rover->tag < TAG_PURGELEVEL) {
-				// hit a block that can't be purged,
-				// so move the base past it
-				base = rover = rover->next;
-			}
-			else {
-				LOG_INFO("rover->tag is >=  TAG_PURGELEVEL, freeing");
-				
-				// free the rover block (adding to the size of the base)
-				// the rover can be the base block
-				base = base->prev;
-				Z_Free((byte *)rover+sizeof(memblock_t));
-				base = base->next;
-				rover = base->next;
-			}
-		}
-		else {
-			rover = rover->next;
+	if (alignment > ZONE_GRAIN) {
+		gap = (alignment - ((uintptr_t)base + sizeof(memblock_t)) % alignment) % alignment;
+		if (gap && gap < ZONE_MINBLOCK)
+			gap += alignment;
+		if (gap) {
+			// the front stays free
+			newblock = (memblock_t *)((byte *)base + gap);
+			newblock->size = base->size - gap;
+			newblock->prev = base;
+			newblock->next = base->next;
+			newblock->next->prev = newblock;
+
+			base->next = newblock;
+			base->size = gap;
+			Z_BinBlock(zone, base);
+			base = newblock;
 		}
-	} while (base->tag != TAG_FREE || base->size < size);
-	// old: (base->user || base->size < size)
-	
-	free_memory -= rover->size;
-	if (tag >= TAG_PURGELEVEL)
-		purgable_memory += rover->size;
-	else
-		active_memory += rover->size;
+	}
 	
 	extra = base->size - size;
 	
 	if (extra > MIN_FRAGMENT) {
+		// there will be a free fragment after the allocated block
 		newblock = (memblock_t *)((byte *)base + size);
 		newblock->size = extra;
+		newblock->tag = TAG_FREE;
 		newblock->user = NULL;
+		newblock->cache = 0;
+		newblock->pinned = 0;
 		newblock->prev = base;
 		newblock->next = base->next;
 		newblock->next->prev = newblock;
 		
 		base->next = newblock;
 		base->size = size;
+		Z_BinBlock(zone, newblock);
 	}
-	else if (tag >= TAG_PURGELEVEL)
-		purgable_memory += size;
 	
 	base->user = (void **)user;
 	base->tag = tag;
+	base->cache = 0;
+	base->pinned = alignment > ZONE_GRAIN;
 	
 	if (tag >= TAG_PURGELEVEL)
-	    purgable_memory += size;
+	    zone->purgable_memory += base->size;
 	else
-	    active_memory += size;
+	    zone->active_memory += base->size;
 	
-	free_memory -= size;
+	zone->free_memory -= base->size;
+	if (zone->active_memory + zone->purgable_memory > zone->peak_memory)
+		zone->peak_memory = zone->active_memory + zone->purgable_memory;
+	++zone->numallocs;
 	
 	void *retn = (void *)( (byte *)base + sizeof(memblock_t) );
 	
 	if (base->user)
 		*base->user = retn;
 
-	// next allocation will start looking here
-	mainzone->rover = base->next;
-	base->id = ZONEID;
-	
-    strncpy(base->name, name, sizeof(base->name) - 1);
-	if (indexer++ > 60) {
-		indexer = 0;
-		Z_Print(true);
-	}
+	Z_SetBlockInfo(base, name, caller);
+	if (tag != TAG_MAGAZINE)
+		Z_RecordEvent(ZEV_ALLOC, tag, base->size, base, name);
 #ifdef CHECKHEAP
-	Z_CheckHeap();
+	Z_ValidateHeap(zone, base);
 #endif
 
-    return retn;
+    return base;
 }
 
-void Z_ChangeTag(void *user, int tag)
+// the magazine a request of this size is served from
+static inline int Z_SizeToClass(size_t size)
 {
-	// sanity
-	if (!user)
-		N_Error("Z_ChangeTag: user is NULL");
+	if (size <= MAG_CLASSSIZE(0))
+		return 0;
+	return 64 - __builtin_clzll(size - 1) - MAG_MINSHIFT;
+}
+
+// the largest magazine a block can be parked in, blocks may have been handed
+// slack by Z_AllocBlock so this isn't always the class they were refilled for
+static inline int Z_BlockToClass(memblock_t* block)
+{
+	int c;
+
+	c = 63 - __builtin_clzll(block->size - sizeof(memblock_t)) - MAG_MINSHIFT;
+	return c < MAG_NUMCLASSES ? c : MAG_NUMCLASSES - 1;
+}
+
+static zonecache_t* Z_GetThreadCache(void)
+{
+	zonecache_t* cache;
+	bool expected;
+	int i;
+
+	if (thread_cache.cache)
+		return thread_cache.cache;
+	
+	for (i = 0; i < ZONE_MAXTHREADS; ++i) {
+		cache = &zone_caches[i];
+		expected = false;
+		if (cache->inuse.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+			// a cache left behind by an exited thread might still get blocks handed back to it,
+			// those are picked up on the first refill
+			thread_cache.cache = cache;
+			return cache;
+		}
+	}
+
+	// out of caches, this thread goes through the zone lock for everything
+	return NULL;
+}
+
+// throws away a cache whose blocks went down with a Z_ClearZone
+static void Z_ResetThreadCache(zonecache_t* cache)
+{
+	memset(cache->count, 0, sizeof(cache->count));
+	cache->returned.store(NULL, std::memory_order_relaxed);
+	cache->generation = zone_generation.load(std::memory_order_acquire);
+}
+
+// hands n blocks from the top of the magazine back to the zone
+static void Z_DrainMagazine(zonecache_t* cache, int c, int n)
+{
+	ZONE_LOCK();
+	while (n-- && cache->count[c])
+		Z_FreeBlock(mainzone, cache->blocks[c][--cache->count[c]]);
+}
+
+static void Z_ParkBlock(zonecache_t* cache, memblock_t* block)
+{
+	int c;
+
+	c = Z_BlockToClass(block);
+	if (cache->count[c] == MAG_SIZE)
+		Z_DrainMagazine(cache, c, MAG_BATCH);
+	
+	cache->blocks[c][cache->count[c]++] = block;
+}
+
+static void Z_RefillMagazine(zonecache_t* cache, int c)
+{
+	memblock_t* block;
+	memblock_t* next;
+	int i;
+
+	// take back whatever other threads freed first
+	block = cache->returned.exchange(NULL, std::memory_order_acquire);
+	for (; block; block = next) {
+		next = FREELINK(block)->next;
+		Z_ParkBlock(cache, block);
+	}
+	if (cache->count[c])
+		return;
+	
+	ZONE_LOCK();
+	for (i = 0; i < MAG_BATCH; ++i) {
+		block = Z_AllocBlock(mainzone, MEM_ALIGN, MAG_CLASSSIZE(c), TAG_MAGAZINE, NULL, "magazine", NULL);
+		block->cache = (byte)(cache - zone_caches) + 1;
+		cache->blocks[c][cache->count[c]++] = block;
+	}
+}
+
+static void* Z_CacheAlloc(zonecache_t* cache, size_t size, int tag, void *user, const char* name, const void *caller)
+{
+	memblock_t* block;
+	void *retn;
+	int c;
+
+	if (cache->generation != zone_generation.load(std::memory_order_acquire))
+		Z_ResetThreadCache(cache);
+	
+	c = Z_SizeToClass(size);
+	if (!cache->count[c])
+		Z_RefillMagazine(cache, c);
+	
+	block = cache->blocks[c][--cache->count[c]];
+	block->user = (void **)user;
+	block->tag = tag;
+	Z_SetBlockInfo(block, name, caller);
+	
+	retn = (void *)((byte *)block + sizeof(memblock_t));
+	if (block->user)
+		*block->user = retn;
+
+	Z_RecordEvent(ZEV_ALLOC, tag, block->size, block, name);
+	return retn;
+}
+
+static void Z_CacheFree(memblock_t* block)
+{
+	zonecache_t* owner;
+	zonecache_t* cache;
+	memblock_t* head;
+
+	if (block->tag == TAG_MAGAZINE)
+		N_Error("Z_Free: freed a pointer that was already freed");
+	if (!Z_IsCachedBlock(block))
+		N_Error("Z_Free: freed a pointer that isn't a zone block");
+	if (block->user != (void **)NULL)
+		*block->user = NULL;
+	
+	Z_RecordEvent(ZEV_FREE, block->tag, block->size, block, NULL);
+	Z_SetBlockInfo(block, "magazine", NULL);
+	block->tag = TAG_MAGAZINE;
+	block->user = (void **)NULL;
+	
+	owner = &zone_caches[block->cache - 1];
+	cache = thread_cache.cache;
+	if (owner == cache && cache->generation == zone_generation.load(std::memory_order_acquire)) {
+		Z_ParkBlock(cache, block);
+		return;
+	}
+
+	// the thread that cached it is gone, nobody would pick it up until the cache gets reused
+	if (!owner->inuse.load(std::memory_order_acquire)) {
+		ZONE_LOCK();
+		Z_FreeBlock(mainzone, block);
+		return;
+	}
+
+	// someone else's block, give it back without taking any lock
+	head = owner->returned.load(std::memory_order_relaxed);
+	do {
+		FREELINK(block)->next = head;
+	} while (!owner->returned.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+}
+
+// gives everything the thread had cached back to the zone
+threadcache_t::~threadcache_t()
+{
+	memblock_t* block;
+	memblock_t* next;
+	int c;
+
+	if (!cache)
+		return;
+	
+	{
+		ZONE_LOCK();
+		if (cache->generation == zone_generation.load(std::memory_order_acquire)) {
+			for (c = 0; c < MAG_NUMCLASSES; ++c) {
+				while (cache->count[c])
+					Z_FreeBlock(mainzone, cache->blocks[c][--cache->count[c]]);
+			}
+			block = cache->returned.exchange(NULL, std::memory_order_acquire);
+			for (; block; block = next) {
+				next = FREELINK(block)->next;
+				Z_FreeBlock(mainzone, block);
+			}
+		}
+		memset(cache->count, 0, sizeof(cache->count));
+	}
+	cache->inuse.store(false, std::memory_order_release);
+	cache = NULL;
+}
+
+void Z_Free(void *ptr)
+{
+	memblock_t* block;
+	memzone_t* zone;
+
+	block = (memblock_t *)((byte *)ptr - sizeof(memblock_t));
+	if (block->cache && block->tag < TAG_PURGELEVEL) {
+		Z_CacheFree(block);
+		return;
+	}
+
+	ZONE_LOCK();
+	zone = Z_BlockZone(block);
+	block = Z_FreeBlock(zone, block);
+#ifdef CHECKHEAP
+	Z_ValidateHeap(zone, block);
+#else
+	(void)block;
+#endif
+}
+
+void* Z_Malloc(size_t size, int tag, void *user)
+{ return Z_Malloc(size, tag, user, "unknown"); }
+
+void* Z_AlignedAlloc(size_t alignment, size_t size, int tag, void *user, const char* name)
+{
+	ZONE_LOCK();
+	return (void *)((byte *)Z_AllocBlock(mainzone, alignment, size, tag, user, name, ZONE_CALLER()) + sizeof(memblock_t));
+}
+
+// Z_Malloc: garbage collection and zone block allocater that returns a block of free memory
+// from within the zone without calling malloc
+void* Z_Malloc(size_t size, int tag, void *user, const char* name)
+{
+	zonecache_t* cache;
+
+	if (size && size <= MAG_MAXSIZE && tag < TAG_PURGELEVEL && (cache = Z_GetThreadCache()) != NULL)
+		return Z_CacheAlloc(cache, size, tag, user, name, ZONE_CALLER());
+	
+	ZONE_LOCK();
+	return (void *)((byte *)Z_AllocBlock(mainzone, MEM_ALIGN, size, tag, user, name, ZONE_CALLER()) + sizeof(memblock_t));
+}
+
+// Z_ZoneMalloc: Z_Malloc out of a specific zone, zones without a budget fall through to the main zone
+void* Z_ZoneMalloc(int zone, size_t size, int tag, void *user, const char* name)
+{
+	zonecache_t* cache;
+
+	if (zone < ZONE_MAIN || zone >= NUMZONES)
+		N_Error("Z_ZoneMalloc: bad zone %i, name: %s", zone, name);
+	
+	// only the main zone has magazines
+	if (memzones[zone] == mainzone && size && size <= MAG_MAXSIZE && tag < TAG_PURGELEVEL && (cache = Z_GetThreadCache()) != NULL)
+		return Z_CacheAlloc(cache, size, tag, user, name, ZONE_CALLER());
+	
+	ZONE_LOCK();
+	return (void *)((byte *)Z_AllocBlock(memzones[zone], MEM_ALIGN, size, tag, user, name, ZONE_CALLER()) + sizeof(memblock_t));
+}
+
+void Z_ChangeTag(void *user, int tag)
+{
+	// sanity
+	if (!user)
+		N_Error("Z_ChangeTag: user is NULL");
 	if (tag >= TAG_PURGELEVEL && !user)
 		N_Error("Z_ChangeTag: user is required for purgable blocks");
 	if (!tag)
 		N_Error("Z_ChangeTag: invalid tag");
 	
 	memblock_t* block;
+	memzone_t* zone;
 	
 	block = (memblock_t *)((byte *)user - sizeof(memblock_t));
-	if (block->id != ZONEID)
-		N_Error("Z_ChangeTag: block id isn't ZONEID");
+
+	// Z_IsZoneBlock walks the neighbour links, which another thread's free can be rewriting
+	ZONE_LOCK();
+	if (!Z_IsZoneBlock(block))
+		N_Error("Z_ChangeTag: pointer isn't a zone block");
+	
+	zone = Z_BlockZone(block);
+	if (block->tag >= TAG_PURGELEVEL)
+		zone->purgable_memory -= block->size;
+	else
+		zone->active_memory -= block->size;
+	if (tag >= TAG_PURGELEVEL)
+		zone->purgable_memory += block->size;
+	else
+		zone->active_memory += block->size;
 	
 	block->tag = tag;
-	if (indexer++ > 60) {
-		indexer = 0;
-		Z_Print(true);
-	}
+	Z_RecordEvent(ZEV_CHANGETAG, tag, block->size, block, NULL);
+}
+
+//
+// Z_Reclaim: takes a purgable block back with a new tag before the zone gets around to
+// purging it, user is the owner's pointer same as Z_Malloc's. Checking *user and changing
+// the tag happen under the one lock so a purge on another thread can't land in between,
+// returns NULL if the block's already gone
+//
+void* Z_Reclaim(void *user, int tag)
+{
+	ZONE_LOCK();
+	if (!*(void **)user)
+		return NULL;
+	Z_ChangeTag(*(void **)user, tag);
+	return *(void **)user;
 }
 
 void Z_ChangeName(void *ptr, const char* name)
@@ -633,14 +1680,12 @@ void Z_ChangeName(void *ptr, const char* name)
 	memblock_t* block;
 	
 	block = (memblock_t *)((byte *)ptr - sizeof(memblock_t));
-	if (block->id != ZONEID)
-		N_Error("Z_ChangeName: block id wasn't zoneid");
+
+	ZONE_LOCK();
+	if (!Z_IsZoneBlock(block))
+		N_Error("Z_ChangeName: pointer isn't a zone block");
 	
-	strncpy(block->name, name, sizeof(block->name) - 1);
-	if (indexer++ > 60) {
-		indexer = 0;
-		Z_Print(true);
-	}
+	Z_SetBlockInfo(block, name, NULL);
 }
 
 void Z_ChangeUser(void *ptr, void *user)
@@ -648,110 +1693,129 @@ void Z_ChangeUser(void *ptr, void *user)
 	memblock_t* block;
 	
 	block = (memblock_t *)((byte *)user - sizeof(memblock_t));
-	if (block->id != ZONEID)
-		N_Error("Z_ChangeUser: block id isn't ZONEID");
+
+	ZONE_LOCK();
+	if (!Z_IsZoneBlock(block))
+		N_Error("Z_ChangeUser: pointer isn't a zone block");
 	
 	*block->user = ptr;
-	if (indexer++ > 60) {
-		indexer = 0;
-		Z_Print(true);
-	}
 }
 
 int Z_FreeMemory(void)
 {
 	memblock_t* block;
-	int memory;
+	int memory, i;
+
+	ZONE_LOCK();
 	
 	memory = 0;
-	for (block = mainzone->blocklist.next; block != &mainzone->blocklist; block = block->next) {
-		if (block->tag == TAG_FREE || block->tag >= TAG_PURGELEVEL)
-			memory += block->size;
-	}
-	if (indexer++ > 60) {
-		indexer = 0;
-		Z_Print(true);
+	for (i = 0; i < numzones; ++i) {
+		for (block = zonelist[i]->blocklist.next; block != &zonelist[i]->blocklist; block = block->next) {
+			if (block->tag == TAG_FREE || block->tag >= TAG_PURGELEVEL)
+				memory += block->size;
+		}
 	}
 	return memory;
 }
 
-void Z_FreeTags(int lowtag, int hightag)
+// the zone lock must be held
+static void Z_FreeZoneTags(memzone_t* zone, int lowtag, int hightag)
 {
 	memblock_t* block;
 	memblock_t* next;
 	
-	for (block = mainzone->blocklist.next; block != &mainzone->blocklist; block = block->next) {
+	for (block = zone->blocklist.next; block != &zone->blocklist; block = next) {
 		next = block->next;
 		
 		if (block->tag == TAG_FREE)
 			continue;
-		if (block->tag >= lowtag && block->tag <= hightag)
-			Z_Free((byte *)block+sizeof(memblock_t));
-	}
-	if (indexer++ > 60) {
-		indexer = 0;
-		Z_Print(true);
+		if (block->tag >= lowtag && block->tag <= hightag) {
+			// the freed block might have swallowed the next one
+			next = Z_FreeBlock(zone, block)->next;
+		}
 	}
 }
 
+void Z_FreeTags(int lowtag, int hightag)
+{
+	int i;
+
+	ZONE_LOCK();
+	for (i = 0; i < numzones; ++i)
+		Z_FreeZoneTags(zonelist[i], lowtag, hightag);
+}
+
 void Z_Print(bool all)
 {
+	memzone_t* zone;
 	memblock_t* block;
-	memblock_t* next;
 	size_t count, sum;
 	size_t totalblocks;
+	size_t total_memory;
+	size_t blockcount[NUMTAGS] = {0};
 	char name[15];
+	double s;
+	int i;
 	
+	ZONE_LOCK();
 	name[14] = 0;
 	count = 0;
 	sum = 0;
 	totalblocks = 0;
 	
-	size_t total_memory = active_memory + purgable_memory + free_memory;
-	double s = 100.0f / total_memory;
-	
-	printf("          : %8li total zone size\n", mainzone->size);
-	printf("-------------------------\n");
-	printf("-------------------------\n");
-	printf("          : %8li REMAINING\n", mainzone->size - active_memory - purgable_memory);
+	printf("          : %8li total zone size\n", zone_size);
 	printf("-------------------------\n");
-	printf("(PERCENTAGES)\n");
-	printf(
-			"%8li   %6.02f%%   static\n"
-			"%8li   %6.02f%%   purgable\n"
-			"%8li   %6.02f%%   free\n",
-	active_memory, active_memory*s,
-	purgable_memory, purgable_memory*s,
-	free_memory, free_memory*s);
-	printf("-------------------------\n");
-	
-	size_t blockcount[NUMTAGS] = {0};
-	for (block = mainzone->blocklist.next; block != &mainzone->blocklist; block = block->next)
-		++blockcount[block->tag];
+	for (i = 0; i < numzones; ++i) {
+		zone = zonelist[i];
+		total_memory = zone->active_memory + zone->purgable_memory + zone->free_memory;
+		s = 100.0f / total_memory;
+		
+		printf("(%s ZONE)\n", zone->name);
+		printf("          : %8li zone size\n", zone->size);
+		printf("          : %8li REMAINING\n", zone->size - zone->active_memory - zone->purgable_memory);
+		printf("          : %8li peak\n", zone->peak_memory);
+		printf("          : %8li allocs %8li frees\n", zone->numallocs, zone->numfrees);
+		printf("(PERCENTAGES)\n");
+		printf(
+				"%8li   %6.02f%%   static\n"
+				"%8li   %6.02f%%   purgable\n"
+				"%8li   %6.02f%%   free\n",
+		zone->active_memory, zone->active_memory*s,
+		zone->purgable_memory, zone->purgable_memory*s,
+		zone->free_memory, zone->free_memory*s);
+		printf("-------------------------\n");
+		
+		for (block = zone->blocklist.next; block != &zone->blocklist; block = block->next)
+			++blockcount[block->tag];
+	}
 	
 	printf("total purgable blocks: %li\n", blockcount[TAG_PURGELEVEL]);
 	printf("total cache blocks:    %li\n", blockcount[TAG_CACHE]);
 	printf("total free blocks:     %li\n", blockcount[TAG_FREE]);
 	printf("total static blocks:   %li\n", blockcount[TAG_STATIC]);
 	printf("total level blocks:    %li\n", blockcount[TAG_LEVEL]);
+	printf("total magazine blocks: %li\n", blockcount[TAG_MAGAZINE]);
+	printf("-------------------------\n");
+	printf("temp memory: %li used of %li, %li high-water\n", tempbufs[temp_current].used.load(std::memory_order_relaxed),
+		tempbufs[temp_current].size, temp_highwater);
 	printf("-------------------------\n");
 	
-	for (block = mainzone->blocklist.next;; block = block->next) {
-		if (block == &mainzone->blocklist)
-	        break;
-		
-		count++;
-		totalblocks++;
-		sum += block->size;
-		
-		memcpy(name, block->name, 14);
-		if (all)
-			printf("%8p : %8li %8s\n", (void *)block, block->size, name);
-		
-		if (block->next == &mainzone->blocklist) {
-			printf("          : %8li %8s (TOTAL)\n", sum, name);
-			count = 0;
-			sum = 0;
+	for (i = 0; i < numzones; ++i) {
+		zone = zonelist[i];
+		for (block = zone->blocklist.next; block != &zone->blocklist; block = block->next) {
+			count++;
+			totalblocks++;
+			sum += block->size;
+			
+			strncpy(name, Z_BlockName(block), 14);
+			if (all)
+				printf("%8p : %8li %8s\n", (void *)block, block->size, name);
+			
+			if (block->next == &zone->blocklist) {
+				printf("          : %8li %8s (%s TOTAL)\n", sum, name, zone->name);
+				count = 0;
+				sum = 0;
+			}
 		}
 	}
 	printf("-------------------------");
@@ -760,96 +1824,917 @@ void Z_Print(bool all)
 
 void* Z_Realloc(void* ptr, size_t nsize, void* user, int tag, const char* name)
 {
+	memblock_t* block;
+	void *p;
+
 #ifdef CHECKHEAP
-	Z_CheckHeap();
-#endif
-	void *p = Z_Malloc(nsize, tag, user, name);
-	if (ptr) {
-		memblock_t* block = (memblock_t *)((byte *)ptr - sizeof(memblock_t));
-		memcpy(p, ptr, nsize <= block->size ? nsize : block->size);
-		
-		Z_Free(ptr);
-		block->user = (void **)user;
-		if (block->user)
-			*block->user = p;
-	}
-	if (indexer++ > 60) {
-		indexer = 0;
-		Z_Print(true);
+	{
+		ZONE_LOCK();
+		Z_ValidateHeap(mainzone, NULL);
 	}
+#endif
+	if (!ptr)
+		return Z_Malloc(nsize, tag, user, name);
+	
+	// stays in whatever zone it was in
+	block = (memblock_t *)((byte *)ptr - sizeof(memblock_t));
+	p = Z_ZoneMalloc(Z_BlockZone(block)->id, nsize, tag, user, name);
+	size_t oldsize = block->size - sizeof(memblock_t);
+	memcpy(p, ptr, nsize <= oldsize ? nsize : oldsize);
+	
+	// freeing the old block clears the user it shares with the new one, so the
+	// user has to be pointed back at the new block afterwards
+	Z_Free(ptr);
+	if (user)
+		*(void **)user = p;
 	return p;
 }
 
 void* Z_Calloc(void *user, size_t nelem, size_t elemsize, int tag, const char* name)
 {
 #ifdef CHECKHEAP
-	Z_CheckHeap();
-#endif
-	if (indexer++ > 60) {
-		indexer = 0;
-		Z_Print(true);
+	{
+		ZONE_LOCK();
+		Z_ValidateHeap(mainzone, NULL);
 	}
+#endif
 	return memset(Z_Malloc(nelem * elemsize, tag, user, name), 0, nelem * elemsize);
 }
 
 // cleans all zone caches (only blocks from scope to free to unused)
 void Z_CleanCache(void)
 {
+	memzone_t* zone;
 	memblock_t* block;
+	int i;
+
+	ZONE_LOCK();
 	LOG_TRACE("performing garbage collection of zone");
 	
-	for (block = mainzone->blocklist.next; block != &mainzone->blocklist; block = block->next) {
-		if (block->id != ZONEID) {
-			N_Error("Z_CleanCache: block id wasn't ZONEID");
+	for (i = 0; i < numzones; ++i) {
+		zone = zonelist[i];
+		for (block = zone->blocklist.next; block != &zone->blocklist; block = block->next) {
+			if (block->tag != TAG_FREE && !Z_IsZoneBlock(block)) {
+				N_Error("Z_CleanCache: block at %p isn't a zone block", (void *)block);
+			}
+			if (block->next->prev != block) {
+				N_Error("Z_CleanCache: next block doesn't have proper back linkage");
+			}
+			if (block->tag == TAG_FREE && block->next->tag == TAG_FREE) {
+				LOG_INFO("Z_CleanCache: two free blocks in a row, merging");
+				Z_UnbinBlock(zone, block);
+				Z_BinBlock(zone, Z_MergeNB(zone, block));
+			}
+			if (block->tag < TAG_PURGELEVEL) {
+				continue;
+			}
+			else {
+				block = Z_FreeBlock(zone, block);
+			}
+		}
+	}
+}
+
+// the zone lock must be held
+static void Z_CheckZone(memzone_t* zone)
+{
+	memblock_t* block;
+
+	for (block = zone->blocklist.next;; block = block->next) {
+		if (block->next == &zone->blocklist) {
+			// all blocks have been hit
+			break;
 		}
 		if (block->next->prev != block) {
-			N_Error("Z_CleanCache: next block doesn't have proper back linkage");
+			N_Error("Z_CheckHeap: next block doesn't have proper back linkage, zone: %s, name: %s, back linked name: %s", zone->name, Z_BlockName(block), Z_BlockName(block->next));
 		}
 		if (block->tag == TAG_FREE && block->next->tag == TAG_FREE) {
-			LOG_INFO("Z_CleanCache: two free blocks in a row, merging");
-			Z_MergeNB(block);
-			Z_MergePB(block);
-		}
-		if (block->tag < TAG_PURGELEVEL) {
-			continue;
+			LOG_INFO("Z_CheckHeap: two free blocks in a row, merging");
+			Z_UnbinBlock(zone, block);
+			Z_BinBlock(zone, Z_MergeNB(zone, block));
 		}
-		else {
-			memblock_t* base = block;
-			block = block->prev;
-			Z_Free((byte*)block+sizeof(memblock_t));
-			block = base->next;
-		}
-	}
-	if (indexer++ > 60) {
-		indexer = 0;
-		Z_Print(true);
 	}
 }
 
 void Z_CheckHeap(void)
 {
-	memblock_t* block;
+	int i;
+
+	ZONE_LOCK();
 //	LOG_TRACE("running heap check");
-	for (block = mainzone->blocklist.next;; block = block->next) {
-		if (block->next == &mainzone->blocklist) {
-			// all blocks have been hit
+	for (i = 0; i < numzones; ++i)
+		Z_CheckZone(zonelist[i]);
+//	LOG_TRACE("done with heap check");
+}
+
+// only blocks the owner has to go through its user pointer for can move, that's anything purgable
+static inline bool Z_IsMovable(const memblock_t* block)
+{
+	return block->tag >= TAG_PURGELEVEL && block->user && !block->pinned;
+}
+
+// moves block down to where the free block in front of it starts, returns the free space left behind it
+static memblock_t* Z_SlideBlock(memzone_t* zone, memblock_t* hole, memblock_t* block)
+{
+	memblock_t* prev;
+	memblock_t* next;
+	memblock_t* freed;
+	size_t holesize, size;
+
+	prev = hole->prev;
+	next = block->next;
+	holesize = hole->size;
+	size = block->size;
+
+	Z_UnbinBlock(zone, hole);
+	memmove(hole, block, size);
+	block = hole; // the old header is gone now, only its address is still good for the event and side table
+	block->prev = prev;
+	prev->next = block;
+
+	freed = (memblock_t *)((byte *)block + size);
+	freed->size = holesize;
+	freed->tag = TAG_FREE;
+	freed->user = (void **)NULL;
+	freed->cache = 0;
+	freed->pinned = 0;
+	freed->prev = block;
+	freed->next = next;
+	next->prev = freed;
+	block->next = freed;
+
+	*block->user = (void *)((byte *)block + sizeof(memblock_t));
+	Z_MoveBlockInfo((memblock_t *)((byte *)block + holesize), block);
+	Z_RecordEvent(ZEV_MOVE, block->tag, (size_t)((byte *)block + holesize), block, NULL);
+
+	if (zone->check_rover == (memblock_t *)((byte *)block + holesize))
+		zone->check_rover = block;
+	++zone->nummoves;
+	zone->movedbytes += size;
+
+	freed = Z_MergeNB(zone, freed);
+	Z_BinBlock(zone, freed);
+	return freed;
+}
+
+// the zone lock must be held, returns true if the sweep got to the end of the zone
+static bool Z_CompactZone(memzone_t* zone, const std::chrono::steady_clock::time_point& deadline)
+{
+	memblock_t* block;
+	unsigned count;
+
+	block = zone->compact_rover ? zone->compact_rover : zone->blocklist.next;
+	for (count = 0; block != &zone->blocklist; ++count) {
+		if (!(count & (COMPACT_CHECK_INTERVAL - 1)) && std::chrono::steady_clock::now() >= deadline) {
+			zone->compact_rover = block;
+			return false;
+		}
+		if (block->tag == TAG_FREE && Z_IsMovable(block->next))
+			block = Z_SlideBlock(zone, block, block->next);
+		else
+			block = block->next;
+	}
+	zone->compact_rover = NULL;
+	return true;
+}
+
+//
+// Z_Compact: slides movable blocks down over the free space in front of them so the free
+// space collects in fewer, bigger blocks, patching the owner's user pointer as it goes.
+// Only purgable blocks move (their owners already can't hold on to anything but the user
+// pointer), so giving a block a non-purgable tag pins it just like it keeps it from being purged.
+// Picks up where it left off until budget_ms runs out, returns true once every zone
+// has been swept through to the end
+//
+bool Z_Compact(int budget_ms)
+{
+	const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(budget_ms);
+	static int compact_zone;
+
+	ZONE_LOCK();
+	if (compact_zone >= numzones)
+		compact_zone = 0;
+	
+	for (; compact_zone < numzones; ++compact_zone) {
+		if (!Z_CompactZone(zonelist[compact_zone], deadline))
+			return false;
+	}
+	compact_zone = 0;
+	return true;
+}
+
+// hooks another chunk of slots onto the front of the free list
+static void Z_PoolGrow(pool_t* pool)
+{
+	poolchunk_t* chunk;
+	byte *slot;
+	size_t i;
+
+	// the zone only guarantees ZONE_GRAIN alignment, so there's room to line the slots up
+	chunk = (poolchunk_t *)Z_Malloc(sizeof(poolchunk_t) + pool->align + pool->slotsize * pool->chunkslots,
+		pool->tag, NULL, pool->name);
+	chunk->slots = (byte *)(((uintptr_t)(chunk + 1) + pool->align - 1) & ~(uintptr_t)(pool->align - 1));
+	chunk->numslots = pool->chunkslots;
+	chunk->next = pool->chunks;
+	pool->chunks = chunk;
+
+	// chained back to front so the first slot comes out first
+	for (i = chunk->numslots; i-- > 0;) {
+		slot = chunk->slots + i * pool->slotsize;
+		*(void **)slot = pool->freelist;
+		pool->freelist = slot;
+	}
+	pool->numslots += chunk->numslots;
+	++pool->numchunks;
+}
+
+pool_t* Z_PoolInit(size_t slotsize, size_t align, size_t count, int tag, const char *name)
+{
+	pool_t* pool;
+
+	if (tag >= TAG_PURGELEVEL)
+		N_Error("Z_PoolInit: pools can't be purgable, name: %s", name);
+	if (!slotsize || !count)
+		N_Error("Z_PoolInit: bad slot size or count, name: %s", name);
+	
+	// a free slot has to be able to hold the free list link
+	if (align < alignof(void *))
+		align = alignof(void *);
+	if (slotsize < sizeof(void *))
+		slotsize = sizeof(void *);
+	slotsize = (slotsize + align - 1) & ~(align - 1);
+
+	pool = (pool_t *)Z_Malloc(sizeof(pool_t), tag, NULL, name);
+	memset(pool, 0, sizeof(pool_t));
+	pool->slotsize = slotsize;
+	pool->align = align;
+	pool->chunkslots = count;
+	pool->tag = tag;
+	strncpy(pool->name, name, sizeof(pool->name) - 1);
+
+	Z_PoolGrow(pool);
+	return pool;
+}
+
+void* Z_PoolAlloc(pool_t* pool)
+{
+	void *ptr;
+
+	if (!pool->freelist)
+		Z_PoolGrow(pool);
+	
+	ptr = pool->freelist;
+	pool->freelist = *(void **)ptr;
+
+	++pool->allocs;
+	if (++pool->used > pool->peak)
+		pool->peak = pool->used;
+	
+	return ptr;
+}
+
+void Z_PoolFree(pool_t* pool, void *ptr)
+{
+#ifdef _NOMAD_DEBUG
+	poolchunk_t* chunk;
+
+	for (chunk = pool->chunks; chunk; chunk = chunk->next) {
+		if ((byte *)ptr >= chunk->slots && (byte *)ptr < chunk->slots + chunk->numslots * pool->slotsize)
+			break;
+	}
+	if (!chunk || ((byte *)ptr - chunk->slots) % pool->slotsize)
+		N_Error("Z_PoolFree: %p isn't a slot in pool %s", ptr, pool->name);
+	if (!pool->used)
+		N_Error("Z_PoolFree: pool %s has nothing allocated", pool->name);
+#endif
+	*(void **)ptr = pool->freelist;
+	pool->freelist = ptr;
+
+	--pool->used;
+	++pool->frees;
+}
+
+void Z_PoolDestroy(pool_t* pool)
+{
+	poolchunk_t* chunk;
+	poolchunk_t* next;
+
+	if (pool->used)
+		LOG_WARN("Z_PoolDestroy: pool {} still has {} slots in use", pool->name, pool->used);
+	
+	for (chunk = pool->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		Z_Free(chunk);
+	}
+	Z_Free(pool);
+}
+
+void Z_PoolPrint(const pool_t* pool)
+{
+	printf("%-14s %8li slots of %li bytes in %li chunks\n", pool->name, pool->numslots, pool->slotsize, pool->numchunks);
+	printf("               %8li used %8li peak %8li allocs %8li frees\n", pool->used, pool->peak, pool->allocs, pool->frees);
+}
+
+typedef struct
+{
+	size_t allocs, frees;
+	size_t bytes;
+	size_t live, peak;
+} tagstats_t;
+
+typedef struct
+{
+	size_t allocs;
+	size_t bytes;
+	size_t hist[ZONE_NUMBINS];
+} namestats_t;
+
+//
+// Z_PrintReport: the -zonereport mode, reads an event file written by
+// Z_FlushEvents and prints per-tag and per-name histograms along with
+// a fragmentation timeline
+//
+void Z_PrintReport(const char *path)
+{
+	FILE* fp;
+	uint32_t header[3];
+	zone_event_t ev;
+	size_t opcount[NUMZEVS] = {0};
+	tagstats_t tags[256];
+	std::map<std::string, namestats_t> names;
+	std::unordered_map<uint64_t, uint8_t> live;
+	std::vector<zone_event_t> frags;
+	uint64_t start, end;
+	size_t total, i, step;
+	int bin;
+
+	fp = fopen(path, "rb");
+	if (!fp)
+		N_Error("Z_PrintReport: failed to open zone event file %s", path);
+	if (fread(header, sizeof(header), 1, fp) != 1 || header[0] != EVENT_MAGIC)
+		N_Error("Z_PrintReport: %s isn't a zone event file", path);
+	if (header[1] != EVENT_VERSION || header[2] != sizeof(zone_event_t))
+		N_Error("Z_PrintReport: %s was written by a different version (version %u, event size %u)",
+			path, header[1], header[2]);
+
+	memset(tags, 0, sizeof(tags));
+	start = end = 0;
+	total = 0;
+	while (fread(&ev, sizeof(ev), 1, fp) == 1) {
+		if (!total)
+			start = ev.time;
+		end = ev.time;
+		++total;
+		if (ev.op >= NUMZEVS)
+			N_Error("Z_PrintReport: bad event op %i at event %li", ev.op, total);
+
+		++opcount[ev.op];
+		ev.name[sizeof(ev.name) - 1] = 0;
+
+		switch (ev.op) {
+		case ZEV_ALLOC:
+			live[ev.addr] = ev.tag;
+			++tags[ev.tag].allocs;
+			tags[ev.tag].bytes += ev.size;
+			tags[ev.tag].live += ev.size;
+			if (tags[ev.tag].live > tags[ev.tag].peak)
+				tags[ev.tag].peak = tags[ev.tag].live;
+			// fallthrough
+		case ZEV_HUNKALLOC:
+		case ZEV_HUNKHIGHALLOC:
+		case ZEV_HUNKTEMP: {
+			namestats_t& n = names[ev.name];
+			bin = ev.size ? 63 - __builtin_clzll(ev.size) : 0;
+			++n.allocs;
+			n.bytes += ev.size;
+			++n.hist[bin];
+			break; }
+		case ZEV_FREE: {
+			std::unordered_map<uint64_t, uint8_t>::iterator it = live.find(ev.addr);
+			const uint8_t tag = it != live.end() ? it->second : ev.tag;
+			++tags[tag].frees;
+			tags[tag].live -= ev.size <= tags[tag].live ? ev.size : tags[tag].live;
+			if (it != live.end())
+				live.erase(it);
+			break; }
+		case ZEV_CHANGETAG: {
+			std::unordered_map<uint64_t, uint8_t>::iterator it = live.find(ev.addr);
+			if (it != live.end()) {
+				tags[it->second].live -= ev.size <= tags[it->second].live ? ev.size : tags[it->second].live;
+				it->second = ev.tag;
+			}
+			tags[ev.tag].live += ev.size;
+			if (tags[ev.tag].live > tags[ev.tag].peak)
+				tags[ev.tag].peak = tags[ev.tag].live;
+			break; }
+		case ZEV_MOVE: {
+			std::unordered_map<uint64_t, uint8_t>::iterator it = live.find(ev.size);
+			if (it != live.end()) {
+				const uint8_t tag = it->second;
+				live.erase(it);
+				live[ev.addr] = tag;
+			}
+			break; }
+		case ZEV_FRAGMENT:
+			frags.emplace_back(ev);
 			break;
+		};
+	}
+	fclose(fp);
+
+	printf("%s: %li events over %.03f seconds\n", path, total, (double)(end - start) / 1e9);
+	printf("-------------------------\n");
+	printf("%8li allocs\n%8li frees\n%8li tag changes\n%8li purges\n%8li moves\n%8li hunk allocs\n",
+		opcount[ZEV_ALLOC], opcount[ZEV_FREE], opcount[ZEV_CHANGETAG], opcount[ZEV_PURGE], opcount[ZEV_MOVE],
+		opcount[ZEV_HUNKALLOC] + opcount[ZEV_HUNKHIGHALLOC] + opcount[ZEV_HUNKTEMP]);
+	printf("-------------------------\n");
+	printf("(PER TAG)\n");
+	printf("%-12s %8s %8s %12s %12s %12s\n", "tag", "allocs", "frees", "bytes", "live", "peak");
+	for (i = 0; i < arraylen(tags); ++i) {
+		if (!tags[i].allocs && !tags[i].frees && !tags[i].live)
+			continue;
+		printf("%-12s %8li %8li %12li %12li %12li\n", Z_TagName(i),
+			tags[i].allocs, tags[i].frees, tags[i].bytes, tags[i].live, tags[i].peak);
+	}
+	printf("-------------------------\n");
+	printf("(PER NAME)\n");
+	for (std::map<std::string, namestats_t>::const_iterator it = names.begin(); it != names.end(); ++it) {
+		printf("%-14s %8li allocs %12li bytes %10li avg\n", it->first.c_str(),
+			it->second.allocs, it->second.bytes, it->second.bytes / it->second.allocs);
+		printf("               ");
+		for (bin = 0; bin < ZONE_NUMBINS; ++bin) {
+			if (it->second.hist[bin])
+				printf(" 2^%i:%li", bin, it->second.hist[bin]);
 		}
-		if (block->id != ZONEID) {
-			N_Error("Z_CheckHeap: block id wasn't ZONEID, name: %s", block->name);
+		printf("\n");
+	}
+	printf("-------------------------\n");
+	printf("(FRAGMENTATION)\n");
+	printf("%10s %14s %14s %8s\n", "ms", "free", "largest", "frag");
+	step = frags.size() > 32 ? frags.size() / 32 : 1;
+	for (i = 0; i < frags.size(); i += step) {
+		const zone_event_t* f = &frags[i];
+		printf("%10.01f %14li %14li %7.02f%%\n", (double)(f->time - start) / 1e6, f->addr, f->size,
+			f->addr ? 100.0 - (f->size * 100.0 / f->addr) : 0.0);
+	}
+	printf("-------------------------\n");
+}
+
+//
+// zone benchmark, the -zonebench mode: random mixed 16 byte to 16 KiB allocs and
+// frees against a table of live blocks, with a fixed seed so runs can be compared
+// between builds. each count is run through a copy of the old rover allocator,
+// straight through the bins, and then through Z_Malloc with the magazines in front.
+// the check level is whatever -zonecheck says, pass -zonecheck 0 for numbers that
+// mean anything (the rover copy never checks)
+//
+#define BENCH_SLOTS 4096
+#define BENCH_SEED  0x2545f491
+
+static inline uint32_t Z_BenchRand(uint32_t* state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+// log-uniform over 16 bytes to 16 KiB, so small blocks are as common as they are in the game
+static inline size_t Z_BenchSize(uint32_t r)
+{
+	const size_t base = (size_t)16 << (r % 10);
+	return base + ((r >> 8) & (base - 1));
+}
+
+// the packed 51 byte header blocks had before it was cut down to 32, only kept so the
+// benchmark can show what the old layout and the rover allocator would have cost
+typedef ZONE_PACK(struct oldmemblock_s
+{
+	char name[15];
+	size_t size;
+	void **user;
+	struct oldmemblock_s* next;
+	struct oldmemblock_s* prev;
+	int tag;
+}) oldmemblock_t;
+
+//
+// the rover allocator the size-class bins replaced, kept only so -zonebench can run the
+// same ops through it: one first-fit walk over every block starting at the rover, with
+// the old header. purging and the debug scans are left out, the bench never uses either
+//
+typedef struct
+{
+	byte *base;
+	size_t size;
+	oldmemblock_t blocklist;
+	oldmemblock_t* rover;
+} roverzone_t;
+
+// big enough that first fit can't run out with every slot holding the largest block
+#define BENCH_ROVER_SIZE (2 * BENCH_SLOTS * ((16 << 10) + sizeof(oldmemblock_t) + MEM_ALIGN))
+
+// sets the whole zone back to one free block
+static void Z_RoverClear(roverzone_t* zone)
+{
+	oldmemblock_t* block;
+
+	block = (oldmemblock_t *)zone->base;
+	zone->blocklist.next = zone->blocklist.prev = block;
+	zone->blocklist.user = (void **)zone;
+	zone->blocklist.tag = TAG_STATIC;
+	zone->blocklist.size = 0;
+	zone->rover = block;
+
+	block->next = block->prev = &zone->blocklist;
+	block->user = NULL;
+	block->tag = TAG_FREE;
+	block->size = zone->size;
+}
+
+// mapped once for the whole benchmark and populated up front, the rover walks forward
+// through the whole arena before it wraps and would otherwise be timing page faults
+static void Z_RoverInit(roverzone_t* zone)
+{
+	zone->size = BENCH_ROVER_SIZE;
+	zone->base = (byte *)mmap(NULL, zone->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (zone->base == (byte *)MAP_FAILED)
+		N_Error("Z_RoverInit: failed to map %li bytes", zone->size);
+	Z_RoverClear(zone);
+}
+
+static void Z_RoverShutdown(roverzone_t* zone)
+{
+	munmap(zone->base, zone->size);
+}
+
+static void *Z_RoverAlloc(roverzone_t* zone, size_t size, const char *name)
+{
+	oldmemblock_t* rover;
+	oldmemblock_t* base;
+	oldmemblock_t* start;
+	oldmemblock_t* newblock;
+	size_t extra;
+
+	size = ((size + MEM_ALIGN - 1) & ~(size_t)(MEM_ALIGN - 1)) + sizeof(oldmemblock_t);
+
+	base = zone->rover;
+	if (base->prev->tag == TAG_FREE)
+		base = base->prev;
+
+	rover = base;
+	start = base->prev;
+	do {
+		if (rover == start)
+			N_Error("Z_RoverAlloc: failed allocation of %li bytes", size);
+		if (rover->tag != TAG_FREE)
+			base = rover = rover->next;
+		else
+			rover = rover->next;
+	} while (base->tag != TAG_FREE || base->size < size);
+
+	extra = base->size - size;
+	if (extra > MIN_FRAGMENT) {
+		newblock = (oldmemblock_t *)((byte *)base + size);
+		newblock->size = extra;
+		newblock->user = NULL;
+		newblock->tag = TAG_FREE;
+		newblock->prev = base;
+		newblock->next = base->next;
+		newblock->next->prev = newblock;
+
+		base->next = newblock;
+		base->size = size;
+	}
+
+	base->user = NULL;
+	base->tag = TAG_STATIC;
+	strncpy(base->name, name, sizeof(base->name) - 1);
+	zone->rover = base->next;
+
+	return (void *)((byte *)base + sizeof(oldmemblock_t));
+}
+
+static void Z_RoverFree(roverzone_t* zone, void *ptr)
+{
+	oldmemblock_t* block;
+	oldmemblock_t* other;
+
+	block = (oldmemblock_t *)((byte *)ptr - sizeof(oldmemblock_t));
+	block->tag = TAG_FREE;
+	block->user = NULL;
+	strncpy(block->name, "freed", sizeof(block->name) - 1);
+
+	other = block->prev;
+	if (other->tag == TAG_FREE) {
+		other->size += block->size;
+		other->next = block->next;
+		other->next->prev = other;
+		if (block == zone->rover)
+			zone->rover = other;
+		block = other;
+	}
+
+	other = block->next;
+	if (other->tag == TAG_FREE) {
+		block->size += other->size;
+		block->next = other->next;
+		block->next->prev = block;
+		if (other == zone->rover)
+			zone->rover = block;
+	}
+}
+
+enum
+{
+	BENCH_ROVER,
+	BENCH_BINS,
+	BENCH_MAGAZINES
+};
+
+// returns the time taken in nanoseconds, everything it allocated is freed again
+static uint64_t Z_BenchRun(size_t ops, int mode, roverzone_t* rover)
+{
+	void *slots[BENCH_SLOTS];
+	uint32_t seed, r, s;
+	uint64_t start, end;
+	size_t i;
+
+	memset(slots, 0, sizeof(slots));
+	seed = BENCH_SEED;
+	if (mode == BENCH_ROVER)
+		Z_RoverClear(rover);
+
+	start = Z_EventTime();
+	for (i = 0; i < ops; ++i) {
+		r = Z_BenchRand(&seed);
+		s = r % BENCH_SLOTS;
+		if (slots[s]) {
+			if (mode == BENCH_ROVER)
+				Z_RoverFree(rover, slots[s]);
+			else
+				Z_Free(slots[s]);
+			slots[s] = NULL;
+			continue;
 		}
-		if (block->next->prev != block) {
-			N_Error("Z_CheckHeap: next block doesn't have proper back linkage, name: %s, back linked name: %s", block->name, block->next->name);
+		r = Z_BenchRand(&seed);
+		if (mode == BENCH_ROVER)
+			slots[s] = Z_RoverAlloc(rover, Z_BenchSize(r), "zonebench");
+		else if (mode == BENCH_MAGAZINES)
+			slots[s] = Z_Malloc(Z_BenchSize(r), TAG_STATIC, NULL, "zonebench");
+		else
+			slots[s] = Z_AlignedAlloc(MEM_ALIGN, Z_BenchSize(r), TAG_STATIC, NULL, "zonebench");
+	}
+	end = Z_EventTime();
+
+	if (mode == BENCH_ROVER)
+		return end - start;
+	for (s = 0; s < BENCH_SLOTS; ++s) {
+		if (slots[s])
+			Z_Free(slots[s]);
+	}
+	return end - start;
+}
+
+#define BENCH_OVERHEAD_BLOCKS (200*1000)
+
+//
+// Z_BenchOverhead: allocates BENCH_OVERHEAD_BLOCKS random 16-512 byte blocks and returns
+// the zone memory they took beyond what was asked for, per block, old is set to what the
+// old header and rounding would have taken for the same requests
+//
+static double Z_BenchOverhead(bool magazines, double *old)
+{
+	void **blocks;
+	zonestats_t before, after;
+	uint32_t seed, r;
+	size_t i, size, requested, oldused;
+
+	blocks = (void **)Z_Malloc(sizeof(*blocks) * BENCH_OVERHEAD_BLOCKS, TAG_STATIC, NULL, "zonebench");
+	seed = BENCH_SEED;
+	requested = oldused = 0;
+
+	Z_ZoneStats(ZONE_MAIN, &before);
+	for (i = 0; i < BENCH_OVERHEAD_BLOCKS; ++i) {
+		r = Z_BenchRand(&seed);
+		size = 16 + r % (512 - 16 + 1);
+		requested += size;
+		oldused += ((size + MEM_ALIGN - 1) & ~(size_t)(MEM_ALIGN - 1)) + sizeof(oldmemblock_t);
+		if (magazines)
+			blocks[i] = Z_Malloc(size, TAG_STATIC, NULL, "zonebench");
+		else
+			blocks[i] = Z_AlignedAlloc(MEM_ALIGN, size, TAG_STATIC, NULL, "zonebench");
+	}
+	Z_ZoneStats(ZONE_MAIN, &after);
+
+	for (i = 0; i < BENCH_OVERHEAD_BLOCKS; ++i)
+		Z_Free(blocks[i]);
+	Z_Free(blocks);
+
+	*old = (double)(oldused - requested) / BENCH_OVERHEAD_BLOCKS;
+	return (double)(after.active - before.active - requested) / BENCH_OVERHEAD_BLOCKS;
+}
+
+//
+// Z_Benchmark: runs 10k, 100k and 1M ops, or just ops if it isn't 0,
+// then measures the per-block overhead, the zone has to be up
+//
+void Z_Benchmark(size_t ops)
+{
+	static const size_t counts[] = { 10000, 100000, 1000000 };
+	roverzone_t roverzone;
+	uint64_t rover, bins, mags;
+	double overhead, old;
+	size_t i, n;
+
+	Z_RoverInit(&roverzone);
+
+	printf("zone benchmark, %i slots, 16B-16KiB, check level %i\n", BENCH_SLOTS, check_level);
+	printf("-------------------------\n");
+	printf("%10s %12s %10s %12s %10s %12s %10s\n", "ops", "rover ms", "ns/op", "bins ms", "ns/op", "magazine ms", "ns/op");
+	for (i = 0; i < arraylen(counts); ++i) {
+		n = ops ? ops : counts[i];
+		rover = Z_BenchRun(n, BENCH_ROVER, &roverzone);
+		bins = Z_BenchRun(n, BENCH_BINS, &roverzone);
+		mags = Z_BenchRun(n, BENCH_MAGAZINES, &roverzone);
+		printf("%10li %12.03f %10.01f %12.03f %10.01f %12.03f %10.01f\n", n,
+			rover / 1e6, (double)rover / n, bins / 1e6, (double)bins / n, mags / 1e6, (double)mags / n);
+		if (ops)
+			break;
+	}
+	Z_RoverShutdown(&roverzone);
+	printf("-------------------------\n");
+	printf("overhead per block, %i blocks of 16-512 bytes\n", BENCH_OVERHEAD_BLOCKS);
+	printf("%-12s %8s %12s\n", "", "header", "bytes/block");
+	overhead = Z_BenchOverhead(false, &old);
+	printf("%-12s %8li %12.01f\n", "old layout", sizeof(oldmemblock_t), old);
+	printf("%-12s %8li %12.01f\n", "bins", sizeof(memblock_t), overhead);
+	overhead = Z_BenchOverhead(true, &old);
+	printf("%-12s %8li %12.01f\n", "magazines", sizeof(memblock_t), overhead);
+	printf("-------------------------\n");
+}
+
+//
+// magazine stress test, the -zonestress mode: every thread allocates through its
+// magazines, stamps each block, and hands some of them to the next thread through a
+// mailbox so they're freed cross-thread onto the owner's return stack. payloads are
+// checked before every free, and once every thread has exited the zone has to be back
+// to what it was. meant to be run under TSan as well
+//
+#define STRESS_MAXTHREADS 32
+#define STRESS_SLOTS      256
+#define STRESS_MAILBOX    64
+
+typedef struct
+{
+	uint32_t size;
+	uint32_t stamp;
+} stresshdr_t;
+
+static std::atomic<void*> stress_mailbox[STRESS_MAXTHREADS][STRESS_MAILBOX];
+static std::atomic<int> stress_barrier;
+
+static void Z_StressStamp(void *ptr, size_t size, uint32_t stamp)
+{
+	stresshdr_t* hdr = (stresshdr_t *)ptr;
+
+	hdr->size = (uint32_t)size;
+	hdr->stamp = stamp;
+	memset(hdr + 1, stamp & 0xff, size - sizeof(*hdr));
+}
+
+static void Z_StressFree(void *ptr)
+{
+	const stresshdr_t* hdr = (const stresshdr_t *)ptr;
+	const byte* p = (const byte *)(hdr + 1);
+	const byte* end = (const byte *)ptr + hdr->size;
+
+	for (; p < end; ++p) {
+		if (*p != (hdr->stamp & 0xff))
+			N_Error("Z_StressTest: block %p (stamp %x) was overwritten at offset %li", ptr, hdr->stamp,
+				(long)(p - (const byte *)ptr));
+	}
+	Z_Free(ptr);
+}
+
+// waits for every thread to get here, spins since it only runs twice per test
+static void Z_StressWait(int numthreads, int phase)
+{
+	stress_barrier.fetch_add(1, std::memory_order_acq_rel);
+	while (stress_barrier.load(std::memory_order_acquire) < numthreads * phase)
+		std::this_thread::yield();
+}
+
+typedef struct
+{
+	int id;
+	int numthreads;
+	size_t ops;
+} stressarg_t;
+
+static void *Z_StressThread(void *arg)
+{
+	const int id = ((stressarg_t *)arg)->id;
+	const int numthreads = ((stressarg_t *)arg)->numthreads;
+	const size_t ops = ((stressarg_t *)arg)->ops;
+	void *slots[STRESS_SLOTS];
+	std::atomic<void*>* outbox;
+	std::atomic<void*>* inbox;
+	uint32_t seed, r, s;
+	size_t i, size;
+	void *old;
+
+	memset(slots, 0, sizeof(slots));
+	seed = BENCH_SEED + id;
+	outbox = stress_mailbox[(id + 1) % numthreads];
+	inbox = stress_mailbox[id];
+
+	for (i = 0; i < ops; ++i) {
+		r = Z_BenchRand(&seed);
+		s = r % STRESS_SLOTS;
+		if (slots[s]) {
+			// every fourth block goes to the next thread instead, whatever it displaces is freed here
+			if (!(r & 0x300)) {
+				old = outbox[(r >> 12) % STRESS_MAILBOX].exchange(slots[s], std::memory_order_acq_rel);
+				if (old)
+					Z_StressFree(old);
+			}
+			else
+				Z_StressFree(slots[s]);
+			slots[s] = NULL;
 		}
-		if (block->tag == TAG_FREE && block->next->tag == TAG_FREE) {
-			LOG_INFO("Z_CleanCache: two free blocks in a row, merging");
-			Z_MergeNB(block);
-			Z_MergePB(block);
+		else {
+			size = sizeof(stresshdr_t) + (r >> 16) % MAG_MAXSIZE;
+			slots[s] = Z_Malloc(size, TAG_STATIC, NULL, "zonestress");
+			Z_StressStamp(slots[s], size, r);
 		}
+
+		old = inbox[r % STRESS_MAILBOX].exchange(NULL, std::memory_order_acq_rel);
+		if (old)
+			Z_StressFree(old);
 	}
-	if (indexer++ > 60) {
-		indexer = 0;
-		Z_Print(true);
+	for (s = 0; s < STRESS_SLOTS; ++s) {
+		if (slots[s])
+			Z_StressFree(slots[s]);
 	}
-//	LOG_TRACE("done with heap check");
-}
\ No newline at end of file
+
+	// nothing can be handed over once everyone's past this, so the inboxes can be emptied
+	Z_StressWait(numthreads, 1);
+	for (s = 0; s < STRESS_MAILBOX; ++s) {
+		old = inbox[s].exchange(NULL, std::memory_order_acq_rel);
+		if (old)
+			Z_StressFree(old);
+	}
+
+	// nobody exits (draining its magazines) while another thread could still be
+	// pushing onto its return stack
+	Z_StressWait(numthreads, 2);
+	return NULL;
+}
+
+//
+// Z_StressTest: runs ops allocs and frees on each of 1, 2, 4 .. maxthreads threads,
+// errors out on a damaged block or on anything that isn't returned to the zone
+//
+void Z_StressTest(int maxthreads, size_t ops)
+{
+	thread threads[STRESS_MAXTHREADS];
+	stressarg_t args[STRESS_MAXTHREADS];
+	zonestats_t before, after;
+	uint64_t start, end;
+	int n, i;
+
+	if (maxthreads < 1 || maxthreads > STRESS_MAXTHREADS)
+		N_Error("Z_StressTest: thread count must be between 1 and %i", STRESS_MAXTHREADS);
+	
+	printf("zone stress test, %li ops per thread\n", ops);
+	printf("-------------------------\n");
+	printf("%8s %12s %12s\n", "threads", "ms", "Mops/s");
+	for (n = 1; ; n = n * 2 < maxthreads ? n * 2 : maxthreads) {
+		Z_ZoneStats(ZONE_MAIN, &before);
+		stress_barrier.store(0, std::memory_order_relaxed);
+
+		start = Z_EventTime();
+		for (i = 0; i < n; ++i) {
+			args[i].id = i;
+			args[i].numthreads = n;
+			args[i].ops = ops;
+			threads[i].create(Z_StressThread, &args[i]);
+		}
+		for (i = 0; i < n; ++i)
+			threads[i].join();
+		end = Z_EventTime();
+
+		Z_ZoneStats(ZONE_MAIN, &after);
+		if (after.active != before.active || after.free != before.free)
+			N_Error("Z_StressTest: %i threads leaked %li bytes", n, (long)(after.active - before.active));
+		Z_CheckHeap();
+
+		printf("%8i %12.03f %12.02f\n", n, (end - start) / 1e6, (double)(ops * n) / ((end - start) / 1e3));
+		if (n == maxthreads)
+			break;
+	}
+	printf("-------------------------\n");
+}
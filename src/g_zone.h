@@ -29,6 +29,7 @@ enum : uint8_t
 	TAG_LEVEL      = 2,
 	TAG_SFX        = 3,
 	TAG_MUSIC      = 4,
+	TAG_MAGAZINE   = 5, // parked in a thread's allocation cache, owned by the zone
 	TAG_PURGELEVEL = 100,
 	TAG_CACHE      = 101,
 	
@@ -38,6 +39,91 @@ enum : uint8_t
 #define TAG_SCOPE TAG_CACHE
 #define TAG_LOAD TAG_CACHE
 
+// heap validation levels, selected with -zonecheck <level>
+enum : uint8_t
+{
+	ZONE_CHECK_OFF     = 0, // no checks
+	ZONE_CHECK_SAMPLED = 1, // full check every Nth op (-zonecheckrate)
+	ZONE_CHECK_LOCAL   = 2, // only the touched block and its neighbors
+	ZONE_CHECK_FULL    = 3  // full check on every op
+};
+
+// named zones, each one is carved out of the arena at startup with its own
+// budget (scf::memory), a zone without a budget shares the main zone
+enum : uint8_t
+{
+	ZONE_MAIN,
+	ZONE_RENDERER,
+	ZONE_AUDIO,
+	ZONE_LEVEL,
+	ZONE_SCRATCH,
+
+	NUMZONES
+};
+
+// what a zone does when it runs dry
+enum : uint8_t
+{
+	ZONE_PURGE_CACHE, // throws out its own purgable blocks and retries
+	ZONE_PURGE_NONE   // the budget is a hard ceiling, running out is fatal
+};
+
+// how the arena is backed, -hugepages <mode> or the scf's memory.hugepages
+enum : uint8_t
+{
+	ZONE_HUGEPAGES_OFF         = 0,
+	ZONE_HUGEPAGES_TRANSPARENT = 1, // madvise(MADV_HUGEPAGE)
+	ZONE_HUGEPAGES_EXPLICIT    = 2  // MAP_HUGETLB, falls back to transparent if none are reserved
+};
+
+typedef struct zonestats_s
+{
+	const char *name;
+	size_t size;
+	size_t active, purgable, free;
+	size_t peak; // high water mark of active + purgable
+	size_t allocs, frees; // doesn't include the main zone's magazine hand-outs
+	size_t largest; // largest free block
+	size_t moves, movedbytes; // Z_Compact's work
+	int purge;
+	bool shared; // no budget of its own, these are the main zone's numbers
+} zonestats_t;
+
+// allocation event ops
+enum : uint8_t
+{
+	ZEV_ALLOC,
+	ZEV_FREE,
+	ZEV_CHANGETAG,
+	ZEV_PURGE,      // zone ran dry and purgable blocks were thrown out, or a whole zone was dropped
+	ZEV_HUNKALLOC,
+	ZEV_HUNKHIGHALLOC,
+	ZEV_HUNKTEMP,
+	ZEV_FRAGMENT,   // once per flush, size = largest free block, addr = total free memory
+	ZEV_MOVE,       // Z_Compact moved a block, addr = new address, size = old address
+
+	NUMZEVS
+};
+
+#define ZONE_EVENT_FILE "Files/debug/zone.evt"
+
+// on-disk/in-ring allocation event, written as-is after a 12 byte header
+typedef struct zone_event_s
+{
+	uint64_t time; // steady clock, nanoseconds
+	uint64_t addr;
+	uint64_t size;
+	char name[14];
+	uint8_t op;
+	uint8_t tag;
+} zone_event_t;
+
+void Z_RecordEvent(int op, int tag, size_t size, const void *addr, const char *name);
+void Z_FlushEvents(void);
+void Z_PrintReport(const char *path);
+void Z_Benchmark(size_t ops);
+void Z_StressTest(int maxthreads, size_t ops);
+
 void* Z_Malloc(size_t size, int tag, void *user);
 void* Z_AlignedAlloc(size_t alignment, size_t size, int tag, void *user, const char* name);
 void* Z_Malloc(size_t size, int tag, void *user, const char* name);
@@ -46,18 +132,77 @@ void* Z_Realloc(void *ptr, size_t nsize, void *user, int tag, const char* name);
 void Z_Free(void *ptr);
 void Z_FreeTags(int lowtag, int hightag);
 void Z_ChangeTag(void* user, int tag);
+void* Z_Reclaim(void *user, int tag);
 void Z_ChangeUser(void* olduser, void* newuser);
 void Z_ChangeName(void* user, const char* name);
 void Z_ClearCache();
 void Z_CheckHeap();
+void Z_CheckHeapStep(void);
+void Z_SetCheckLevel(int level, int rate);
 void Z_ClearZone();
 void Z_Print(bool all);
 void Z_Init();
 int Z_FreeMemory(void);
 
+void* Z_ZoneMalloc(int zone, size_t size, int tag, void *user, const char* name);
+
+// per-frame temp memory, good until the end of the next tic, never freed by hand
+void* Z_AllocTemp(size_t size, const char *name);
+void Z_FlipTemp(void);
+void Z_ZoneDrop(int zone);
+void Z_ZoneStats(int zone, zonestats_t* stats);
+bool Z_Compact(int budget_ms);
+
 void *Z_ZoneBegin(void);
 void *Z_ZoneEnd(void);
 
+//
+// fixed-size object pools, slots are carved out of one zone block per chunk so
+// there's no memblock_t header or bin search per object, free slots are chained
+// through their first bytes. pools aren't locked, keep each one on a single thread
+//
+typedef struct poolchunk_s
+{
+	struct poolchunk_s* next;
+	byte* slots;
+	size_t numslots;
+} poolchunk_t;
+
+typedef struct pool_s
+{
+	void *freelist;
+	poolchunk_t* chunks;
+	size_t slotsize;
+	size_t align;
+	size_t chunkslots; // slots added every time the pool runs dry
+	int tag;
+	char name[15];
+
+	// stats
+	size_t numslots;
+	size_t numchunks;
+	size_t used, peak;
+	size_t allocs, frees;
+} pool_t;
+
+pool_t* Z_PoolInit(size_t slotsize, size_t align, size_t count, int tag, const char *name);
+void* Z_PoolAlloc(pool_t* pool);
+void Z_PoolFree(pool_t* pool, void *ptr);
+void Z_PoolDestroy(pool_t* pool);
+void Z_PoolPrint(const pool_t* pool);
+
+template<typename T>
+inline pool_t* Z_PoolCreate(size_t count, int tag, const char *name = "pool")
+{ return Z_PoolInit(sizeof(T), alignof(T), count, tag, name); }
+
+// the static pool every allocation of a T shares, created on first use
+template<typename T>
+inline pool_t* Z_TypePool(size_t count, const char *name)
+{
+	static pool_t* pool = Z_PoolCreate<T>(count, TAG_STATIC, name);
+	return pool;
+}
+
 #ifdef _WIN32
 #define PROT_READ     0x1
 #define PROT_WRITE    0x2
@@ -102,14 +247,14 @@ struct zone_allocator
 
     [[nodiscard]] inline T* allocate(std::size_t n) const {
         T* p = NULL;
-		if ((p = static_cast<T*>(Z_Malloc(n, TAG_STATIC, &p, "zallocator"))) != NULL)
+		if ((p = static_cast<T*>(Z_Malloc(n * sizeof(T), TAG_STATIC, NULL, "zallocator"))) != NULL)
             return p;
 
         throw std::bad_alloc();
     }
 	[[nodiscard]] inline T* allocate(std::size_t& n, std::size_t& alignment, std::size_t& offset) const {
 		T* p = NULL;
-		if ((p = static_cast<T*>(Z_Malloc(n, TAG_STATIC, &p, "zallocator"))) != NULL)
+		if ((p = static_cast<T*>(Z_Malloc(n, TAG_STATIC, NULL, "zallocator"))) != NULL)
 			return p;
 		
 		throw std::bad_alloc();
@@ -119,268 +264,362 @@ struct zone_allocator
 	}
 };
 
-template<typename T>
+#define LIST_POOL_SIZE 512
+
+// hands out single objects from T's type pool, anything bigger goes to the zone
+template<class T>
+struct pool_allocator
+{
+	pool_allocator() noexcept { }
+
+	typedef T value_type;
+	template<class U>
+	constexpr pool_allocator(const pool_allocator<U>&) noexcept { }
+
+	[[nodiscard]] inline T* allocate(std::size_t n) const {
+		void *p;
+		if (n == 1)
+			p = Z_PoolAlloc(Z_TypePool<T>(LIST_POOL_SIZE, "poolalloc"));
+		else
+			p = Z_Malloc(n * sizeof(T), TAG_STATIC, NULL, "poolalloc");
+		if (p == NULL)
+			throw std::bad_alloc();
+		return static_cast<T*>(p);
+	}
+	void deallocate(T* p, std::size_t n) const noexcept {
+		if (n == 1)
+			Z_PoolFree(Z_TypePool<T>(LIST_POOL_SIZE, "poolalloc"), (void *)p);
+		else
+			Z_Free((void *)p);
+	}
+};
+template<class T, class U>
+inline bool operator==(const pool_allocator<T>&, const pool_allocator<U>&) noexcept { return true; }
+template<class T, class U>
+inline bool operator!=(const pool_allocator<T>&, const pool_allocator<U>&) noexcept { return false; }
+
+//
+// linked_list: doubly linked list closed into a ring by a sentinel that lives in the
+// list itself, so the tail, size and end() are all constant time and nothing ever
+// checks for NULL. Nodes never move, an iterator stays good until its own node is erased
+//
+template<typename T, class Allocator = pool_allocator<T>>
 class linked_list
 {
 public:
-	class linked_list_node
+	struct list_link
+	{
+		list_link *next;
+		list_link *prev;
+	};
+	struct linked_list_node : list_link
 	{
-	public:
 		T val;
-		linked_list_node *next;
-		linked_list_node *prev;
+	};
+
+	template<class N, class V>
+	class list_iterator
+	{
+	private:
+		list_link *ptr;
 	public:
-		linked_list_node() = default;
-		linked_list_node(const linked_list_node &) = delete;
-		linked_list_node(linked_list_node &&) = default;
-		~linked_list_node() = default;
-		inline linked_list_node& operator++(int) noexcept
-		{
-			next->next->prev = this;
-			next->prev = prev;
-			next->next = this;
-			prev->next = next;
-			return *this;
-		}
-		inline linked_list_node& operator++() noexcept
-		{
-			next->next->prev = this;
-			next->prev = prev;
-			next->next = this;
-			prev->next = next;
-			return *this;
-		}
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef V value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef V* pointer;
+		typedef V& reference;
+
+		list_iterator(void) noexcept : ptr(NULL) { }
+		list_iterator(const list_link *p) noexcept : ptr(const_cast<list_link *>(p)) { }
+		template<class N2, class V2>
+		list_iterator(const list_iterator<N2, V2>& it) noexcept : ptr(it.link()) { }
+
+		inline list_link* link(void) const noexcept { return ptr; }
+		inline N* operator->(void) const noexcept { return static_cast<N*>(ptr); }
+		inline V& operator*(void) const noexcept { return static_cast<N*>(ptr)->val; }
+		inline operator N*(void) const noexcept { return static_cast<N*>(ptr); }
+		inline list_iterator& operator++(void) noexcept { ptr = ptr->next; return *this; }
+		inline list_iterator& operator--(void) noexcept { ptr = ptr->prev; return *this; }
+		inline list_iterator operator++(int) noexcept { list_iterator it = *this; ptr = ptr->next; return it; }
+		inline list_iterator operator--(int) noexcept { list_iterator it = *this; ptr = ptr->prev; return it; }
+		template<class N2, class V2>
+		inline bool operator==(const list_iterator<N2, V2>& it) const noexcept { return ptr == it.link(); }
+		template<class N2, class V2>
+		inline bool operator!=(const list_iterator<N2, V2>& it) const noexcept { return ptr != it.link(); }
 	};
-	
+
 	typedef linked_list_node* node;
 	typedef linked_list_node list_node;
-	typedef linked_list_node* iterator;
-	typedef const linked_list_node* const_iterator;
+	typedef list_iterator<linked_list_node, T> iterator;
+	typedef list_iterator<const linked_list_node, const T> const_iterator;
 	typedef std::size_t size_type;
 	typedef T value_type;
+	typedef typename std::allocator_traits<Allocator>::template rebind_alloc<linked_list_node> node_allocator;
 private:
-	linked_list<T>::node ptr_list = NULL;
-	std::size_t _size = 0;
-	
-	linked_list<T>::node alloc_node(void) {
-		linked_list<T>::node ptr = (linked_list<T>::node)Z_Malloc(
-			sizeof(linked_list<T>::list_node), TAG_STATIC, &ptr, "listnode");
+	list_link head;
+	std::size_t _size;
+	node_allocator alloc;
+
+	linked_list<T, Allocator>::node alloc_node(void) {
+		linked_list<T, Allocator>::node ptr = std::allocator_traits<node_allocator>::allocate(alloc, 1);
 		if (ptr == NULL)
 			N_Error("linked_list::alloc_node: memory allocation failed");
 		
+		new (&ptr->val) T();
 		return ptr;
 	}
-	void dealloc_node(linked_list<T>::node ptr) noexcept {
-		if (ptr == NULL)
-			return;
-		Z_Free((void *)ptr);
+	void dealloc_node(linked_list<T, Allocator>::node ptr) noexcept {
+		ptr->val.~T();
+		std::allocator_traits<node_allocator>::deallocate(alloc, ptr, 1);
+	}
+	static inline void link_before(list_link *pos, list_link *ptr) noexcept {
+		ptr->next = pos;
+		ptr->prev = pos->prev;
+		pos->prev->next = ptr;
+		pos->prev = ptr;
+	}
+	static inline void unlink(list_link *ptr) noexcept {
+		ptr->prev->next = ptr->next;
+		ptr->next->prev = ptr->prev;
+	}
+	// moves [first, last) in front of pos, both can be in different lists
+	static inline void transfer(list_link *pos, list_link *first, list_link *last) noexcept {
+		list_link *tail = last->prev;
+
+		first->prev->next = last;
+		last->prev = first->prev;
+
+		tail->next = pos;
+		first->prev = pos->prev;
+		pos->prev->next = first;
+		pos->prev = tail;
 	}
 public:
-	linked_list() noexcept = default;
+	linked_list(const Allocator& a = Allocator()) noexcept
+		: _size(0), alloc(a)
+	{
+		head.next = head.prev = &head;
+	}
 	~linked_list() noexcept
 	{
-		if (ptr_list == NULL || begin() == NULL)
-			return;
-
-		for (linked_list<T>::iterator it = begin(); it != end(); it = it->next)
-			dealloc_node(it);
+		clear();
+	}
+	linked_list(linked_list &&list) noexcept
+		: _size(0), alloc(list.alloc)
+	{
+		head.next = head.prev = &head;
+		splice(end(), list);
+	}
+	linked_list(const linked_list &list)
+		: _size(0), alloc(list.alloc)
+	{
+		head.next = head.prev = &head;
+		for (const_iterator it = list.begin(); it != list.end(); ++it)
+			push_back(*it);
+	}
+	linked_list& operator=(linked_list &&list) noexcept
+	{
+		if (this != &list) {
+			clear();
+			splice(end(), list);
+		}
+		return *this;
+	}
+	linked_list& operator=(const linked_list &list)
+	{
+		if (this != &list) {
+			clear();
+			for (const_iterator it = list.begin(); it != list.end(); ++it)
+				push_back(*it);
+		}
+		return *this;
 	}
-	linked_list(linked_list &&) = default;
-	linked_list(const linked_list &) = default;
 	
 	// memory management
 	inline void clear(void) noexcept
 	{
-		if (ptr_list == NULL)
-			return;
-		
-		for (linked_list<T>::iterator it = begin(); it != end(); it = it->next)
-			dealloc_node(it);
+		list_link *it, *next;
+
+		for (it = head.next; it != &head; it = next) {
+			next = it->next;
+			dealloc_node(static_cast<node>(it));
+		}
+		head.next = head.prev = &head;
+		_size = 0;
 	}
-	inline void free_node(linked_list<T>::node ptr) noexcept
+	inline void free_node(linked_list<T, Allocator>::node ptr) noexcept
 	{
 		if (ptr == NULL)
 			return;
 		
-		ptr->prev->next = ptr->next;
-		ptr->next->prev = ptr->prev;
+		unlink(ptr);
 		dealloc_node(ptr);
 		--_size;
 	}
-	inline void pop_back() noexcept
+	// returns the node that followed it
+	inline linked_list<T, Allocator>::iterator erase(linked_list<T, Allocator>::iterator it) noexcept
 	{
-		if (ptr_list == NULL)
-			return;
+		list_link *next;
+
+		if (it.link() == NULL || it.link() == &head)
+			return end();
 		
-		linked_list<T>::node endptr = back_node();
-		endptr->prev->next = NULL;
-		dealloc_node(endptr);
-		--_size;
+		next = it.link()->next;
+		free_node(it);
+		return iterator(next);
 	}
-	inline void erase(linked_list<T>::node ptr) noexcept
+	inline void pop_back() noexcept
 	{
-		if (ptr == NULL || ptr_list == NULL)
-			return;
-		
-		if (ptr == front_node())
-			pop_front();
-		else if (ptr == back_node())
-			pop_back();
-		else
-			free_node(ptr);
+		if (_size)
+			free_node(back_node());
 	}
 	inline void pop_front() noexcept
 	{
-		linked_list<T>::node frontptr = front_node();
-		if (frontptr->next != NULL) {
-			frontptr->next->prev = NULL;
-			frontptr = frontptr->next;
-			ptr_list = frontptr;
-		}
-		dealloc_node(ptr_list);
-		--_size;
+		if (_size)
+			free_node(front_node());
 	}
-	inline linked_list<T>::node push_back(void) noexcept
+	// a new default constructed value in front of pos
+	inline linked_list<T, Allocator>::node insert(linked_list<T, Allocator>::iterator pos)
 	{
-		linked_list<T>::node ptr;
-		if (ptr_list == NULL) {
-			ptr_list = alloc_node();
-			ptr = ptr_list;
-			ptr_list->prev = NULL;
-		}
-		else {
-			ptr = alloc_node();
-			linked_list<T>::node endptr = back_node();
-			endptr->next = ptr;
-			ptr->prev = endptr;
-		}
-		ptr->next = NULL;
+		linked_list<T, Allocator>::node ptr = alloc_node();
+		link_before(pos.link(), ptr);
 		++_size;
 		return ptr;
 	}
-	inline linked_list<T>::node emplace_back(void) noexcept
+	inline linked_list<T, Allocator>::node insert(linked_list<T, Allocator>::iterator pos, const T& val)
+	{
+		linked_list<T, Allocator>::node ptr = insert(pos);
+		ptr->val = val;
+		return ptr;
+	}
+	inline linked_list<T, Allocator>::node push_back(void)
+	{ return insert(end()); }
+	inline linked_list<T, Allocator>::node push_back(const T& val)
+	{ return insert(end(), val); }
+	inline linked_list<T, Allocator>::node push_front(void)
+	{ return insert(begin()); }
+	inline linked_list<T, Allocator>::node push_front(const T& val)
+	{ return insert(begin(), val); }
+	inline linked_list<T, Allocator>::node emplace_back(void)
 	{ return push_back(); }
 	
-	// random algos
-	inline void swap(linked_list& list)
+	// moves all of list in front of pos
+	inline void splice(linked_list<T, Allocator>::iterator pos, linked_list& list) noexcept
 	{
-		if (list.ptr_list == NULL || ptr_list == NULL)
+		if (&list == this || list.empty())
 			return;
+		
+		transfer(pos.link(), list.head.next, &list.head);
+		_size += list._size;
+		list._size = 0;
 	}
-	inline void swap_nodes(linked_list<T>::iterator iter1, linked_list<T>::iterator iter2) noexcept
+	// moves one node of list in front of pos
+	inline void splice(linked_list<T, Allocator>::iterator pos, linked_list& list, linked_list<T, Allocator>::iterator it) noexcept
 	{
-		if (ptr_list == NULL || iter1 == NULL || iter2 == NULL)
+		if (pos == it || pos.link() == it.link()->next)
 			return;
 		
-		if (iter1 == front_node())
-			iter1->next->prev = iter2;
-		else if (iter1 == back_node())
-			iter1->prev->next = iter2;
-		else {
-			iter1->prev->next = iter2;
-			iter1->next->prev = iter2;
+		transfer(pos.link(), it.link(), it.link()->next);
+		--list._size;
+		++_size;
+	}
+	// moves [first, last) of list in front of pos, counting it is the only part that isn't constant
+	inline void splice(linked_list<T, Allocator>::iterator pos, linked_list& list, linked_list<T, Allocator>::iterator first,
+		linked_list<T, Allocator>::iterator last) noexcept
+	{
+		if (first == last)
+			return;
+		
+		if (&list != this) {
+			std::size_t n = std::distance(first, last);
+			list._size -= n;
+			_size += n;
 		}
+		transfer(pos.link(), first.link(), last.link());
+	}
+	
+	// random algos
+	inline void swap(linked_list& list) noexcept
+	{
+		linked_list tmp(std::move(list));
+		list.splice(list.end(), *this);
+		splice(end(), tmp);
+	}
+	inline void swap_nodes(linked_list<T, Allocator>::iterator iter1, linked_list<T, Allocator>::iterator iter2) noexcept
+	{
+		list_link *a = iter1.link(), *b = iter2.link();
+		list_link *apos;
+
+		if (a == b || a == &head || b == &head)
+			return;
 		
-		if (iter2 == front_node())
-			iter2->next->prev = iter1;
-		else if (iter2 == back_node())
-			iter2->prev->next = iter1;
+		if (a->next == b) {
+			unlink(a);
+			link_before(b->next, a);
+		}
+		else if (b->next == a) {
+			unlink(b);
+			link_before(a->next, b);
+		}
 		else {
-			iter2->prev->next = iter1;
-			iter2->next->prev = iter1;
+			apos = a->next;
+			unlink(a);
+			link_before(b, a);
+			unlink(b);
+			link_before(apos, b);
 		}
 	}
-	linked_list<T>::node find_node(linked_list<T>::iterator begin_it, std::size_t n,
+	linked_list<T, Allocator>::iterator find_node(linked_list<T, Allocator>::iterator begin_it, std::size_t n,
 		const T &val) noexcept
 	{
-		if (ptr_list == NULL || begin_it == NULL || n == 0)
-			return NULL;
-		
-		for (linked_list<T>::iterator it = begin_it; --n; it = it->next) {
+		for (linked_list<T, Allocator>::iterator it = begin_it; n && it != end(); --n, ++it) {
 			if (it->val == val) return it;
 		}
-		return ptr_list;
+		return end();
 	}
-	inline void erase_n(linked_list<T>::iterator begin_it, std::size_t n) noexcept
+	inline void erase_n(linked_list<T, Allocator>::iterator begin_it, std::size_t n) noexcept
 	{
-		if (begin_it == NULL || ptr_list == NULL || n == 0)
-			return;
-		
-		for (linked_list<T>::iterator it = begin_it; --n; it = it->next)
-			erase(it);
+		for (linked_list<T, Allocator>::iterator it = begin_it; n && it != end(); --n)
+			it = erase(it);
 	}
-	inline void erase_range(linked_list<T>::iterator begin_it, linked_list<T>::iterator end_it) noexcept
+	inline void erase_range(linked_list<T, Allocator>::iterator begin_it, linked_list<T, Allocator>::iterator end_it) noexcept
 	{
-		if (begin_it == NULL || end_it == NULL || ptr_list == NULL)
-			return;
-		
-		for (linked_list<T>::iterator it = begin_it; it != end_it; it = it->next)
-			erase(it);
+		for (linked_list<T, Allocator>::iterator it = begin_it; it != end_it && it != end(); )
+			it = erase(it);
 	}
 
 	// iterators/access
 	inline T& operator[](std::size_t index) noexcept
 	{
-		if (ptr_list == NULL || index > _size) {
-			LOG_WARN("ptr_list is NULL or index > _size in linked_list::operator[]");
-			return 0;
-		}
+		if (index >= _size)
+			N_Error("linked_list::operator[]: index %lu out of range (size %lu)", index, _size);
 		
-		linked_list<T>::iterator it = begin();
-		while (--index && it != end())
-			it = it->next;
+		linked_list<T, Allocator>::iterator it = begin();
+		while (index--)
+			++it;
 		
 		return it->val;
 	}
 	inline std::size_t size(void) const noexcept
 	{ return _size; }
-	inline linked_list<T>::iterator begin(void) {
-		if (ptr_list == NULL)
-			LOG_WARN("ptr_list is NULL in linked_list::begin");
-		
-		return ptr_list;
-	}
-	inline linked_list<T>::iterator end(void) {
-		if (ptr_list == NULL) {
-			LOG_WARN("ptr_list is NULL in linked_list::end");
-			return NULL;
-		}
-		
-		linked_list<T>::iterator _endptr;
-		for (_endptr = begin();; _endptr = _endptr->next) {
-			if (_endptr == NULL) break;
-		}
-		return _endptr;
-	}
-	inline linked_list<T>::node back_node(void) {
-		if (ptr_list == NULL) {
-			LOG_WARN("ptr_list is NULL in linked_list::back_node");
-			return NULL;
-		}
-		linked_list<T>::node _endptr;
-		for (_endptr = begin();; _endptr = _endptr->next) {
-			if (_endptr->next == NULL) break;
-		}
-		return _endptr;
-	}
-	inline linked_list<T>::node front_node(void) {
-		if (ptr_list == NULL)
-			LOG_WARN("ptr_list is NULL in linked_list::front_node");
-		
-		return ptr_list;
-	}
-	inline T& back(void) noexcept {
-		if (ptr_list == NULL)
-			LOG_WARN("ptr_list is NULL in linked_list::back");
-		
-		return back_node()->val;
-    }
-	inline T& front(void) noexcept {
-		if (ptr_list == NULL)
-			LOG_WARN("ptr_list is NULL in linked_list::front");
-
-		return front_node()->val;
-	}
+	inline bool empty(void) const noexcept
+	{ return _size == 0; }
+	inline linked_list<T, Allocator>::iterator begin(void) noexcept
+	{ return iterator(head.next); }
+	inline linked_list<T, Allocator>::iterator end(void) noexcept
+	{ return iterator(&head); }
+	inline linked_list<T, Allocator>::const_iterator begin(void) const noexcept
+	{ return const_iterator(head.next); }
+	inline linked_list<T, Allocator>::const_iterator end(void) const noexcept
+	{ return const_iterator(&head); }
+	inline linked_list<T, Allocator>::node back_node(void) noexcept
+	{ return _size ? static_cast<node>(head.prev) : NULL; }
+	inline linked_list<T, Allocator>::node front_node(void) noexcept
+	{ return _size ? static_cast<node>(head.next) : NULL; }
+	inline T& back(void) noexcept
+	{ return static_cast<node>(head.prev)->val; }
+	inline T& front(void) noexcept
+	{ return static_cast<node>(head.next)->val; }
 };
 
 #endif
\ No newline at end of file
@@ -14,7 +14,7 @@ constexpr int32_t horz_fov = 88 >> 1;
 
 static void R_InitVK(void)
 {
-    renderer->gpuContext.instance = (VKContext *)Z_Malloc(sizeof(VKContext), TAG_STATIC, &renderer->gpuContext.instance, "VKContext");
+    renderer->gpuContext.instance = (VKContext *)Z_ZoneMalloc(ZONE_RENDERER, sizeof(VKContext), TAG_STATIC, &renderer->gpuContext.instance, "VKContext");
 
     VkApplicationInfo *info = &renderer->gpuContext.instance->appInfo;
     memset(info, 0, sizeof(VkApplicationInfo));
@@ -183,7 +183,7 @@ void R_InitScene();
 
 void R_Init()
 {
-    renderer = (Renderer *)Z_Malloc(sizeof(Renderer), TAG_STATIC, &renderer, "renderer");
+    renderer = (Renderer *)Z_ZoneMalloc(ZONE_RENDERER, sizeof(Renderer), TAG_STATIC, &renderer, "renderer");
     assert(renderer);
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS) < 0) {
         N_Error("R_Init: failed to initialize SDL2, error message: %s",
@@ -211,6 +211,7 @@ void R_ShutDown()
         return;
 
     con.ConPrintf("R_ShutDown: deallocating SDL2 contexts and window");
+    R_FreeBFFTextures();
 
     if (scf::renderer::api == scf::R_OPENGL && renderer->gpuContext.context) {
         SDL_GL_DeleteContext(renderer->gpuContext.context);
@@ -670,4 +671,51 @@ void Renderer::DrawQuad(const glm::vec2& pos, const glm::vec2& size, const glm::
     }
     scene.QuadIndexCount += 6;
 }
-#endif
\ No newline at end of file
+#endif
+
+static Vertex* mobbatch;
+static uint32_t mobbatchverts;
+
+//
+// R_BuildMobBatch: a quad for every mob, lerp of the way from where it was at the last
+// snapshot to where it is now. Only touches the think snapshots and temp memory, so it
+// can go on a job worker, the draw itself stays on the main thread
+//
+void R_BuildMobBatch(float lerp)
+{
+    static const glm::vec2 corners[4] = { {0.5f, 0.5f}, {0.5f, -0.5f}, {-0.5f, -0.5f}, {-0.5f, 0.5f} };
+    static const glm::vec2 texcoords[4] = { {1.0f, 1.0f}, {1.0f, 0.0f}, {0.0f, 0.0f}, {0.0f, 1.0f} };
+    const mobworld_t* cur = M_World(false);
+    const mobworld_t* prev = M_World(true);
+    Vertex* v;
+
+    mobbatchverts = cur->nummobs * 4;
+    if (!mobbatchverts) {
+        mobbatch = NULL;
+        return;
+    }
+    mobbatch = v = (Vertex *)Z_AllocTemp(sizeof(Vertex) * mobbatchverts, "mobbatch");
+
+    for (uint32_t i = 0; i < cur->nummobs; ++i) {
+        const mobsnap_t* m = &cur->mobs[i];
+        glm::vec2 pos(m->mpos.x, m->mpos.y);
+
+        // only the same mob at the same packed index, anything spawned or shuffled since
+        // just pops into place
+        if (i < prev->nummobs && prev->mobs[i].h == m->h)
+            pos = glm::mix(glm::vec2(prev->mobs[i].mpos.x, prev->mobs[i].mpos.y), pos, lerp);
+
+        for (uint32_t c = 0; c < 4; ++c, ++v) {
+            v->pos = glm::vec3(pos + corners[c], 0.0f);
+            v->color = glm::vec4(1.0f);
+            v->texcoords = texcoords[c];
+            v->texindex = (float)m->type;
+        }
+    }
+}
+
+const Vertex* R_MobBatch(uint32_t* numvertices)
+{
+    *numvertices = mobbatchverts;
+    return mobbatch;
+}
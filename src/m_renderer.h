@@ -411,6 +411,10 @@ extern nomadvector<model_t> modelinfo;
 void glDrawBatches(GLenum mode, GLsizei count, const Vertex* vertices);
 void glDrawDuplicate(GLenum mode, GLsizei amount, GLsizei numvertices, const Vertex* vertices);
 
+// built every frame off the mob snapshots, good until the next Z_FlipTemp
+void R_BuildMobBatch(float lerp);
+const Vertex* R_MobBatch(uint32_t* numvertices);
+
 #ifdef _NOMAD_DEBUG
 
 const char *DBG_GL_SourceToStr(GLenum source);
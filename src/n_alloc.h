@@ -0,0 +1,130 @@
+//----------------------------------------------------------
+//
+// Copyright (C) GDR Games 2022-2023
+//
+// This source code is available for distribution and/or
+// modification under the terms of either the Apache License
+// v2.0 as published by the Apache Software Foundation, or
+// the GNU General Public License v2.0 as published by the
+// Free Software Foundation.
+//
+// This source is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY. If you are using this code for personal,
+// non-commercial/monetary gain, you may use either of the
+// licenses permitted, otherwise, you must use the GNU GPL v2.0.
+//
+// DESCRIPTION: src/n_alloc.h
+//  header for the hunk (z_hunk.cpp) and the cache between its marks (z_cache.cpp)
+//----------------------------------------------------------
+#ifndef _N_ALLOC_
+#define _N_ALLOC_
+
+#pragma once
+
+//
+// the hunk is one block out of the main zone (Memory_Init), handed out from both ends with
+// marks. Whatever's left between the two marks is the cache, entries there get moved or
+// thrown out as the hunk grows into them. None of it is locked, main thread only, the
+// cache's prefetch loaders are the only thing that runs anywhere else
+//
+
+extern byte* hunk_base;
+extern size_t hunk_size;
+extern size_t hunk_low_used;
+extern size_t hunk_high_used;
+
+void Memory_Init(void);
+void Memory_Shutdown(void);
+
+void Hunk_Check(void);
+void Hunk_Print(bool all);
+void *Hunk_Alloc(size_t size);
+void *Hunk_AllocName(size_t size, const char* name);
+void *Hunk_HighAllocName(size_t size, const char* name);
+void *Hunk_TempAlloc(size_t size);
+int Hunk_LowMark(void);
+void Hunk_FreeToLowMark(size_t mark);
+int Hunk_HighMark(void);
+void Hunk_FreeToHighMark(size_t mark);
+
+//
+// HunkScope: takes a mark on construction and frees back to it when it goes out of
+// scope, so a load can be thrown out in one go. Scopes nest but have to unwind in
+// order on each end of the hunk, debug builds check that. Pass clear to zero the
+// released memory in release builds too
+//
+class HunkScope
+{
+private:
+	const char *name;
+	size_t mark;
+	int depth;
+	bool high;
+	bool clear;
+	bool released;
+public:
+	HunkScope(const char *_name, bool _high = false, bool _clear = false);
+	~HunkScope();
+
+	void release(void);
+
+	HunkScope(const HunkScope &) = delete;
+	HunkScope &operator=(const HunkScope &) = delete;
+};
+
+// data is NULL while it isn't cached, the cache writes through it when an entry moves
+typedef struct
+{
+	void *data;
+} cache_user_t;
+
+typedef enum
+{
+	CACHE_LRU,		// least recently used goes first
+	CACHE_GDSF,		// greedy dual size frequency, hits * cost / size
+	CACHE_ARC,		// adaptive split between seen once and seen again
+
+	NUMCACHEPOLICIES
+} cachepolicy_t;
+
+typedef struct
+{
+	uint64_t	hits;
+	uint64_t	misses;
+	uint64_t	evictions;
+	uint64_t	bytesloaded;
+	uint64_t	bytesevicted;
+	uint64_t	prefetches;
+} cachestats_t;
+
+// fills a prefetched entry on the i/o thread, returns false if the load failed
+typedef bool (*cacheloader_t)(void *data, size_t size, void *arg);
+
+void Cache_Init(void);
+void Cache_Shutdown(void);
+void Cache_Flush(void);
+void Cache_FreeLow(size_t new_low_hunk);
+void Cache_FreeHigh(size_t new_high_hunk);
+
+// what Cache_Check and Cache_Alloc hand back is only good until the next Cache_Alloc
+// or hunk allocation, either one can move or evict it
+void *Cache_Check(cache_user_t *c);
+void *Cache_Alloc(cache_user_t *c, size_t size, const char* name);
+void *Cache_Realloc(cache_user_t *c, size_t nsize, const char* name);
+void *Cache_Calloc(cache_user_t *c, size_t elemsize, size_t nelem, const char* name);
+void Cache_Free(cache_user_t *c);
+void Cache_Compact(void);
+
+void Cache_SetCost(cache_user_t *c, float cost);
+void Cache_SetPolicy(cachepolicy_t policy);
+cachepolicy_t Cache_GetPolicy(void);
+cachepolicy_t Cache_PolicyForName(const char *name);
+void Cache_GetStats(cachepolicy_t policy, cachestats_t *stats);
+void Cache_Print(void);
+void Cache_Report(void);
+
+void Cache_Prefetch(cache_user_t *c, size_t size, cacheloader_t loader, void *arg, int priority, const char *name);
+void Cache_UpdatePrefetch(void);
+void Cache_Wait(cache_user_t *c);
+
+#endif
@@ -0,0 +1,428 @@
+#include "n_shared.h"
+#include "g_game.h"
+
+typedef struct alignas(64)
+{
+    mutex lock;
+    job_t jobs[JOB_QUEUESIZE];
+    uint32_t head;          // oldest job, where thieves take from
+    uint32_t tail;          // one past the newest, where the owner pushes and pops
+} jobqueue_t;
+
+typedef struct
+{
+    const char *name;
+    uint64_t runs;
+    uint64_t total;         // nanoseconds
+    uint64_t max;
+} jobstat_t;
+
+// every worker keeps its own so timing a job never touches anything shared
+typedef struct alignas(64)
+{
+    jobstat_t stats[MAX_JOB_STATS];
+    uint32_t numstats;
+} jobprofile_t;
+
+static jobqueue_t queues[MAX_JOB_WORKERS];
+static jobprofile_t profiles[MAX_JOB_WORKERS];
+static thread workers[MAX_JOB_WORKERS];
+static uint32_t numworkers;
+
+// -1 for anything that isn't one of ours (the main thread's set to 0 in N_InitJobs)
+static thread_local int32_t jobworker = -1;
+
+// workers with nothing to do sleep on jobwake, queued and sleepers are both seq_cst so a
+// push either sees somebody asleep or the sleeper sees the push
+static std::atomic<uint32_t> queued;
+static std::atomic<uint32_t> sleepers;
+static mutex sleeplock;
+static std::condition_variable_any jobwake;
+static bool jobquit;
+
+static void N_RecordJob(const char *name, uint64_t time)
+{
+    jobprofile_t* profile;
+    jobstat_t* stat;
+    uint32_t i;
+
+    // only the workers get timed, anybody else would be racing one of them for its table
+    if (jobworker < 0)
+        return;
+
+    profile = &profiles[jobworker];
+    for (i = 0; i < profile->numstats; ++i) {
+        if (profile->stats[i].name == name)
+            break;
+    }
+    if (i == MAX_JOB_STATS)
+        return;
+
+    stat = &profile->stats[i];
+    if (i == profile->numstats) {
+        memset(stat, 0, sizeof(*stat));
+        stat->name = name;
+        ++profile->numstats;
+    }
+    ++stat->runs;
+    stat->total += time;
+    if (time > stat->max)
+        stat->max = time;
+}
+
+static inline uint64_t N_JobClock(void)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// jobs without a name time themselves
+static void N_ExecuteJob(const job_t* job)
+{
+    if (job->name) {
+        const uint64_t start = N_JobClock();
+        job->func(job->arg);
+        N_RecordJob(job->name, N_JobClock() - start);
+    }
+    else
+        job->func(job->arg);
+
+    if (job->counter)
+        job->counter->fetch_sub(1, std::memory_order_acq_rel);
+}
+
+static bool N_PopJob(uint32_t id, job_t* job)
+{
+    jobqueue_t* q = &queues[id];
+    std::lock_guard<mutex> lock(q->lock);
+
+    if (q->head == q->tail)
+        return false;
+    *job = q->jobs[--q->tail % JOB_QUEUESIZE];
+    --queued;
+    return true;
+}
+
+static bool N_StealJob(uint32_t id, job_t* job)
+{
+    jobqueue_t* q = &queues[id];
+    std::lock_guard<mutex> lock(q->lock);
+
+    if (q->head == q->tail)
+        return false;
+    *job = q->jobs[q->head++ % JOB_QUEUESIZE];
+    --queued;
+    return true;
+}
+
+// own queue first, newest first since that's what's still in cache, then the oldest job off
+// everybody else's
+static bool N_FindJob(uint32_t id, job_t* job)
+{
+    if (N_PopJob(id, job))
+        return true;
+    for (uint32_t i = 1; i < numworkers; ++i) {
+        if (N_StealJob((id + i) % numworkers, job))
+            return true;
+    }
+    return false;
+}
+
+static void *N_JobThread(void *arg)
+{
+    const uint32_t id = (uint32_t)(uintptr_t)arg;
+    job_t job;
+
+    jobworker = id;
+    for (;;) {
+        if (N_FindJob(id, &job)) {
+            N_ExecuteJob(&job);
+            continue;
+        }
+
+        std::unique_lock<mutex> lock(sleeplock);
+        ++sleepers;
+        jobwake.wait(lock, [] { return jobquit || queued.load() != 0; });
+        --sleepers;
+        if (jobquit)
+            break;
+    }
+    return NULL;
+}
+
+void N_InitJobs(uint32_t count)
+{
+    N_ShutdownJobs();
+
+    if (!count)
+        count = std::thread::hardware_concurrency();
+    if (count < 1)
+        count = 1;
+    if (count > MAX_JOB_WORKERS)
+        count = MAX_JOB_WORKERS;
+
+    numworkers = count;
+    jobworker = 0;
+    for (uint32_t i = 0; i < numworkers; ++i)
+        queues[i].head = queues[i].tail = 0;
+    queued = 0;
+    N_ClearJobStats();
+
+    LOG_INFO("N_InitJobs: starting {} job workers", numworkers - 1);
+    for (uint32_t i = 1; i < numworkers; ++i)
+        workers[i].create(N_JobThread, (void *)(uintptr_t)i);
+}
+
+void N_ShutdownJobs(void)
+{
+    if (!numworkers)
+        return;
+
+    {
+        std::lock_guard<mutex> lock(sleeplock);
+        jobquit = true;
+    }
+    jobwake.notify_all();
+    for (uint32_t i = 1; i < numworkers; ++i)
+        workers[i].join();
+    numworkers = 0;
+    jobquit = false;
+}
+
+uint32_t N_NumJobWorkers(void)
+{
+    return numworkers ? numworkers : 1;
+}
+
+uint32_t N_JobWorker(void)
+{
+    return jobworker < 0 ? 0 : (uint32_t)jobworker;
+}
+
+static void N_PushJob(const job_t* job)
+{
+    // anybody that isn't a worker hands theirs to the main thread's queue
+    jobqueue_t* q = &queues[jobworker < 0 ? 0 : jobworker];
+
+    {
+        std::lock_guard<mutex> lock(q->lock);
+        if (q->tail - q->head < JOB_QUEUESIZE) {
+            q->jobs[q->tail++ % JOB_QUEUESIZE] = *job;
+            ++queued;
+            job = NULL;
+        }
+    }
+    // full up, better to run it here than to wait on somebody else to make room
+    if (job)
+        N_ExecuteJob(job);
+}
+
+static void N_WakeWorkers(uint32_t count)
+{
+    if (!sleepers.load())
+        return;
+
+    {
+        std::lock_guard<mutex> lock(sleeplock);
+    }
+    if (count > 1)
+        jobwake.notify_all();
+    else
+        jobwake.notify_one();
+}
+
+void N_RunJob(jobfunc_t func, void *arg, const char *name, jobcounter_t* counter)
+{
+    job_t job;
+
+    job.func = func;
+    job.arg = arg;
+    job.name = name;
+    job.counter = counter;
+    N_RunJobs(&job, 1, counter);
+}
+
+void N_RunJobs(const job_t* jobs, uint32_t count, jobcounter_t* counter)
+{
+    uint32_t i;
+
+    if (!count)
+        return;
+    if (counter)
+        counter->fetch_add(count, std::memory_order_relaxed);
+
+    // without any workers there's nobody to hand them to
+    if (numworkers <= 1) {
+        for (i = 0; i < count; ++i) {
+            job_t job = jobs[i];
+            job.counter = counter;
+            N_ExecuteJob(&job);
+        }
+        return;
+    }
+
+    for (i = 0; i < count; ++i) {
+        job_t job = jobs[i];
+        job.counter = counter;
+        N_PushJob(&job);
+    }
+    N_WakeWorkers(count);
+}
+
+// runs one job if there's one to be had
+static bool N_HelpJobs(void)
+{
+    job_t job;
+
+    if (jobworker < 0 || !N_FindJob(jobworker, &job))
+        return false;
+    N_ExecuteJob(&job);
+    return true;
+}
+
+void N_WaitJobs(jobcounter_t* counter)
+{
+    while (counter->load(std::memory_order_acquire) != 0) {
+        if (!N_HelpJobs())
+            std::this_thread::yield();
+    }
+}
+
+void N_ClearJobStats(void)
+{
+    for (uint32_t i = 0; i < MAX_JOB_WORKERS; ++i)
+        profiles[i].numstats = 0;
+}
+
+// wall time, so a job that waits on others counts whatever it ran while it was waiting
+void N_PrintJobStats(void)
+{
+    jobstat_t stats[MAX_JOB_STATS];
+    uint32_t numstats, i, j, k;
+
+    numstats = 0;
+    for (i = 0; i < N_NumJobWorkers(); ++i) {
+        for (j = 0; j < profiles[i].numstats; ++j) {
+            const jobstat_t* s = &profiles[i].stats[j];
+            for (k = 0; k < numstats; ++k) {
+                if (stats[k].name == s->name)
+                    break;
+            }
+            if (k == numstats) {
+                if (numstats == MAX_JOB_STATS)
+                    continue;
+                memset(&stats[numstats++], 0, sizeof(jobstat_t));
+                stats[k].name = s->name;
+            }
+            stats[k].runs += s->runs;
+            stats[k].total += s->total;
+            if (s->max > stats[k].max)
+                stats[k].max = s->max;
+        }
+    }
+
+    LOG_TRACE("job timings over {} workers:", N_NumJobWorkers());
+    for (i = 0; i < numstats; ++i) {
+        LOG_TRACE("  {:<16} runs: {:>8} avg: {:>10.2f}us max: {:>10.2f}us", stats[i].name, stats[i].runs,
+            stats[i].total / 1000.0 / stats[i].runs, stats[i].max / 1000.0);
+    }
+}
+
+void JobGraph::Init(void)
+{
+    numnodes = 0;
+    nummainready = 0;
+    remaining = 0;
+}
+
+jobnode_t* JobGraph::Add(const char *name, jobfunc_t func, void *arg, bool mainthread)
+{
+    jobnode_t* node;
+
+    if (numnodes >= MAX_GRAPH_NODES)
+        N_Error("JobGraph::Add: more than %i nodes", MAX_GRAPH_NODES);
+
+    node = &nodes[numnodes++];
+    node->name = name;
+    node->func = func;
+    node->arg = arg;
+    node->mainthread = mainthread;
+    node->graph = this;
+    node->numdeps = 0;
+    node->numsuccessors = 0;
+    node->pending = 0;
+    return node;
+}
+
+void JobGraph::Depend(jobnode_t* node, jobnode_t* dep)
+{
+    if (dep->numsuccessors >= MAX_NODE_SUCCESSORS)
+        N_Error("JobGraph::Depend: more than %i nodes depend on %s", MAX_NODE_SUCCESSORS, dep->name);
+    dep->successors[dep->numsuccessors++] = node;
+    ++node->numdeps;
+}
+
+void JobGraph::Schedule(jobnode_t* node)
+{
+    if (node->mainthread) {
+        std::lock_guard<mutex> lock(mainlock);
+        mainready[nummainready++] = node;
+        return;
+    }
+    N_RunJob(RunNode, node, NULL, NULL);
+}
+
+// the timing stops before the successors get scheduled, with only the one worker they'd
+// run right here and end up counted as this node's
+void JobGraph::RunNode(void *arg)
+{
+    jobnode_t* node = (jobnode_t *)arg;
+    JobGraph* graph = node->graph;
+    const uint64_t start = N_JobClock();
+
+    node->func(node->arg);
+    N_RecordJob(node->name, N_JobClock() - start);
+
+    for (uint32_t i = 0; i < node->numsuccessors; ++i) {
+        jobnode_t* next = node->successors[i];
+        if (next->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            graph->Schedule(next);
+    }
+    graph->remaining.fetch_sub(1, std::memory_order_release);
+}
+
+bool JobGraph::RunMainThread(void)
+{
+    jobnode_t* node;
+
+    {
+        std::lock_guard<mutex> lock(mainlock);
+        if (!nummainready)
+            return false;
+        node = mainready[--nummainready];
+    }
+    RunNode(node);
+    return true;
+}
+
+void JobGraph::Run(void)
+{
+    uint32_t i;
+
+    if (!numnodes)
+        return;
+
+    remaining.store(numnodes, std::memory_order_relaxed);
+    for (i = 0; i < numnodes; ++i)
+        nodes[i].pending.store(nodes[i].numdeps, std::memory_order_relaxed);
+    for (i = 0; i < numnodes; ++i) {
+        if (!nodes[i].numdeps)
+            Schedule(&nodes[i]);
+    }
+
+    while (remaining.load(std::memory_order_acquire) != 0) {
+        if (RunMainThread())
+            continue;
+        if (!N_HelpJobs())
+            std::this_thread::yield();
+    }
+}
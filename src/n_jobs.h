@@ -0,0 +1,95 @@
+#ifndef _N_JOBS_
+#define _N_JOBS_
+
+#pragma once
+
+//
+// a fixed pool of worker threads, each with its own deque of jobs. A worker pushes and pops
+// at the back of its own and steals off the front of somebody else's when it runs dry. The
+// main thread is worker 0, it doesn't run anything until it waits on something
+//
+
+#define MAX_JOB_WORKERS     16
+#define JOB_QUEUESIZE       1024    // per worker, a push onto a full one just runs the job
+#define MAX_JOB_STATS       64      // distinct job names the profiler keeps track of
+
+typedef void (*jobfunc_t)(void *arg);
+
+// how many jobs are still out, N_WaitJobs until it hits zero
+typedef std::atomic<uint32_t> jobcounter_t;
+
+typedef struct
+{
+    jobfunc_t func;
+    void *arg;
+    const char *name;       // the profiler goes by the pointer, so keep these literals. NULL isn't timed
+    jobcounter_t* counter;
+} job_t;
+
+// 0 for as many workers as there are cores
+void N_InitJobs(uint32_t numworkers);
+void N_ShutdownJobs(void);
+// counting the main thread
+uint32_t N_NumJobWorkers(void);
+// which worker the caller is, in [0, N_NumJobWorkers())
+uint32_t N_JobWorker(void);
+
+void N_RunJob(jobfunc_t func, void *arg, const char *name, jobcounter_t* counter);
+void N_RunJobs(const job_t* jobs, uint32_t count, jobcounter_t* counter);
+// runs other jobs while it waits, so it's fine to call from inside a job
+void N_WaitJobs(jobcounter_t* counter);
+
+// not thread safe, only call these when nothing's running
+void N_PrintJobStats(void);
+void N_ClearJobStats(void);
+
+//
+// a set of jobs and what has to finish before each of them can start, run through the
+// workers in one go every frame. Nodes marked mainthread (SDL, GL) only ever run on the
+// thread that called Run
+//
+
+#define MAX_GRAPH_NODES     32
+#define MAX_NODE_SUCCESSORS 8
+
+class JobGraph;
+
+typedef struct jobnode_s
+{
+    const char *name;
+    jobfunc_t func;
+    void *arg;
+    bool mainthread;
+    JobGraph* graph;
+    uint32_t numdeps;
+    uint32_t numsuccessors;
+    struct jobnode_s* successors[MAX_NODE_SUCCESSORS];
+    std::atomic<uint32_t> pending;  // dependencies that haven't finished yet this run
+} jobnode_t;
+
+class JobGraph
+{
+private:
+    jobnode_t nodes[MAX_GRAPH_NODES];
+    uint32_t numnodes;
+    std::atomic<uint32_t> remaining;
+
+    // the mainthread nodes that are ready, waiting on Run to pick them up
+    mutex mainlock;
+    jobnode_t* mainready[MAX_GRAPH_NODES];
+    uint32_t nummainready;
+
+    void Schedule(jobnode_t* node);
+    bool RunMainThread(void);
+    static void RunNode(void *arg);
+public:
+    void Init(void);
+    jobnode_t* Add(const char *name, jobfunc_t func, void *arg, bool mainthread = false);
+    // node doesn't start until dep is done
+    void Depend(jobnode_t* node, jobnode_t* dep);
+    // blocks until every node's run, the calling thread helps out
+    void Run(void);
+    inline uint32_t NumNodes(void) const { return numnodes; }
+};
+
+#endif
@@ -27,8 +27,13 @@
 #include <iostream>
 #include <fstream>
 #include <memory>
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <stdlib.h>
 #include <sstream>
 #include <stdio.h>
@@ -37,8 +42,15 @@
 #include <string>
 #include <string.h>
 #include <vector>
+#include <map>
+#include <deque>
+#include <queue>
+#include <set>
+#include <unordered_map>
 #include <algorithm>
 #include <utility>
+#include <tuple>
+#include <type_traits>
 
 /*** deps ***/
 // random
@@ -95,7 +107,9 @@
 
 // bff stuff
 //#include <zlib.h>
-//#include <zstd/zstd.h>
+#include <zstd.h>
+#include <lz4.h>
+#include <lz4hc.h>
 //#include <zip.h>
 #ifdef __unix__
 #include <dirent.h>
@@ -20,6 +20,7 @@ namespace scf {
         bool native_fullscreen = false;
 //        float ratio = width / height;
         uint16_t ticrate = 35;
+        uint16_t fpscap = 60;
         uint8_t vert_fov = 44;
         uint8_t horz_fov = 88;
 #ifdef _NOMAD_DEBUG
@@ -33,6 +34,21 @@ namespace scf {
 		int32_t max_draw_buffers = 0;
 	};
     };
+    namespace memory {
+        uint32_t zone_size = 900;
+        uint32_t hugepages = ZONE_HUGEPAGES_TRANSPARENT;
+        uint32_t renderer_zone = 64;
+        uint32_t audio_zone = 64;
+        uint32_t level_zone = 128;
+        uint32_t scratch_zone = 16;
+        uint32_t temp_size = 4;
+        uint32_t level_sectors = 16;
+
+        bool renderer_purge = true;
+        bool audio_purge = true;
+        bool level_purge = false;
+        bool scratch_purge = false;
+    };
     namespace launch {
         bool fastmobs1 = false;
 		bool fastmobs2 = false;
@@ -86,6 +102,29 @@ void G_LoadSCF()
             scf::launch::bottomless_clip = data["launch"].contains("bottomless_clip") ? static_cast<bool>(data["launch"]["bottomless_clip"]) : false;
             scf::launch::devmode = data["launch"].contains("devmode") ? static_cast<bool>(data["launch"]["devmode"]) : false;
         }
+        // zone budgets
+        if (data.contains("memory")) {
+            scf::memory::zone_size = data["memory"].contains("zone_size") ? static_cast<uint32_t>(data["memory"]["zone_size"]) : scf::memory::zone_size;
+            scf::memory::hugepages = data["memory"].contains("hugepages") ? static_cast<uint32_t>(data["memory"]["hugepages"]) : scf::memory::hugepages;
+            if (data["memory"].contains("renderer")) {
+                scf::memory::renderer_zone = data["memory"]["renderer"].contains("size") ? static_cast<uint32_t>(data["memory"]["renderer"]["size"]) : scf::memory::renderer_zone;
+                scf::memory::renderer_purge = data["memory"]["renderer"].contains("purge") ? static_cast<bool>(data["memory"]["renderer"]["purge"]) : scf::memory::renderer_purge;
+            }
+            if (data["memory"].contains("audio")) {
+                scf::memory::audio_zone = data["memory"]["audio"].contains("size") ? static_cast<uint32_t>(data["memory"]["audio"]["size"]) : scf::memory::audio_zone;
+                scf::memory::audio_purge = data["memory"]["audio"].contains("purge") ? static_cast<bool>(data["memory"]["audio"]["purge"]) : scf::memory::audio_purge;
+            }
+            if (data["memory"].contains("level")) {
+                scf::memory::level_zone = data["memory"]["level"].contains("size") ? static_cast<uint32_t>(data["memory"]["level"]["size"]) : scf::memory::level_zone;
+                scf::memory::level_purge = data["memory"]["level"].contains("purge") ? static_cast<bool>(data["memory"]["level"]["purge"]) : scf::memory::level_purge;
+                scf::memory::level_sectors = data["memory"]["level"].contains("sectors") ? static_cast<uint32_t>(data["memory"]["level"]["sectors"]) : scf::memory::level_sectors;
+            }
+            if (data["memory"].contains("scratch")) {
+                scf::memory::scratch_zone = data["memory"]["scratch"].contains("size") ? static_cast<uint32_t>(data["memory"]["scratch"]["size"]) : scf::memory::scratch_zone;
+                scf::memory::scratch_purge = data["memory"]["scratch"].contains("purge") ? static_cast<bool>(data["memory"]["scratch"]["purge"]) : scf::memory::scratch_purge;
+            }
+            scf::memory::temp_size = data["memory"].contains("temp") ? static_cast<uint32_t>(data["memory"]["temp"]) : scf::memory::temp_size;
+        }
         // renderering stuff
         const std::string api = data["renderer"]["api"];
         if (api == "R_SDL2")
@@ -99,6 +138,7 @@ void G_LoadSCF()
 
         scf::renderer::drawfps = static_cast<bool>(data["renderer"]["drawfps"]);
         scf::renderer::ticrate = static_cast<uint16_t>(data["renderer"]["ticrate"]);
+        scf::renderer::fpscap = data["renderer"].contains("fpscap") ? static_cast<uint16_t>(data["renderer"]["fpscap"]) : scf::renderer::fpscap;
         scf::renderer::fullscreen = static_cast<bool>(data["renderer"]["fullscreen"]);
         scf::renderer::native_fullscreen = static_cast<bool>(data["renderer"]["native_fullscreen"]);
         scf::renderer::hidden = static_cast<bool>(data["renderer"]["window_hidden"]);
@@ -124,10 +164,20 @@ void G_LoadSCF()
             "    launch::infinite_ammo      = {}\n"
             "    launch::bottomless_clip    = {}\n"
             "    launch::devmode            = {}\n"
+            "  memory::\n"
+            "    memory::zone_size          = {} MiB\n"
+            "    memory::hugepages          = {}\n"
+            "    memory::renderer_zone      = {} MiB (purge: {})\n"
+            "    memory::audio_zone         = {} MiB (purge: {})\n"
+            "    memory::level_zone         = {} MiB (purge: {})\n"
+            "    memory::scratch_zone       = {} MiB (purge: {})\n"
+            "    memory::temp_size          = {} MiB x2\n"
+            "    memory::level_sectors      = {}\n"
             "  renderer::\n"
             "    renderer::api              = {}\n"
             "    renderer::drawfps          = {}\n"
             "    renderer::ticrate          = {}\n"
+            "    renderer::fpscap           = {}\n"
             "    renderer::fullscreen       = {}\n"
             "    renderer::native_fullscreen= {}\n"
             "    renderer::hidden           = {}\n"
@@ -142,7 +192,11 @@ void G_LoadSCF()
         scf::launch::blindmobs, scf::launch::nosmell, scf::launch::nomobs,
         scf::launch::godmode, scf::launch::infinite_ammo, scf::launch::bottomless_clip,
         scf::launch::devmode,
-        scf::renderer::api, scf::renderer::drawfps, scf::renderer::ticrate,
+        scf::memory::zone_size, scf::memory::hugepages,
+        scf::memory::renderer_zone, scf::memory::renderer_purge, scf::memory::audio_zone, scf::memory::audio_purge,
+        scf::memory::level_zone, scf::memory::level_purge, scf::memory::scratch_zone, scf::memory::scratch_purge,
+        scf::memory::temp_size, scf::memory::level_sectors,
+        scf::renderer::api, scf::renderer::drawfps, scf::renderer::ticrate, scf::renderer::fpscap,
         scf::renderer::fullscreen, scf::renderer::native_fullscreen, scf::renderer::hidden,
         scf::renderer::vsync,
         scf::audio::music_vol, scf::audio::sfx_vol, scf::audio::music_on, scf::audio::sfx_on);
@@ -56,13 +56,16 @@ namespace scf {
         extern bool native_fullscreen;
         extern msaa_amount_t msaa;
         extern bool drawfps;
-        extern uint16_t ticrate;
+        extern uint16_t ticrate;    // sim tics a second
+        extern uint16_t fpscap;     // 0 leaves frames to vsync or uncapped
         extern uint8_t vert_fov;
         extern uint8_t horz_fov;
         
         // min-max tic caps
         constexpr uint16_t ticrate_max = 60;
         constexpr uint16_t ticrate_min = 14;
+        constexpr uint16_t fpscap_min = 0;
+        constexpr uint16_t fpscap_max = 240;
         constexpr uint8_t max_vert_fov = 100;
         constexpr uint8_t max_horz_fov = 250;
 	namespace limits { // graphics driver limitations, read-only unless setting them at initialization
@@ -71,6 +74,22 @@ namespace scf {
 		extern int32_t max_draw_buffers;
 	};
     };
+    namespace memory { // zone budgets in MiB, a zone with a budget of 0 shares the main zone
+        extern uint32_t zone_size; // the whole arena, -ram overrides it
+        extern uint32_t hugepages; // ZONE_HUGEPAGES_*
+        extern uint32_t renderer_zone;
+        extern uint32_t audio_zone;
+        extern uint32_t level_zone;
+        extern uint32_t scratch_zone;
+        extern uint32_t temp_size; // each of the two per-frame temp buffers
+        extern uint32_t level_sectors; // level sectors kept resident, the rest are paged back in as they're needed
+        
+        // whether a zone throws out its own cache when it runs dry instead of failing
+        extern bool renderer_purge;
+        extern bool audio_purge;
+        extern bool level_purge;
+        extern bool scratch_purge;
+    };
     namespace launch {
         extern bool fastmobs1;
 		extern bool fastmobs2;
@@ -34,11 +34,14 @@
 template<class T, typename... Args>
 inline T* Construct(const char* name, Args&&... args)
 {
-	T *ptr = (T *)Z_Malloc(sizeof(T), 1, &ptr, name);
+	// no user, the zone writes through it on free and ptr is gone by then
+	T *ptr = (T *)Z_Malloc(sizeof(T), 1, NULL, name);
 	new (ptr) T(std::forward<Args>(args)...);
 	return ptr;
 }
-#define CONSTRUCT(class,name,...) ({class* ptr=(class*)Z_Malloc(sizeof(class),TAG_STATIC,&ptr,name);new (ptr) class(__VA_ARGS__);ptr;})
+#define CONSTRUCT(class,name,...) ({class* ptr=(class*)Z_Malloc(sizeof(class),TAG_STATIC,NULL,name);new (ptr) class(__VA_ARGS__);ptr;})
+// CONSTRUCT out of one of the named zones (ZONE_RENDERER and friends)
+#define ZONE_CONSTRUCT(zone,class,name,...) ({class* ptr=(class*)Z_ZoneMalloc(zone,sizeof(class),TAG_STATIC,NULL,name);new (ptr) class(__VA_ARGS__);ptr;})
 
 #define NOMAD_VERSION _NOMAD_VERSION
 #define NOMAD_VERSION_UPDATE _NOMAD_VERSION_UPDATE
@@ -378,38 +381,36 @@ constexpr const char* credits_str =
 "A Few of the Guns: Ben Pavlovic\n"
 "\n";
 
+// plain pthread wrappers, lock/unlock/try_lock so they go with std::lock_guard and
+// std::condition_variable_any
 class mutex
 {
 private:
 	pthread_mutex_t id;
-	bool is_locked;
 public:
 	inline mutex()
-		: is_locked(false)
 	{
 		pthread_mutex_init(&id, NULL);
 	}
 	mutex(const mutex &) = delete;
-	inline mutex(mutex &&) = default;
+	// a pthread mutex can't be moved once it's been used
+	mutex(mutex &&) = delete;
 	inline ~mutex()
 	{
 		pthread_mutex_destroy(&id);
 	}
-	void lock()
+	inline void lock()
 	{
-		if (is_locked)
-			return;
-		
-		pthread_mutex_trylock(&id);
-		is_locked = true;
+		if (pthread_mutex_lock(&id) != 0)
+			N_Error("mutex::lock: pthread_mutex_lock failed");
 	}
-	void unlock()
+	inline bool try_lock()
+	{
+		return pthread_mutex_trylock(&id) == 0;
+	}
+	inline void unlock()
 	{
-		if (!is_locked)
-			return;
-		
 		pthread_mutex_unlock(&id);
-		is_locked = false;
 	}
 };
 
@@ -422,36 +423,63 @@ private:
 	bool working;
 public:
 	inline thread(void *(*_work)(void *), void *_args, bool launch = false)
-		: work(_work), args(_args)
+		: work(_work), args(_args), working(false)
 	{
 		assert(_work);
-		create(_args);
+		if (launch)
+			create();
+	}
+	inline thread()
+		: work(NULL), args(NULL), working(false)
+	{
 	}
-	inline thread() = default;
 	inline ~thread()
 	{
 		if (working)
 			join();
 	}
-	void create(void *_args = NULL)
+	void create(void)
 	{
 		if (working)
 			return;
 		
-		pthread_create(&id, NULL, work, _args);
-		LOG_INFO("launching new thread with id {}", id);
+		assert(work);
+		if (pthread_create(&id, NULL, work, args) != 0)
+			N_Error("thread::create: pthread_create failed");
+		LOG_INFO("launching new thread with id {}", (uint64_t)id);
 		working = true;
 	}
-	void join(void *_args = NULL)
+	void create(void *(*_work)(void *), void *_args)
 	{
-		if (!working)
+		if (working)
 			return;
 		
-		LOG_INFO("joining worker thread with id {} back to calling thread of id {}", id, pthread_self());
-		pthread_join(id, &_args);
+		work = _work;
+		args = _args;
+		create();
+	}
+	// returns whatever the thread's function did
+	void *join(void)
+	{
+		void *ret = NULL;
+		if (!working)
+			return NULL;
+		
+		LOG_INFO("joining worker thread with id {} back to calling thread of id {}", (uint64_t)id, (uint64_t)pthread_self());
+		pthread_join(id, &ret);
+		working = false;
+		return ret;
+	}
+	inline bool joinable() const
+	{
+		return working;
 	}
 	thread(const thread &) = delete;
-	inline thread(thread &&) = default;
+	inline thread(thread &&t)
+		: id(t.id), work(t.work), args(t.args), working(t.working)
+	{
+		t.working = false;
+	}
 };
 
 class Profiler
@@ -672,6 +700,7 @@ void N_strcat (char *dest, char *src);
 int N_strcmp (const char *str1, const char *str2);
 int N_strncmp (const char *str1, const char *str2, size_t count);
 int N_strncasecmp (const char *str1, const char *str2, size_t n);
+int N_strcasecmp (const char *s1, const char *s2);
 int N_atoi (const char *s);
 float N_atof(const char *s);
 bool N_strnbcmp(const char* str1, const char* str2, size_t n);
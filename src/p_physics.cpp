@@ -0,0 +1,10 @@
+#include "n_shared.h"
+#include "g_game.h"
+
+//
+// P_RunPhysics: the tic's movement pass, after the thinkers have had their say
+//
+void P_RunPhysics(void)
+{
+    Game::Get()->entities.Move();
+}
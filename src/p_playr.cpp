@@ -3,22 +3,22 @@
 
 void P_MoveN()
 {
-    --Game::GetPlayr()->p->pos.coords.y;
+    --Game::Get()->entities.Coords(Game::GetPlayr()->p).y;
 }
 
 void P_MoveW()
 {
-    --Game::GetPlayr()->p->pos.coords.x;
+    --Game::Get()->entities.Coords(Game::GetPlayr()->p).x;
 }
 
 void P_MoveS()
 {
-    ++Game::GetPlayr()->p->pos.coords.y;
+    ++Game::Get()->entities.Coords(Game::GetPlayr()->p).y;
 }
 
 void P_MoveE()
 {
-    ++Game::GetPlayr()->p->pos.coords.x;
+    ++Game::Get()->entities.Coords(Game::GetPlayr()->p).x;
 }
 
 void P_NextWeapon()
@@ -46,18 +46,18 @@ void P_QuickSwap()
 
 void P_ChangeDirL()
 {
-    if (Game::GetPlayr()->p->dir == D_EAST)
-        Game::GetPlayr()->p->dir = D_NORTH;
+    if (Game::Get()->entities.Info(Game::GetPlayr()->p).dir == D_EAST)
+        Game::Get()->entities.Info(Game::GetPlayr()->p).dir = D_NORTH;
     else
-        ++Game::GetPlayr()->p->dir;
+        ++Game::Get()->entities.Info(Game::GetPlayr()->p).dir;
 }
 
 void P_ChangeDirR()
 {
-    if (Game::GetPlayr()->p->dir == D_NORTH)
-        Game::GetPlayr()->p->dir = D_EAST;
+    if (Game::Get()->entities.Info(Game::GetPlayr()->p).dir == D_NORTH)
+        Game::Get()->entities.Info(Game::GetPlayr()->p).dir = D_EAST;
     else
-        --Game::GetPlayr()->p->dir;
+        --Game::Get()->entities.Info(Game::GetPlayr()->p).dir;
 }
 
 void P_DashN()
@@ -10,7 +10,7 @@ inline std::vector<std::array<uint64_t, 4>> xp_to_stats = {
 
 typedef struct playr_s
 {
-    entity_t* p;
+    entityhandle_t p;
     uint64_t level = 0;
     uint64_t xp = 0;
 
@@ -70,11 +70,11 @@ void VertexBuffer::PushVertexAttrib(const VertexArray* vao, GLint index, GLsizei
 
 VertexBuffer* VertexBuffer::Create(const void* data, size_t size, const eastl::string& name)
 {
-    return CONSTRUCT(VertexBuffer, name.c_str(), data, size);
+    return ZONE_CONSTRUCT(ZONE_RENDERER, VertexBuffer, name.c_str(), data, size);
 }
 VertexBuffer* VertexBuffer::Create(size_t reserve, const eastl::string& name)
 {
-    return CONSTRUCT(VertexBuffer, name.c_str(), reserve);
+    return ZONE_CONSTRUCT(ZONE_RENDERER, VertexBuffer, name.c_str(), reserve);
 }
 
 /*
@@ -83,7 +83,7 @@ VertexBuffer* VertexBuffer::Create(size_t reserve, const eastl::string& name)
 
 IndexBuffer* IndexBuffer::Create(const void *indices, size_t count, GLenum type, const eastl::string& name)
 {
-    return CONSTRUCT(IndexBuffer, name.c_str(), indices, count, type);
+    return ZONE_CONSTRUCT(ZONE_RENDERER, IndexBuffer, name.c_str(), indices, count, type);
 }
 
 IndexBuffer::IndexBuffer(const void* data, size_t count, GLenum _type)
@@ -122,11 +122,11 @@ IndexBuffer::~IndexBuffer()
 
 ShaderStorageBuffer* ShaderStorageBuffer::Create(const void *data, size_t count, GLuint binding, const std::string& name)
 {
-    return CONSTRUCT(ShaderStorageBuffer, name.c_str(), data, count, binding);
+    return ZONE_CONSTRUCT(ZONE_RENDERER, ShaderStorageBuffer, name.c_str(), data, count, binding);
 }
 ShaderStorageBuffer* ShaderStorageBuffer::Create(size_t reserve, GLuint binding, const std::string& name)
 {
-    return CONSTRUCT(ShaderStorageBuffer, name.c_str(), reserve, binding);
+    return ZONE_CONSTRUCT(ZONE_RENDERER, ShaderStorageBuffer, name.c_str(), reserve, binding);
 }
 
 ShaderStorageBuffer::ShaderStorageBuffer(const void *data, size_t count, GLuint binding)
@@ -202,9 +202,9 @@ void UniformBuffer::SetData(const void *data, size_t count)
 
 UniformBuffer* UniformBuffer::Create(const void *data, size_t count, const eastl::string& name)
 {
-    return CONSTRUCT(UniformBuffer, name.c_str(), data, count);
+    return ZONE_CONSTRUCT(ZONE_RENDERER, UniformBuffer, name.c_str(), data, count);
 }
 UniformBuffer* UniformBuffer::Create(size_t reserve, const eastl::string& name)
 {
-    return CONSTRUCT(UniformBuffer, name.c_str(), reserve);
+    return ZONE_CONSTRUCT(ZONE_RENDERER, UniformBuffer, name.c_str(), reserve);
 }
\ No newline at end of file
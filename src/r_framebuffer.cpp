@@ -3,7 +3,7 @@
 
 Framebuffer* Framebuffer::Create(const eastl::string& name)
 {
-    return CONSTRUCT(Framebuffer, name.c_str());
+    return ZONE_CONSTRUCT(ZONE_RENDERER, Framebuffer, name.c_str());
 }
 
 Framebuffer::Framebuffer()
@@ -24,10 +24,10 @@ GPUContext::GPUContext()
     glsl_extensions = (const char*)glGetString(GL_SPIR_V_EXTENSIONS);
 
     glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
-    extensions = (char **)Z_Malloc(sizeof(char *) * num_extensions, TAG_STATIC, &extensions, "OpenGL_EXT");
+    extensions = (char **)Z_ZoneMalloc(ZONE_RENDERER, sizeof(char *) * num_extensions, TAG_STATIC, &extensions, "OpenGL_EXT");
     for (int i = 0; i < num_extensions; i++) {
         const char* str = (const char*)glGetStringi(GL_EXTENSIONS, i);
-        extensions[i] = (char *)Z_Malloc(strlen(str)+1, TAG_STATIC, &extensions[i], "extensionStr");
+        extensions[i] = (char *)Z_ZoneMalloc(ZONE_RENDERER, strlen(str)+1, TAG_STATIC, &extensions[i], "extensionStr");
         strncpy(extensions[i], str, strlen(str));
     }
 }
@@ -15,7 +15,7 @@ static byte* R_LoadImage(const eastl::string& filepath)
     return buffer;
 }
 
-Texture2D::Texture2D(const Texture2DSetup& setup, const eastl::string& filepath)
+void Texture2D::Upload(const Texture2DSetup& setup, byte* image)
 {
     glGenTextures(1, &id);
     glBindTexture(GL_TEXTURE_2D, id);
@@ -26,11 +26,6 @@ Texture2D::Texture2D(const Texture2DSetup& setup, const eastl::string& filepath)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, setup.wrapT);
     glTexParameteri(GL_TEXTURE_2D, GL_AUTO_GENERATE_MIPMAP, (setup.genMipmap ? GL_TRUE : GL_FALSE));
 
-    byte* image = SOIL_load_image(filepath.c_str(), &width, &height, 0, SOIL_LOAD_RGBA);
-    if (!image)
-        N_Error("Texture2D::Texture2D: SOIL_load_image failed for texture file %s, error string: %s", filepath.c_str(), SOIL_last_result());
-    
-    assert(image);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
     
     if (setup.genMipmap)
@@ -38,13 +33,32 @@ Texture2D::Texture2D(const Texture2DSetup& setup, const eastl::string& filepath)
 
     glBindTexture(GL_TEXTURE_2D, 0);
 
-    buffer = (byte *)Z_Malloc(width * height * 4, TAG_STATIC, &buffer, "texbuffer");
+    buffer = (byte *)Z_ZoneMalloc(ZONE_RENDERER, width * height * 4, TAG_STATIC, &buffer, "texbuffer");
     memcpy(buffer, image, width * height * 4);
     (free)(image);
+}
+
+Texture2D::Texture2D(const Texture2DSetup& setup, const eastl::string& filepath)
+{
+    byte* image = SOIL_load_image(filepath.c_str(), &width, &height, 0, SOIL_LOAD_RGBA);
+    if (!image)
+        N_Error("Texture2D::Texture2D: SOIL_load_image failed for texture file %s, error string: %s", filepath.c_str(), SOIL_last_result());
+    
+    assert(image);
+    Upload(setup, image);
 
     LOG_INFO("successfully loaded texture file {}", filepath.c_str());
 }
 
+Texture2D::Texture2D(const Texture2DSetup& setup, const void *data, uint64_t size)
+{
+    byte* image = SOIL_load_image_from_memory((const unsigned char *)data, (int)size, &width, &height, 0, SOIL_LOAD_RGBA);
+    if (!image)
+        N_Error("Texture2D::Texture2D: SOIL_load_image_from_memory failed, error string: %s", SOIL_last_result());
+
+    Upload(setup, image);
+}
+
 Texture2D::~Texture2D()
 {
     glDeleteTextures(1, &id);
@@ -54,5 +68,53 @@ Texture2D::~Texture2D()
 Texture2D* Texture2D::Create(const Texture2DSetup& setup, const eastl::string& filepath, const eastl::string& name)
 {
     LOG_INFO("loading texture file {}", filepath.c_str());
-    return CONSTRUCT(Texture2D, name.c_str(), setup, filepath);
-}
\ No newline at end of file
+    return ZONE_CONSTRUCT(ZONE_RENDERER, Texture2D, name.c_str(), setup, filepath);
+}
+
+static Texture2D** bfftextures;
+static uint32_t numbfftextures;
+
+//
+// R_BFFTexture: uploads a texture chunk the first time it's asked for, chunks that share
+// a payload share the one texture
+//
+Texture2D* R_BFFTexture(uint32_t index)
+{
+    uint32_t first;
+
+    if (!bfftextures) {
+        numbfftextures = G_BFFNumChunks(CT_TEXTURE);
+        bfftextures = (Texture2D **)Z_ZoneMalloc(ZONE_RENDERER, sizeof(Texture2D *) * (numbfftextures + 1), TAG_STATIC, &bfftextures, "bfftextures");
+        memset(bfftextures, 0, sizeof(Texture2D *) * (numbfftextures + 1));
+    }
+    if (index >= numbfftextures)
+        N_Error("R_BFFTexture: texture %u out of range", index);
+    if (bfftextures[index])
+        return bfftextures[index];
+
+    first = G_BFFChunkAlias(CT_TEXTURE, index);
+    if (!bfftextures[first]) {
+        uint64_t size;
+        const void *data = G_BFFCacheChunk(CT_TEXTURE, first, &size);
+        bfftextures[first] = ZONE_CONSTRUCT(ZONE_RENDERER, Texture2D, "bfftexture", DEFAULT_TEXTURE_SETUP, data, size);
+    }
+    bfftextures[index] = bfftextures[first];
+    return bfftextures[index];
+}
+
+// needs the gl context that uploaded them
+void R_FreeBFFTextures(void)
+{
+    if (!bfftextures)
+        return;
+
+    for (uint32_t i = 0; i < numbfftextures; ++i) {
+        if (bfftextures[i] && G_BFFChunkAlias(CT_TEXTURE, i) == i) {
+            bfftextures[i]->~Texture2D();
+            Z_Free(bfftextures[i]);
+        }
+    }
+    Z_Free(bfftextures);
+    bfftextures = NULL;
+    numbfftextures = 0;
+}
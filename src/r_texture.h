@@ -28,8 +28,12 @@ private:
     int width;
     int height;
     int n;
+
+    void Upload(const Texture2DSetup& setup, byte* image);
 public:
     Texture2D(const Texture2DSetup& _setup, const eastl::string& filepath);
+    // an image file that's already in memory, a bff texture chunk
+    Texture2D(const Texture2DSetup& _setup, const void *data, uint64_t size);
     ~Texture2D();
 
     inline void Bind(uint32_t slot = 0) const
@@ -49,4 +53,7 @@ public:
     static Texture2D* Create(const Texture2DSetup& setup, const eastl::string& filepath, const eastl::string& name);
 };
 
+Texture2D* R_BFFTexture(uint32_t index);
+void R_FreeBFFTextures(void);
+
 #endif
\ No newline at end of file
@@ -2,11 +2,32 @@
 #include "g_game.h"
 
 Mob::Mob()
-    : health(0), flags(0), mpos(0, 0), mdir(P_Random() & 3)
+    : health(0), flags(0), mpos(0, 0), mdir(P_Random() & 3), type(0)
 {
 }
 
-void M_RunThinker(linked_list<Mob*>::iterator it)
+// only done when a mob takes on a type, getmobjindex just hands back what this found
+uint32_t M_MobjIndex(const mobj_t* m)
 {
-    Mob* const actor = it->val;
-}
\ No newline at end of file
+    if (m >= mobinfo && m < mobinfo + NUMMOBS)
+        return (uint32_t)(m - mobinfo);
+
+    for (uint32_t i = 0; i < NUMMOBS; ++i) {
+        if (!strncmp(mobinfo[i].name, m->name, sizeof(m->name)))
+            return i;
+    }
+    LOG_WARN("M_MobjIndex: mob has invalid mobj_t type, returning 0");
+    return 0;
+}
+
+entityhandle_t M_SpawnMob(uint32_t type)
+{
+    Registry& reg = Game::Get()->registry;
+
+    if (type >= NUMMOBS)
+        N_Error("M_SpawnMob: bad mob type %u", type);
+
+    const entityhandle_t h = reg.Create();
+    reg.Add<Mob>(h) = mobinfo[type];
+    return h;
+}
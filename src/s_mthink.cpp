@@ -0,0 +1,429 @@
+#include "n_shared.h"
+#include "g_game.h"
+
+//
+// the mob think phase: the live mobs get copied into a snapshot, the snapshot gets cut into
+// chunks that go out to the job workers, every worker writes intents into its own buffer,
+// and once everybody's done the intents get applied in chunk order. Nothing a thinker does
+// depends on which worker ran it or when, so a tic comes out the same no matter how many
+// workers there are
+//
+
+#define MTHINK_CHUNK        128     // mobs per chunk
+#define MTHINK_PARALLELMIN  512     // below this handing out jobs costs more than it saves
+
+#define MOB_SIGHTRANGE      24
+#define MOB_SHOOTRANGE      8
+
+typedef struct
+{
+    uint32_t worker;        // whose buffer the chunk's intents are in
+    uint32_t first;
+    uint32_t count;
+} mobchunk_t;
+
+typedef struct alignas(64)
+{
+    mobcmdbuf_t cmds;
+} mthinker_t;
+
+static mobworld_t worlds[2];
+static uint32_t frontworld;
+
+static mobchunk_t* chunks;
+static job_t* chunkjobs;
+static uint32_t numchunks, maxchunks;
+
+static mthinker_t thinkers[MAX_JOB_WORKERS];
+
+//
+// M_Random: a counter run through murmur3's finalizer, so what a mob rolls only depends on
+// the tic's seed, who the mob is and how many times it's rolled before
+//
+static inline int M_Random(uint32_t* state)
+{
+    uint32_t x = (*state += 0x9e3779b9);
+
+    x ^= x >> 16;
+    x *= 0x85ebca6b;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35;
+    x ^= x >> 16;
+    return rndtable[x & 0xff];
+}
+
+static inline void M_Intent(mobcmdbuf_t* cmds, uint32_t actor, mobintenttype_t type, uint8_t dir, uint16_t sfx, uint32_t amount)
+{
+    mobintent_t* intent = &cmds->intents[cmds->count++];
+
+    intent->actor = actor;
+    intent->type = type;
+    intent->dir = dir;
+    intent->sfx = sfx;
+    intent->amount = amount;
+}
+
+static inline bool M_Blocked(int32_t y, int32_t x)
+{
+    if (y < 0 || y >= MAP_MAX_Y || x < 0 || x >= MAP_MAX_X)
+        return true;
+    return Game::Get()->c_map[y][x] == SPR_WALL;
+}
+
+// walks the line between the two, the map doesn't change during the think phase
+static bool M_CheckSight(const coord_t& from, const coord_t& to)
+{
+    int32_t y0 = (int32_t)from.y, x0 = (int32_t)from.x;
+    const int32_t y1 = (int32_t)to.y, x1 = (int32_t)to.x;
+    const int32_t dy = -abs(y1 - y0), dx = abs(x1 - x0);
+    const int32_t sy = y0 < y1 ? 1 : -1, sx = x0 < x1 ? 1 : -1;
+    int32_t err = dx + dy;
+
+    while (y0 != y1 || x0 != x1) {
+        const int32_t e2 = err * 2;
+        if (e2 >= dy) {
+            err += dy;
+            x0 += sx;
+        }
+        if (e2 <= dx) {
+            err += dx;
+            y0 += sy;
+        }
+        if ((y0 != y1 || x0 != x1) && M_Blocked(y0, x0))
+            return false;
+    }
+    return true;
+}
+
+//
+// M_RunThinker: decides what one mob does this tic, only ever reads the snapshot
+// and the map
+//
+void M_RunThinker(const mobworld_t* world, uint32_t index, mobcmdbuf_t* cmds)
+{
+    const mobsnap_t* actor = &world->mobs[index];
+    uint32_t rnd;
+    uint8_t dir;
+
+    if (actor->health <= 0)
+        return;
+
+    rnd = world->seed ^ (actor->h * 0x27d4eb2d);
+    dir = actor->mdir;
+
+    if (world->playr != ENTITY_NONE) {
+        const float dy = world->playrpos.y - actor->mpos.y;
+        const float dx = world->playrpos.x - actor->mpos.x;
+        const float dist = fabsf(dy) > fabsf(dx) ? fabsf(dy) : fabsf(dx);
+
+        if (dist <= MOB_SIGHTRANGE && M_CheckSight(actor->mpos, world->playrpos)) {
+            if (dist <= 1 || (dist <= MOB_SHOOTRANGE && M_Random(&rnd) < 32)) {
+                M_Intent(cmds, index, MI_ATTACK, dir, 0, 1 + (M_Random(&rnd) & 7));
+                if (M_Random(&rnd) < 64)
+                    M_Intent(cmds, index, MI_SOUND, dir, sfx_playr_hurt0, 0);
+                return;
+            }
+            // close in along whichever axis is further off
+            if (fabsf(dy) > fabsf(dx))
+                dir = dy < 0 ? D_NORTH : D_SOUTH;
+            else
+                dir = dx < 0 ? D_WEST : D_EAST;
+            M_Intent(cmds, index, MI_MOVE, dir, 0, 0);
+            return;
+        }
+    }
+
+    // wander
+    if (M_Random(&rnd) < 64)
+        dir = M_Random(&rnd) & 3;
+    M_Intent(cmds, index, MI_MOVE, dir, 0, 0);
+}
+
+static void M_ReserveIntents(mobcmdbuf_t* cmds, uint32_t count)
+{
+    uint32_t ncapacity;
+
+    if (cmds->count + count <= cmds->capacity)
+        return;
+
+    ncapacity = cmds->capacity ? cmds->capacity : MTHINK_CHUNK * MOB_MAXINTENTS;
+    while (ncapacity < cmds->count + count)
+        ncapacity <<= 1;
+    cmds->intents = (mobintent_t *)Z_Realloc(cmds->intents, sizeof(mobintent_t) * ncapacity, &cmds->intents, TAG_STATIC, "mobintents");
+    cmds->capacity = ncapacity;
+}
+
+static void M_ThinkChunk(void *arg)
+{
+    const uint32_t chunk = (uint32_t)(uintptr_t)arg;
+    const uint32_t worker = N_JobWorker();
+    const mobworld_t* world = &worlds[frontworld];
+    mobcmdbuf_t* cmds = &thinkers[worker].cmds;
+    mobchunk_t* c = &chunks[chunk];
+    const uint32_t begin = chunk * MTHINK_CHUNK;
+    const uint32_t end = begin + MTHINK_CHUNK < world->nummobs ? begin + MTHINK_CHUNK : world->nummobs;
+
+    // reserved up front so M_Intent never has to check
+    M_ReserveIntents(cmds, (end - begin) * MOB_MAXINTENTS);
+
+    c->worker = worker;
+    c->first = cmds->count;
+    for (uint32_t i = begin; i < end; ++i)
+        M_RunThinker(world, i, cmds);
+    c->count = cmds->count - c->first;
+}
+
+//
+// M_Snapshot: copies the live mobs into the back world and makes it the front one,
+// the previous tic's stays around for whoever wants to interpolate
+//
+static const mobworld_t* M_Snapshot(ComponentSet<Mob>* set)
+{
+    mobworld_t* world;
+    const Mob* mobs;
+    const entityhandle_t* handles;
+    EntityStore* entities;
+    playr_t* playr;
+    uint32_t n;
+
+    frontworld ^= 1;
+    world = &worlds[frontworld];
+
+    n = set->size();
+    if (n > world->capacity) {
+        world->mobs = (mobsnap_t *)Z_Realloc(world->mobs, sizeof(mobsnap_t) * n, &world->mobs, TAG_STATIC, "mobsnap");
+        world->capacity = n;
+    }
+
+    mobs = set->Data();
+    handles = set->Handles();
+    for (uint32_t i = 0; i < n; ++i) {
+        mobsnap_t* snap = &world->mobs[i];
+        snap->mpos = mobs[i].mpos;
+        snap->health = mobs[i].health;
+        snap->mdir = mobs[i].mdir;
+        snap->type = mobs[i].type;
+        snap->h = handles[i];
+    }
+    world->nummobs = n;
+
+    entities = &Game::Get()->entities;
+    playr = Game::GetPlayr();
+    if (entities->Valid(playr->p)) {
+        const glm::vec3& pos = entities->Coords(playr->p);
+        world->playr = playr->p;
+        world->playrpos = coord_t(pos.y, pos.x);
+    }
+    else {
+        world->playr = ENTITY_NONE;
+        world->playrpos = coord_t(0, 0);
+    }
+
+    world->tic = ticcount;
+    world->seed = (uint32_t)P_Random() * 0x01000193 ^ (uint32_t)ticcount;
+
+    return world;
+}
+
+const mobworld_t* M_World(bool previous)
+{
+    return &worlds[frontworld ^ (previous ? 1 : 0)];
+}
+
+// E_GetDir without the switch, this runs once for every mob every tic
+static const float dirsteps[NUMDIR][2] = {
+    {-1,  0}, // D_NORTH
+    { 0, -1}, // D_WEST
+    { 1,  0}, // D_SOUTH
+    { 0,  1}, // D_EAST
+};
+
+static void M_ApplyIntent(Mob* mobs, const mobintent_t* intent)
+{
+    Mob* const actor = &mobs[intent->actor];
+    EntityStore* const entities = &Game::Get()->entities;
+    const entityhandle_t playr = worlds[frontworld].playr;
+    coord_t step;
+
+    switch (intent->type) {
+    case MI_MOVE:
+        step = coord_t(dirsteps[intent->dir & 3][0], dirsteps[intent->dir & 3][1]);
+        actor->mdir = intent->dir;
+        if (!M_Blocked((int32_t)(actor->mpos.y + step.y), (int32_t)(actor->mpos.x + step.x)))
+            actor->mpos += step;
+        break;
+    case MI_ATTACK:
+        if (entities->Valid(playr))
+            entities->Health(playr) -= intent->amount < entities->Health(playr) ? intent->amount : entities->Health(playr);
+        break;
+    case MI_SOUND:
+        P_PlaySFX(intent->sfx);
+        break;
+    };
+}
+
+//
+// M_Think: the mob think system, runs every thinker against this tic's snapshot and then
+// applies what they came up with in snapshot order
+//
+void M_Think(Registry& reg)
+{
+    ComponentSet<Mob>* set = reg.Set<Mob>();
+    const mobworld_t* world;
+    jobcounter_t pending{0};
+    uint32_t i, j, n;
+
+    world = M_Snapshot(set);
+    if (!world->nummobs)
+        return;
+
+    n = (world->nummobs + MTHINK_CHUNK - 1) / MTHINK_CHUNK;
+    if (n > maxchunks) {
+        chunks = (mobchunk_t *)Z_Realloc(chunks, sizeof(mobchunk_t) * n, &chunks, TAG_STATIC, "mobchunks");
+        chunkjobs = (job_t *)Z_Realloc(chunkjobs, sizeof(job_t) * n, &chunkjobs, TAG_STATIC, "mobchunkjobs");
+        maxchunks = n;
+    }
+    numchunks = n;
+
+    for (i = 0; i < N_NumJobWorkers(); ++i)
+        thinkers[i].cmds.count = 0;
+
+    if (world->nummobs < MTHINK_PARALLELMIN) {
+        for (i = 0; i < numchunks; ++i)
+            M_ThinkChunk((void *)(uintptr_t)i);
+    }
+    else {
+        for (i = 0; i < numchunks; ++i) {
+            chunkjobs[i].func = M_ThinkChunk;
+            chunkjobs[i].arg = (void *)(uintptr_t)i;
+            chunkjobs[i].name = "mobchunk";
+        }
+        N_RunJobs(chunkjobs, numchunks, &pending);
+        N_WaitJobs(&pending);
+    }
+
+    // chunk order is snapshot order no matter who ran what
+    Mob* const mobs = set->Data();
+    for (i = 0; i < numchunks; ++i) {
+        const mobchunk_t* c = &chunks[i];
+        const mobintent_t* intents = thinkers[c->worker].cmds.intents + c->first;
+        for (j = 0; j < c->count; ++j)
+            M_ApplyIntent(mobs, &intents[j]);
+    }
+}
+
+//
+// the -thinkcheck mode: spawns a made-up level once and runs it from the same start for tics
+// tics on 1, 2, 4 .. maxworkers job workers. The mobs, the player's health and P_Random have to
+// come out the same every time, it's the only thing that catches the merge going out of chunk
+// order, so run it after touching anything in here. Takes over the level and the job workers
+//
+#define THINKCHECK_SEED 0x6d2b79f5
+#define THINKCHECK_WALLS 16 // one in this many tiles is a wall, so sight actually gets blocked
+
+typedef struct
+{
+    coord_t mpos;
+    int16_t health;
+    uint8_t mdir;
+} mobstart_t;
+
+static inline uint32_t M_CheckRandom(uint32_t* seed)
+{
+    *seed = *seed * 1664525 + 1013904223;
+    return *seed >> 8;
+}
+
+static uint32_t M_CheckRun(const mobstart_t* start, uint32_t tics)
+{
+    Registry& reg = Game::Get()->registry;
+    EntityStore* const entities = &Game::Get()->entities;
+    const entityhandle_t playr = Game::GetPlayr()->p;
+    ComponentSet<Mob>* set = reg.Set<Mob>();
+    Mob* mobs = set->Data();
+    uint32_t i, crc;
+
+    for (i = 0; i < set->size(); ++i) {
+        mobs[i].mpos = start[i].mpos;
+        mobs[i].health = start[i].health;
+        mobs[i].mdir = start[i].mdir;
+    }
+    entities->Coords(playr) = glm::vec3(MAP_MAX_X / 2, MAP_MAX_Y / 2, 0.0f);
+    entities->Health(playr) = UINT32_MAX;
+    G_ClearRandom();
+    ticcount = 0;
+
+    for (i = 0; i < tics; ++i, ++ticcount)
+        M_Think(reg);
+
+    crc = 0;
+    for (i = 0; i < set->size(); ++i) {
+        crc = G_CRC32(crc, &mobs[i].mpos, sizeof(mobs[i].mpos));
+        crc = G_CRC32(crc, &mobs[i].health, sizeof(mobs[i].health));
+        crc = G_CRC32(crc, &mobs[i].mdir, sizeof(mobs[i].mdir));
+    }
+    crc = G_CRC32(crc, &entities->Health(playr), sizeof(uint32_t));
+    crc = G_CRC32(crc, &rndindex, sizeof(rndindex));
+    return crc;
+}
+
+void M_CheckThink(uint32_t nummobs, uint32_t tics, uint32_t maxworkers)
+{
+    Game* const game = Game::Get();
+    Registry& reg = game->registry;
+    mobstart_t* start;
+    uint32_t seed, crc, first, workers, y, x, i;
+    std::chrono::steady_clock::time_point begin;
+
+    if (maxworkers < 1 || maxworkers > MAX_JOB_WORKERS)
+        maxworkers = MAX_JOB_WORKERS;
+
+    // walled in all the way round with walls scattered in between
+    seed = THINKCHECK_SEED;
+    for (y = 0; y < MAP_MAX_Y; ++y) {
+        for (x = 0; x < MAP_MAX_X; ++x) {
+            if (!y || !x || y == MAP_MAX_Y - 1 || x == MAP_MAX_X - 1 || !(M_CheckRandom(&seed) % THINKCHECK_WALLS))
+                game->c_map[y][x] = SPR_WALL;
+            else
+                game->c_map[y][x] = SPR_FLOOR_INSIDE;
+        }
+    }
+    game->c_map[MAP_MAX_Y / 2][MAP_MAX_X / 2] = SPR_FLOOR_INSIDE;
+
+    reg.Clear();
+    game->playr->p = reg.Create();
+
+    start = (mobstart_t *)Z_Malloc(sizeof(mobstart_t) * nummobs, TAG_STATIC, NULL, "thinkcheck");
+    for (i = 0; i < nummobs; ++i) {
+        Mob& mob = reg.Get<Mob>(M_SpawnMob(i % NUMMOBS));
+        do {
+            y = M_CheckRandom(&seed) % MAP_MAX_Y;
+            x = M_CheckRandom(&seed) % MAP_MAX_X;
+        } while (M_Blocked(y, x));
+        mob.mpos = coord_t(y, x);
+        start[i].mpos = mob.mpos;
+        start[i].health = mob.health;
+        start[i].mdir = mob.mdir;
+    }
+
+    printf("mob think check, %u mobs, %u tics\n", nummobs, tics);
+    printf("-------------------------\n");
+    printf("%8s %12s %10s\n", "workers", "ms", "crc");
+    first = 0;
+    for (workers = 1; ; workers = workers * 2 < maxworkers ? workers * 2 : maxworkers) {
+        N_InitJobs(workers);
+        begin = std::chrono::steady_clock::now();
+        crc = M_CheckRun(start, tics);
+        printf("%8u %12.03f %10x\n", workers,
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count(), crc);
+        if (workers == 1)
+            first = crc;
+        else if (crc != first)
+            N_Error("M_CheckThink: %u workers came out different from 1 worker (%x, should be %x)", workers, crc, first);
+        if (workers == maxworkers)
+            break;
+    }
+    printf("-------------------------\n");
+
+    Z_Free(start);
+}
@@ -21,6 +21,9 @@ json& N_GetSaveJSon()
     return data;
 }
 
+// bumped whenever the layout below changes, older saves are refused instead of misread
+#define SAVE_MAGIC 0x5f3759e0
+
 #define UINTPTR_C(x)      ((uintptr_t)(UINTMAX_C(x)))
 #define PADSAVEP()	save_p = (byte*)(((uintptr_t)save_p + UINTPTR_C(3)) & (~UINTPTR_C(3)))
 
@@ -72,7 +75,7 @@ void G_SaveGame()
     if (arg != -1) {
         svfile = myargv[arg + 1];
     }
-	uint64_t magic = 0x5f3759df;
+	uint64_t magic = SAVE_MAGIC;
 	uint32_t player_size = sizeof(playr_t) - ((sizeof(void *) * 6) + (24 << 1));
 	uint16_t version_major = _NOMAD_VERSION;
 	uint32_t version_update = _NOMAD_VERSION_UPDATE;
@@ -106,18 +109,17 @@ void G_SaveGame()
 	fwrite(playr->P_wpns, sizeof(weapon_t), PLAYR_MAX_WPNS, fp);
 	fwrite(playr->inv, sizeof(item_t), PLAYR_MAX_ITEMS, fp);
 
-	linked_list<entity_t>::iterator entities = game->entities.begin();
+	// one array at a time, targets go out as dense indices since handles don't survive a reload
+	EntityStore* const entities = &game->entities;
+	fwrite(entities->coords, sizeof(glm::vec3), numentities, fp);
+	fwrite(entities->thrust, sizeof(glm::vec3), numentities, fp);
+	fwrite(entities->health, sizeof(uint32_t), numentities, fp);
+	fwrite(entities->flags, sizeof(entityflag_t), numentities, fp);
+	fwrite(entities->state, sizeof(state_t), numentities, fp);
 	for (uint16_t i = 0; i < numentities; ++i) {
-		fwrite(&entities->val, sizeof(entity_t) - sizeof(entitypos_t) + sizeof(state_t) + (sizeof(void *) * 2) + 1, 1, fp);
-		fwrite(&entities->val.state, sizeof(state_t), 1, fp);
-		fwrite(&entities->val.dir, sizeof(uint8_t), 1, fp);
-		fwrite(&entities->val.ticker, sizeof(uint64_t), 1, fp);
-		fwrite(&entities->val.pos.coords, sizeof(glm::vec3), 1, fp);
-		fwrite(&entities->val.pos.lookangle, sizeof(glm::vec2), 1, fp);
-		fwrite(entities->val.pos.hitbox, sizeof(vec2_t), 4, fp);
-		fwrite(&entities->val.pos.to, sizeof(vec3_t), 1, fp);
-		fwrite(&entities->val.pos.thrust, sizeof(vec3_t), 1, fp);
-		entities = entities->next;
+		entityinfo_t info = entities->info[i];
+		info.target = entities->Valid(info.target) ? entities->Index(info.target) : 0xffff;
+		fwrite(&info, sizeof(entityinfo_t), 1, fp);
 	}
 	fwrite(game->c_map, sizeof(sprite_t), MAP_MAX_Y*MAP_MAX_X, fp);
 	fclose(fp);
@@ -133,7 +135,7 @@ void G_LoadGame()
     if (arg != -1) {
         svfile = myargv[arg + 1];
     }
-	uint64_t magic = 0x5f3759df;
+	uint64_t magic = 0;
 	uint16_t numentities = game->entities.size();
 	uint64_t player_size = sizeof(playr_t) - ((sizeof(void *) * 6) + (24 << 1));
 	uint16_t version_major = 0;
@@ -155,6 +157,11 @@ void G_LoadGame()
 	fread(&version_patch, sizeof(uint64_t), 1, fp);
 	
 	fread(&magic, sizeof(uint64_t), 1, fp);
+	if (magic != SAVE_MAGIC) {
+		LOG_ERROR("save file {} is from an older version, can't load it", svfile);
+		fclose(fp);
+		return;
+	}
 	fread(&numentities, sizeof(uint16_t), 1, fp);
 	fread(&game->difficulty, sizeof(uint8_t), 1, fp);
 	fread(&game->gamestate, sizeof(gamestate_t), 1, fp);
@@ -165,21 +172,23 @@ void G_LoadGame()
 	fread(playr->P_wpns, sizeof(weapon_t), PLAYR_MAX_WPNS, fp);
 	fread(playr->inv, sizeof(item_t), PLAYR_MAX_ITEMS, fp);
 
-	game->entities.clear();
-
+	// spawning into a cleared store hands out dense indices in order, so the arrays load straight in
+	EntityStore* const entities = &game->entities;
+	game->registry.Clear();
+	for (uint16_t i = 0; i < numentities; ++i)
+		entities->Spawn();
+
+	fread(entities->coords, sizeof(glm::vec3), numentities, fp);
+	fread(entities->thrust, sizeof(glm::vec3), numentities, fp);
+	fread(entities->health, sizeof(uint32_t), numentities, fp);
+	fread(entities->flags, sizeof(entityflag_t), numentities, fp);
+	fread(entities->state, sizeof(state_t), numentities, fp);
+	fread(entities->info, sizeof(entityinfo_t), numentities, fp);
 	for (uint16_t i = 0; i < numentities; ++i) {
-		game->entities.emplace_back();
-		entity_t* const entity = &game->entities.back();
-		fread(entity, sizeof(entity_t) - sizeof(entitypos_t) + sizeof(state_t) + (sizeof(void *) * 2) + 1, 1, fp);
-		fread(&entity->state, sizeof(state_t), 1, fp);
-		fread(&entity->dir, sizeof(uint8_t), 1, fp);
-		fread(&entity->ticker, sizeof(uint64_t), 1, fp);
-		fread(&entity->pos.coords, sizeof(glm::vec3), 1, fp);
-		fread(&entity->pos.lookangle, sizeof(glm::vec2), 1, fp);
-		fread(entity->pos.hitbox, sizeof(vec2_t), 4, fp);
-		fread(&entity->pos.to, sizeof(vec3_t), 1, fp);
-		fread(&entity->pos.thrust, sizeof(vec3_t), 1, fp);
+		entityinfo_t* const info = &entities->info[i];
+		info->target = info->target < numentities ? entities->Handle(info->target) : ENTITY_NONE;
 	}
+	playr->p = numentities ? entities->Handle(0) : ENTITY_NONE;
 	fread(game->c_map, sizeof(sprite_t), MAP_MAX_Y*MAP_MAX_X, fp);
 	fclose(fp);
 }
\ No newline at end of file
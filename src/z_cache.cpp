@@ -1,5 +1,5 @@
 #include "n_shared.h"
-#include "n_alloc.h"
+#include "g_game.h"
 
 typedef struct cache_system_s
 {
@@ -7,16 +7,116 @@ typedef struct cache_system_s
 	cache_user_t			*user;
 	char					name[15];
 	struct cache_system_s	*prev, *next;
-	struct cache_system_s	*lru_prev, *lru_next;	// for LRU flushing	
+	struct cache_system_s	*lru_prev, *lru_next;	// for LRU flushing
+	double					priority;	// GDSF key
+	float					cost;		// reload cost hint, see Cache_SetCost
+	uint32_t				hits;
+	byte					list;		// ARC, CACHE_RECENT or CACHE_FREQUENT
+	byte					pending;	// being filled by the prefetch thread, can't move
 } cache_system_t;
 
-cache_system_t *Cache_TryAlloc(int32_t size, bool nobottom);
+typedef struct
+{
+	cache_user_t		*user;
+	cache_system_t		*cs;
+	cacheloader_t		loader;
+	void				*arg;
+	size_t				size;
+	int					priority;
+	uint64_t			seq;
+	std::atomic<int>	state;
+	bool				ok;
+	float				cost;		// what the loader took in milliseconds, for Cache_SetCost
+} cacheprefetch_t;
+
+enum
+{
+	PREFETCH_QUEUED,
+	PREFETCH_LOADING,
+	PREFETCH_DONE
+};
+
+enum
+{
+	CACHE_RECENT,
+	CACHE_FREQUENT
+};
+
+// a hole between two entries, keyed by its size and the entry right above it.
+// the holes below the first entry and above the last one move with the hunk
+// marks, so they're checked directly and never indexed
+typedef std::pair<size_t, cache_system_t *> cachegap_t;
+
+// Cache_Alloc compacts instead of evicting once this much of the cache is loose
+#define CACHE_COMPACT_FRACTION 8
+
+cache_system_t *Cache_TryAlloc(size_t size, bool nobottom);
+static void Cache_PolicyLink(cache_system_t *cs);
+static void Cache_WaitPrefetch(cache_user_t *c);
+static bool Cache_PollPrefetch(cache_user_t *c);
+static void Cache_WaitPrefetches(void);
 
 cache_system_t	cache_head;
+cache_system_t	cache_freq;		// ARC only, entries that were hit after being loaded
+
+static std::set<cachegap_t> cache_gaps;	// ordered by size, best fit is a lower_bound
+static size_t cache_used;				// bytes held by entries, headers included
+
+static cachepolicy_t cache_policy = CACHE_LRU;
+static cachestats_t cache_stats[NUMCACHEPOLICIES];
+
+// GDSF, entries keyed by the user so a move doesn't change the key
+static std::set<std::pair<double, cache_user_t *>> cache_priority;
+static double cache_inflation;			// priority of the last victim
+
+// ARC, byte target for the recent list and the users evicted from either list
+#define CACHE_MAXGHOSTS 4096
+static size_t cache_arc_target;
+static size_t cache_listbytes[2];
+static std::unordered_map<cache_user_t *, std::pair<byte, uint32_t>> cache_ghosts;
+static std::deque<std::pair<cache_user_t *, uint32_t>> cache_ghostorder;
+static uint32_t cache_ghostseq;
+
+// prefetches in flight, keyed by user. only the main thread touches the map,
+// the i/o thread only sees the queue
+static std::unordered_map<cache_user_t *, cacheprefetch_t *> cache_prefetches;
+
+static const char *cache_policynames[NUMCACHEPOLICIES] = { "lru", "gdsf", "arc" };
+
+static inline byte *Cache_Bottom(void)
+{
+	return hunk_base + hunk_low_used;
+}
+
+static inline byte *Cache_Top(void)
+{
+	return hunk_base + hunk_size - hunk_high_used;
+}
+
+static inline size_t Cache_FreeSpace(void)
+{
+	if (Cache_Top() < Cache_Bottom() + cache_used)
+		return 0;
+	return (size_t)(Cache_Top() - Cache_Bottom()) - cache_used;
+}
+
+static inline byte *Cache_End(const cache_system_t *cs)
+{
+	return (byte *)cs + cs->size;
+}
+
+// the hole in front of cs, only indexed when there's an entry below it
+static void Cache_IndexGap(cache_system_t *cs)
+{
+	if (cs->prev != &cache_head && (byte *)cs > Cache_End(cs->prev))
+		cache_gaps.emplace((size_t)((byte *)cs - Cache_End(cs->prev)), cs);
+}
 
-void __attribute__((format (printf, 1, 2))) Con_Printf(const char* fmt, ...);
-void __attribute__((format (printf, 1, 2))) Con_Error(const char* fmt, ...);
-void __attribute__((format (printf, 1, 2))) Con_Debug(const char* fmt, ...);
+static void Cache_UnindexGap(cache_system_t *cs)
+{
+	if (cs->prev != &cache_head && (byte *)cs > Cache_End(cs->prev))
+		cache_gaps.erase(cachegap_t((size_t)((byte *)cs - Cache_End(cs->prev)), cs));
+}
 
 /*
 ===========
@@ -27,6 +127,13 @@ void Cache_Move(cache_system_t *c)
 {
 	cache_system_t		*newcache;
 
+	// can't move it out from under the i/o thread
+	if (c->pending) {
+		Cache_WaitPrefetch(c->user);
+		if (!c->user->data)
+			return;		// load failed and freed it
+	}
+
 	// we are clearing up space at the bottom, so only allocate it late
 	newcache = Cache_TryAlloc(c->size, true);
 	if (newcache) {
@@ -34,8 +141,13 @@ void Cache_Move(cache_system_t *c)
 		memcpy(newcache+1, c+1, c->size - sizeof(cache_system_t));
 		newcache->user = c->user;
 		memcpy(newcache->name, c->name, sizeof(newcache->name));
+		newcache->priority = c->priority;
+		newcache->cost = c->cost;
+		newcache->hits = c->hits;
+		newcache->list = c->list;
 		Cache_Free(c->user);
 		newcache->user->data = (void *)(newcache+1);
+		Cache_PolicyLink(newcache);
 	}
 	else {
 		LOG_INFO("cache_move failed");
@@ -53,7 +165,7 @@ Throw things out until the hunk can be expanded to the given point
 void Cache_FreeLow(size_t new_low_hunk)
 {
 	cache_system_t	*c;
-	
+
 	while (1) {
 		c = cache_head.next;
 		if (c == &cache_head)
@@ -74,7 +186,7 @@ Throw things out until the hunk can be expanded to the given point
 void Cache_FreeHigh(size_t new_high_hunk)
 {
 	cache_system_t	*c, *prev;
-	
+
 	prev = NULL;
 	while (1) {
 		c = cache_head.prev;
@@ -98,19 +210,192 @@ void Cache_UnlinkLRU (cache_system_t *cs)
 
 	cs->lru_next->lru_prev = cs->lru_prev;
 	cs->lru_prev->lru_next = cs->lru_next;
-	
+
 	cs->lru_prev = cs->lru_next = NULL;
 }
 
-void Cache_MakeLRU(cache_system_t *cs)
+static void Cache_LinkLRU(cache_system_t *head, cache_system_t *cs)
 {
 	if (cs->lru_next || cs->lru_prev)
 		N_Error("Cache_MakeLRU: active link");
 
-	cache_head.lru_next->lru_prev = cs;
-	cs->lru_next = cache_head.lru_next;
-	cs->lru_prev = &cache_head;
-	cache_head.lru_next = cs;
+	head->lru_next->lru_prev = cs;
+	cs->lru_next = head->lru_next;
+	cs->lru_prev = head;
+	head->lru_next = cs;
+}
+
+void Cache_MakeLRU(cache_system_t *cs)
+{
+	Cache_LinkLRU(&cache_head, cs);
+}
+
+/*
+============
+Cache_PolicyLink
+
+Hands a filled in entry over to the eviction policy, cs->user has to be
+set. Every policy keeps the entry on an LRU list so the links stay valid
+for Cache_Compact
+============
+*/
+static void Cache_PolicyLink(cache_system_t *cs)
+{
+	switch (cache_policy) {
+	case CACHE_LRU:
+		Cache_MakeLRU(cs);
+		break;
+	case CACHE_GDSF:
+		Cache_MakeLRU(cs);
+		cache_priority.emplace(cs->priority, cs->user);
+		break;
+	case CACHE_ARC:
+		Cache_LinkLRU(cs->list == CACHE_FREQUENT ? &cache_freq : &cache_head, cs);
+		cache_listbytes[cs->list] += cs->size;
+		break;
+	default:
+		N_Error("Cache_PolicyLink: bad policy %i", cache_policy);
+	}
+}
+
+static void Cache_PolicyUnlink(cache_system_t *cs)
+{
+	Cache_UnlinkLRU(cs);
+	if (cache_policy == CACHE_GDSF)
+		cache_priority.erase(std::make_pair(cs->priority, cs->user));
+	else if (cache_policy == CACHE_ARC)
+		cache_listbytes[cs->list] -= cs->size;
+}
+
+/*
+============
+Cache_PolicyVictim
+
+Picks the entry to throw out next, NULL if the cache is empty
+============
+*/
+static cache_system_t *Cache_PolicyVictim(void)
+{
+	cache_system_t *head;
+
+	switch (cache_policy) {
+	case CACHE_GDSF:
+		if (cache_priority.empty())
+			return NULL;
+		return ((cache_system_t *)cache_priority.begin()->second->data) - 1;
+	case CACHE_ARC:
+		// shrink whichever list is over its share
+		if (cache_freq.lru_prev == &cache_freq
+		|| (cache_head.lru_prev != &cache_head && cache_listbytes[CACHE_RECENT] > cache_arc_target))
+			head = &cache_head;
+		else
+			head = &cache_freq;
+		break;
+	default:
+		head = &cache_head;
+		break;
+	}
+	return head->lru_prev == head ? NULL : head->lru_prev;
+}
+
+/*
+============
+Cache_Evict
+============
+*/
+static void Cache_Evict(cache_system_t *cs)
+{
+	cachestats_t *stats = &cache_stats[cache_policy];
+
+	stats->evictions++;
+	stats->bytesevicted += cs->size;
+
+	if (cache_policy == CACHE_GDSF)
+		cache_inflation = cs->priority;
+	else if (cache_policy == CACHE_ARC) {
+		// remember it, reloading it soon means that list was cut too short
+		cache_ghosts[cs->user] = std::make_pair(cs->list, ++cache_ghostseq);
+		cache_ghostorder.emplace_back(cs->user, cache_ghostseq);
+		while (cache_ghostorder.size() > CACHE_MAXGHOSTS) {
+			auto it = cache_ghosts.find(cache_ghostorder.front().first);
+			if (it != cache_ghosts.end() && it->second.second == cache_ghostorder.front().second)
+				cache_ghosts.erase(it);
+			cache_ghostorder.pop_front();
+		}
+	}
+	Cache_Free(cs->user);
+}
+
+/*
+============
+Cache_GhostHit
+
+A reload of something ARC threw out recently, grow the list it came from
+============
+*/
+static void Cache_GhostHit(cache_system_t *cs)
+{
+	auto it = cache_ghosts.find(cs->user);
+	size_t capacity;
+
+	if (it == cache_ghosts.end())
+		return;
+
+	capacity = Cache_Top() > Cache_Bottom() ? (size_t)(Cache_Top() - Cache_Bottom()) : 0;
+	if (it->second.first == CACHE_RECENT)
+		cache_arc_target = std::min(capacity, cache_arc_target + cs->size);
+	else
+		cache_arc_target = cache_arc_target > cs->size ? cache_arc_target - cs->size : 0;
+
+	cs->list = CACHE_FREQUENT;
+	cache_ghosts.erase(it);
+}
+
+/*
+============
+Cache_Touch
+
+Called on a hit
+============
+*/
+static void Cache_Touch(cache_system_t *cs)
+{
+	Cache_PolicyUnlink(cs);
+	cs->hits++;
+	cs->priority = cache_inflation + cs->hits * cs->cost / cs->size;
+	if (cache_policy == CACHE_ARC)
+		cs->list = CACHE_FREQUENT;
+	Cache_PolicyLink(cs);
+}
+
+/*
+============
+Cache_LinkEntry
+
+Carves a new entry out of the start of the hole below next and links it
+in address order, whatever is left of the hole goes back in the index.
+The caller hands it to the policy once the user is set
+============
+*/
+static cache_system_t *Cache_LinkEntry(byte *start, size_t size, cache_system_t *next)
+{
+	cache_system_t	*newcache;
+
+	newcache = (cache_system_t *)start;
+	memset(newcache, 0, sizeof(*newcache));
+	newcache->size = size;
+
+	newcache->next = next;
+	newcache->prev = next->prev;
+	next->prev->next = newcache;
+	next->prev = newcache;
+
+	if (next != &cache_head)
+		Cache_IndexGap(next);
+
+	cache_used += size;
+
+	return newcache;
 }
 
 /*
@@ -119,71 +404,46 @@ Cache_TryAlloc
 
 Looks for a free block of memory between the high and low hunk marks
 Size should already include the header and padding
+
+Holes between entries are taken best fit from the gap index, the holes
+at either end of the cache are only used when nothing inside fits
 ============
 */
 cache_system_t *Cache_TryAlloc(size_t size, bool nobottom)
 {
-	cache_system_t	*cs, *newcache;
-	
+	std::set<cachegap_t>::iterator gap;
+	cache_system_t	*cs;
+	byte			*start;
+
 	// is the cache completely empty?
 	if (!nobottom && cache_head.prev == &cache_head) {
 		if (hunk_size - hunk_high_used - hunk_low_used < size)
 			N_Error("Cache_TryAlloc: %li is greater then free hunk", size);
 
-		newcache = (cache_system_t *)(hunk_base + hunk_low_used);
-		memset(newcache, 0, sizeof(*newcache));
-		newcache->size = size;
-		
-		cache_head.prev = cache_head.next = newcache;
-		newcache->prev = newcache->next = &cache_head;
-		
-		Cache_MakeLRU(newcache);
-		return newcache;
+		return Cache_LinkEntry(Cache_Bottom(), size, &cache_head);
 	}
-	
-	// search from the bottom up for space
-	newcache = (cache_system_t *) (hunk_base + hunk_low_used);
-	cs = cache_head.next;
-	
-	do {
-		if (!nobottom || cs != cache_head.next) {
-			if ( (byte *)cs - (byte *)newcache >= size) {
-				// found space
-				memset(newcache, 0, sizeof(*newcache));
-				newcache->size = size;
-				
-				newcache->next = cs;
-				newcache->prev = cs->prev;
-				cs->prev->next = newcache;
-				cs->prev = newcache;
-				
-				Cache_MakeLRU(newcache);
-	
-				return newcache;
-			}
-		}
 
-		// continue looking		
-		newcache = (cache_system_t *)((byte *)cs + cs->size);
-		cs = cs->next;
+	// smallest hole between two entries that fits
+	gap = cache_gaps.lower_bound(cachegap_t(size, (cache_system_t *)NULL));
+	if (gap != cache_gaps.end()) {
+		cs = gap->second;
+		start = (byte *)cs - gap->first;
+		cache_gaps.erase(gap);
+		return Cache_LinkEntry(start, size, cs);
+	}
 
-	} while (cs != &cache_head);
-	
-	// try to allocate one at the very end
-	if (hunk_base + hunk_size - hunk_high_used - (byte *)newcache >= size) {
-		memset(newcache, 0, sizeof(*newcache));
-		newcache->size = size;
-		
-		newcache->next = &cache_head;
-		newcache->prev = cache_head.prev;
-		cache_head.prev->next = newcache;
-		cache_head.prev = newcache;
-		
-		Cache_MakeLRU(newcache);
-		
-		return ;
+	// below the first entry
+	cs = cache_head.next;
+	if (!nobottom && cs != &cache_head) {
+		if ((byte *)cs >= Cache_Bottom() && (size_t)((byte *)cs - Cache_Bottom()) >= size)
+			return Cache_LinkEntry(Cache_Bottom(), size, cs);
 	}
-	
+
+	// try to allocate one at the very end
+	start = cache_head.prev == &cache_head ? Cache_Bottom() : Cache_End(cache_head.prev);
+	if (Cache_Top() >= start && (size_t)(Cache_Top() - start) >= size)
+		return Cache_LinkEntry(start, size, &cache_head);
+
 	return NULL;		// couldn't allocate
 }
 
@@ -196,6 +456,7 @@ Throw everything out, so new data will be demand cached
 */
 void Cache_Flush(void)
 {
+	Cache_WaitPrefetches();
 	while (cache_head.next != &cache_head)
 		Cache_Free(cache_head.next->user); // reclaim the space
 }
@@ -210,7 +471,7 @@ Cache_Print
 void Cache_Print(void)
 {
 	cache_system_t	*cd;
-	
+
 	for (cd = cache_head.next ; cd != &cache_head ; cd = cd->next)
 		fprintf(stdout, "%8li : %s\n", cd->size, cd->name);
 }
@@ -225,16 +486,140 @@ void Cache_Report(void)
 {
 	fprintf(stdout, "%4.1f / %li megabyte data cache\n", (hunk_size - hunk_high_used - hunk_low_used) / (float)(1024*1024),
 		(hunk_size - hunk_high_used - hunk_low_used) >> 20);
+	fprintf(stdout, "%4.1f megabytes in use, %li holes\n", cache_used / (float)(1024*1024), (long)cache_gaps.size());
+	for (int i = 0; i < NUMCACHEPOLICIES; i++) {
+		const cachestats_t *stats = &cache_stats[i];
+		if (!stats->hits && !stats->misses)
+			continue;
+		fprintf(stdout, "%-4s%s: %lu hits, %lu misses (%4.1f%%), %lu evictions, %4.1f MiB loaded, %4.1f MiB evicted\n",
+			cache_policynames[i], i == cache_policy ? "*" : " ", stats->hits, stats->misses,
+			stats->hits * 100.0 / (stats->hits + stats->misses), stats->evictions,
+			stats->bytesloaded / (double)(1024*1024), stats->bytesevicted / (double)(1024*1024));
+	}
+}
+
+/*
+============
+Cache_SetPolicy
+
+Switches eviction policy, everything in the cache is kept and handed to
+the new one. Stats are kept per policy so they can be compared
+============
+*/
+void Cache_SetPolicy(cachepolicy_t policy)
+{
+	cache_system_t	*cs;
+
+	if (policy < CACHE_LRU || policy >= NUMCACHEPOLICIES)
+		N_Error("Cache_SetPolicy: bad policy %i", policy);
+	if (policy == cache_policy)
+		return;
+
+	for (cs = cache_head.next ; cs != &cache_head ; cs = cs->next) {
+		if (!cs->pending)
+			Cache_PolicyUnlink(cs);
+	}
+
+	cache_policy = policy;
+	cache_inflation = 0;
+	cache_ghosts.clear();
+	cache_ghostorder.clear();
+	cache_arc_target = 0;
+
+	for (cs = cache_head.next ; cs != &cache_head ; cs = cs->next) {
+		cs->priority = cs->hits * cs->cost / cs->size;
+		cs->list = cs->hits > 1 ? CACHE_FREQUENT : CACHE_RECENT;
+		if (!cs->pending)
+			Cache_PolicyLink(cs);
+	}
+}
+
+cachepolicy_t Cache_GetPolicy(void)
+{
+	return cache_policy;
+}
+
+// NUMCACHEPOLICIES if there's no policy by that name
+cachepolicy_t Cache_PolicyForName(const char *name)
+{
+	int i;
+
+	for (i = 0; i < NUMCACHEPOLICIES; i++) {
+		if (!strcmp(name, cache_policynames[i]))
+			break;
+	}
+	return (cachepolicy_t)i;
+}
+
+void Cache_GetStats(cachepolicy_t policy, cachestats_t *stats)
+{
+	*stats = cache_stats[policy];
+}
+
+/*
+============
+Cache_SetCost
+
+How expensive the entry is to bring back, in milliseconds of load and
+decode. Only GDSF looks at it, entries start at 1
+============
+*/
+void Cache_SetCost(cache_user_t *c, float cost)
+{
+	cache_system_t	*cs;
+
+	if (!c->data)
+		N_Error("Cache_SetCost: not allocated");
+
+	cs = ((cache_system_t *)c->data) - 1;
+	Cache_PolicyUnlink(cs);
+	cs->cost = cost > 0 ? cost : 1.0f;
+	cs->priority = cache_inflation + cs->hits * cs->cost / cs->size;
+	Cache_PolicyLink(cs);
 }
 
 /*
 ============
 Cache_Compact
 
+Slides every entry down against the low hunk mark so all of the free
+space ends up in one piece above the last entry. Entries are relocated
+through their user pointer, same as a zone purge would clear it.
+Entries still being prefetched stay put
 ============
 */
 void Cache_Compact(void)
 {
+	cache_system_t	*cs, *next, *dest;
+
+	dest = (cache_system_t *)Cache_Bottom();
+	for (cs = cache_head.next ; cs != &cache_head ; cs = next) {
+		next = cs->next;
+		if (cs < dest)
+			N_Error("Cache_Compact: %s is below the low hunk mark", cs->name);
+
+		// the i/o thread is writing into it, leave it where it is
+		if (cs->pending) {
+			dest = (cache_system_t *)Cache_End(cs);
+			continue;
+		}
+		if (cs != dest) {
+			memmove(dest, cs, cs->size);
+			dest->prev->next = dest;
+			dest->next->prev = dest;
+			dest->lru_prev->lru_next = dest;
+			dest->lru_next->lru_prev = dest;
+			dest->user->data = (void *)(dest+1);
+		}
+		dest = (cache_system_t *)Cache_End(dest);
+	}
+	cache_gaps.clear();
+
+	// the only holes left are the ones in front of pending entries
+	if (!cache_prefetches.empty()) {
+		for (cs = cache_head.next ; cs != &cache_head ; cs = cs->next)
+			Cache_IndexGap(cs);
+	}
 }
 
 /*
@@ -247,6 +632,17 @@ void Cache_Init(void)
 {
 	cache_head.next = cache_head.prev = &cache_head;
 	cache_head.lru_next = cache_head.lru_prev = &cache_head;
+	cache_freq.lru_next = cache_freq.lru_prev = &cache_freq;
+	cache_gaps.clear();
+	cache_used = 0;
+
+	cache_priority.clear();
+	cache_inflation = 0;
+	cache_ghosts.clear();
+	cache_ghostorder.clear();
+	cache_arc_target = 0;
+	cache_listbytes[CACHE_RECENT] = cache_listbytes[CACHE_FREQUENT] = 0;
+	memset(cache_stats, 0, sizeof(cache_stats));
 
 //	Cmd_AddCommand ("flush", Cache_Flush);
 }
@@ -260,20 +656,30 @@ Frees the memory and removes it from the LRU list
 */
 void Cache_Free(cache_user_t *c)
 {
-	cache_system_t	*cs;
+	cache_system_t	*cs, *next;
 
 	if (!c->data)
 		N_Error ("Cache_Free: not allocated");
 
 	cs = ((cache_system_t *)c->data) - 1;
+	next = cs->next;
+
+	// the holes on either side merge into one
+	Cache_UnindexGap(cs);
+	if (next != &cache_head)
+		Cache_UnindexGap(next);
 
 	cs->prev->next = cs->next;
 	cs->next->prev = cs->prev;
 	cs->next = cs->prev = NULL;
 
-	c->data = NULL;
+	if (next != &cache_head)
+		Cache_IndexGap(next);
+	cache_used -= cs->size;
+
+	Cache_PolicyUnlink(cs);
 
-	Cache_UnlinkLRU (cs);
+	c->data = NULL;
 }
 
 
@@ -285,15 +691,17 @@ Cache_Check
 void *Cache_Check(cache_user_t *c)
 {
 	cache_system_t	*cs;
-	if (!c->data)
+	if (!c->data && (cache_prefetches.empty() || !Cache_PollPrefetch(c))) {
+		cache_stats[cache_policy].misses++;
 		return NULL;
-	
+	}
+
 	cs = ((cache_system_t *)c->data) - 1;
-	
+	cache_stats[cache_policy].hits++;
+
 	// move to head of LRU
-	Cache_UnlinkLRU(cs);
-	Cache_MakeLRU(cs);
-	
+	Cache_Touch(cs);
+
 	return c->data;
 }
 
@@ -306,32 +714,66 @@ Cache_Alloc
 void *Cache_Alloc (cache_user_t *c, size_t size, const char* name)
 {
 	cache_system_t *cs;
+	size_t free;
+	bool compacted;
 	if (c->data)
 		N_Error ("Cache_Alloc: allready allocated, name: %s", name);
-	
+
 	if (size <= 0)
 		N_Error ("Cache_Alloc: size %li, name: %s", size, name);
-	
+
+	// already on its way, if the load failed fall through and let the caller fill it
+	if (cache_prefetches.count(c)) {
+		Cache_WaitPrefetch(c);
+		if (c->data)
+			return Cache_Check(c);
+	}
+
 	size = (size + sizeof(cache_system_t) + 15) & ~15;
 
-	// find memory for it	
+	// find memory for it
+	compacted = false;
 	while (1) {
 		cs = Cache_TryAlloc(size, false);
 		if (cs) {
 			strncpy(cs->name, name, sizeof(cs->name)-1);
 			c->data = (void *)(cs+1);
 			cs->user = c;
+			cs->cost = 1.0f;
+			cs->hits = 1;
+			cs->priority = cache_inflation + cs->cost / cs->size;
+			cs->list = CACHE_RECENT;
+			if (cache_policy == CACHE_ARC)
+				Cache_GhostHit(cs);
+			Cache_PolicyLink(cs);
 			break;
 		}
-		
-		// free the least recently used cahedat
-		if (cache_head.lru_prev == &cache_head)
+
+		// there's room, it's just in pieces. only worth sliding everything
+		// down when enough is loose that it won't be needed again right away
+		free = Cache_FreeSpace();
+		if (!compacted && free >= size && free >= (size_t)(Cache_Top() - Cache_Bottom()) / CACHE_COMPACT_FRACTION) {
+			Cache_Compact();
+			compacted = true;
+			continue;
+		}
+
+		// free whatever the policy likes least
+		cs = Cache_PolicyVictim();
+		if (!cs) {
+			// everything left is still being prefetched
+			if (!cache_prefetches.empty()) {
+				Cache_WaitPrefetches();
+				continue;
+			}
 			N_Error("Cache_Alloc: out of memory"); // not enough memory at all
-		
-		Cache_Free(cache_head.lru_prev->user);
+		}
+
+		Cache_Evict(cs);
 	}
-	
-	return Cache_Check(c);
+
+	cache_stats[cache_policy].bytesloaded += size;
+	return c->data;
 }
 
 void *Cache_Realloc(cache_user_t *c, size_t nsize, const char* name)
@@ -340,18 +782,253 @@ void *Cache_Realloc(cache_user_t *c, size_t nsize, const char* name)
 		N_Error("Cache_Realloc: pointer is null");
 	if (nsize == 0)
 		N_Error("Cache_Realloc: size is 0");
-	
+
 	cache_user_t user;
-	void *p = Cache_Alloc(&user, nsize, name);
+	cache_system_t *cs, *newcache;
+
+	user.data = NULL;
+	Cache_Alloc(&user, nsize, name);
+	newcache = ((cache_system_t*)user.data) - 1;
+
+	// hand the entry over to the caller, compaction writes through cs->user
+	Cache_PolicyUnlink(newcache);
 	if (c->data) {
-		cache_system_t* cs = ((cache_system_t*)c->data) - 1;
-		memcpy(user.data, c->data, cs->size);
+		cs = ((cache_system_t*)c->data) - 1;
+		memcpy(user.data, c->data, std::min(nsize, cs->size - sizeof(cache_system_t)));
+		newcache->cost = cs->cost;
+		newcache->hits = cs->hits;
+		newcache->priority = cs->priority;
+		newcache->list = cs->list;
 		Cache_Free(c);
 	}
-	return p;
+	newcache->user = c;
+	c->data = user.data;
+	Cache_PolicyLink(newcache);
+	return c->data;
 }
 
 void *Cache_Calloc(cache_user_t *c, size_t elemsize, size_t nelem, const char* name)
 {
 	return memset((Cache_Alloc)(c, elemsize * nelem, name), 0, elemsize * nelem);
-}
\ No newline at end of file
+}
+
+/*
+==============================================================================
+
+PREFETCH
+
+Cache_Prefetch reserves the entry on the calling thread and queues the
+loader for the i/o thread. The entry is pinned and kept off the eviction
+lists until the main thread sees it finish, only then does c->data get
+set, so Cache_Check keeps returning NULL while it's in flight.
+
+==============================================================================
+*/
+
+struct cacheprefetchorder_t {
+	bool operator()(const cacheprefetch_t *a, const cacheprefetch_t *b) const {
+		if (a->priority != b->priority)
+			return a->priority < b->priority;
+		return a->seq > b->seq;
+	}
+};
+
+static std::priority_queue<cacheprefetch_t *, std::vector<cacheprefetch_t *>, cacheprefetchorder_t> cache_prefetchqueue;
+static mutex cache_prefetchlock;
+static std::condition_variable_any cache_prefetchwake;	// queue has work or shutting down
+static std::condition_variable_any cache_prefetchdone;	// a load finished
+static thread cache_prefetchthread;
+static bool cache_prefetchquit;
+static uint64_t cache_prefetchseq;
+
+static void *Cache_PrefetchThread(void *)
+{
+	cacheprefetch_t *job;
+
+	while (1) {
+		{
+			std::unique_lock<mutex> lock(cache_prefetchlock);
+			cache_prefetchwake.wait(lock, [] { return cache_prefetchquit || !cache_prefetchqueue.empty(); });
+			if (cache_prefetchquit)
+				return NULL;
+			job = cache_prefetchqueue.top();
+			cache_prefetchqueue.pop();
+			job->state.store(PREFETCH_LOADING, std::memory_order_relaxed);
+		}
+
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		job->ok = job->loader((void *)(job->cs+1), job->size, job->arg);
+		job->cost = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		{
+			std::lock_guard<mutex> lock(cache_prefetchlock);
+			job->state.store(PREFETCH_DONE, std::memory_order_release);
+		}
+		cache_prefetchdone.notify_all();
+	}
+}
+
+/*
+============
+Cache_FinishPrefetch
+
+Main thread side of a finished load, publishes the data and hands the
+entry to the eviction policy, costed at what the loader took
+============
+*/
+static void Cache_FinishPrefetch(cacheprefetch_t *job)
+{
+	cache_user_t *c = job->user;
+	cache_system_t *cs = job->cs;
+
+	cache_prefetches.erase(c);
+
+	cs->pending = 0;
+	c->data = (void *)(cs+1);
+	Cache_PolicyLink(cs);
+	if (!job->ok) {
+		LOG_INFO("Cache_Prefetch: failed to load {}", cs->name);
+		Cache_Free(c);
+	}
+	else
+		Cache_SetCost(c, job->cost);
+	delete job;
+}
+
+static bool Cache_PollPrefetch(cache_user_t *c)
+{
+	auto it = cache_prefetches.find(c);
+
+	if (it == cache_prefetches.end() || it->second->state.load(std::memory_order_acquire) != PREFETCH_DONE)
+		return false;
+
+	Cache_FinishPrefetch(it->second);
+	return c->data != NULL;
+}
+
+static void Cache_WaitPrefetch(cache_user_t *c)
+{
+	auto it = cache_prefetches.find(c);
+	cacheprefetch_t *job;
+
+	if (it == cache_prefetches.end())
+		return;
+
+	job = it->second;
+	{
+		std::unique_lock<mutex> lock(cache_prefetchlock);
+		cache_prefetchdone.wait(lock, [job] { return job->state.load(std::memory_order_acquire) == PREFETCH_DONE; });
+	}
+	Cache_FinishPrefetch(job);
+}
+
+static void Cache_WaitPrefetches(void)
+{
+	while (!cache_prefetches.empty())
+		Cache_WaitPrefetch(cache_prefetches.begin()->first);
+}
+
+/*
+============
+Cache_Wait
+
+Blocks until a prefetch of c has landed, nothing to wait for if it isn't
+on its way. Cache_Check only polls, this is for when a caller needs the
+data now and would rather not load it twice
+============
+*/
+void Cache_Wait(cache_user_t *c)
+{
+	Cache_WaitPrefetch(c);
+}
+
+/*
+============
+Cache_Prefetch
+
+Reserves size bytes for c and fills them with loader on the i/o thread.
+Higher priority loads go first. Does nothing if c is already cached or
+on its way
+============
+*/
+void Cache_Prefetch(cache_user_t *c, size_t size, cacheloader_t loader, void *arg, int priority, const char *name)
+{
+	cacheprefetch_t *job;
+	cache_system_t *cs;
+
+	if (c->data || cache_prefetches.count(c))
+		return;
+	if (!loader)
+		N_Error("Cache_Prefetch: no loader for %s", name);
+
+	Cache_Alloc(c, size, name);
+	cs = ((cache_system_t *)c->data) - 1;
+
+	// pin it and hide it until it's loaded
+	Cache_PolicyUnlink(cs);
+	cs->pending = 1;
+	c->data = NULL;
+
+	job = new cacheprefetch_t;
+	job->user = c;
+	job->cs = cs;
+	job->loader = loader;
+	job->arg = arg;
+	job->size = size;
+	job->priority = priority;
+	job->seq = cache_prefetchseq++;
+	job->state.store(PREFETCH_QUEUED, std::memory_order_relaxed);
+	job->ok = false;
+	job->cost = 0;
+	cache_prefetches[c] = job;
+	cache_stats[cache_policy].prefetches++;
+
+	{
+		std::lock_guard<mutex> lock(cache_prefetchlock);
+		if (!cache_prefetchthread.joinable()) {
+			cache_prefetchquit = false;
+			cache_prefetchthread.create(Cache_PrefetchThread, NULL);
+		}
+		cache_prefetchqueue.push(job);
+	}
+	cache_prefetchwake.notify_one();
+}
+
+/*
+============
+Cache_UpdatePrefetch
+
+Publishes everything the i/o thread has finished, call once a frame so
+finished loads don't stay pinned until someone asks for them
+============
+*/
+void Cache_UpdatePrefetch(void)
+{
+	for (auto it = cache_prefetches.begin(); it != cache_prefetches.end(); ) {
+		cacheprefetch_t *job = it->second;
+		++it;
+		if (job->state.load(std::memory_order_acquire) == PREFETCH_DONE)
+			Cache_FinishPrefetch(job);
+	}
+}
+
+/*
+============
+Cache_Shutdown
+
+Finishes whatever is queued and stops the i/o thread
+============
+*/
+void Cache_Shutdown(void)
+{
+	Cache_WaitPrefetches();
+	if (!cache_prefetchthread.joinable())
+		return;
+
+	{
+		std::lock_guard<mutex> lock(cache_prefetchlock);
+		cache_prefetchquit = true;
+	}
+	cache_prefetchwake.notify_one();
+	cache_prefetchthread.join();
+}